@@ -43,6 +43,8 @@
 #include <geometric_shapes/mesh_operations.h>
 #include <geometric_shapes/shape_operations.h>
 #include <shape_msgs/Mesh.h>
+#include <lwr_pick_n_place/mesh_cache.hpp>
+#include <lwr_pick_n_place/scene_sync.hpp>
 #include <iostream>
 #include <sstream>
 
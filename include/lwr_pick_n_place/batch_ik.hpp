@@ -0,0 +1,98 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef BATCH_IK_HPP
+#define BATCH_IK_HPP
+
+#include <ros/ros.h>
+
+#include <moveit/robot_model_loader/robot_model_loader.h>
+#include <moveit/planning_scene/planning_scene.h>
+#include <geometry_msgs/Pose.h>
+
+#include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <string>
+#include <vector>
+
+// Solve IK for a set of candidate poses in parallel and rank the feasible ones.
+// Kinematics solvers are not thread safe, so every worker loads its own robot model
+// with its own solver instance.
+class BatchIk
+{
+public:
+
+  struct Solution
+  {
+    int index;                    // Index of the candidate pose
+    std::vector<double> joints;   // Group positions
+    double distance;              // Largest joint displacement from the start positions
+  };
+
+  // Order of the solutions, closest to the start positions first
+  static bool closerSolution(const Solution &a, const Solution &b);
+
+  // Constructor, loads nb_workers robot models with their kinematics solvers.
+  // Poses are expressed in base_frame and reached by tip_frame
+  BatchIk(const std::string &robot_description, const std::string &group_name, const std::string &base_frame,
+          const std::string &tip_frame, int nb_workers, int attempts, double timeout);
+
+  // False if no kinematics solver could be loaded for the group
+  bool isAvailable() const;
+
+  // Collision free solutions of the candidates, closest to the start positions first.
+  // Each solver starts from the start positions, so solutions stay close to them
+  std::vector<Solution> solve(const planning_scene::PlanningSceneConstPtr &scene, const std::vector<double> &start_joints,
+                              const std::vector<geometry_msgs::Pose> &poses);
+
+private:
+
+  struct Worker
+  {
+    robot_model_loader::RobotModelLoaderPtr loader;
+    const robot_model::JointModelGroup *group;
+  };
+
+  void runWorker(int index, const planning_scene::PlanningSceneConstPtr &scene, const std::vector<double> &start_joints,
+                 const std::vector<geometry_msgs::Pose> &poses, std::vector<Solution> &solutions, std::vector<char> &found);
+
+  std::string group_name_, base_frame_, tip_frame_;
+  int attempts_;
+  double timeout_;
+  std::vector<Worker> workers_;
+  boost::atomic<int> next_pose_;
+};
+
+#endif
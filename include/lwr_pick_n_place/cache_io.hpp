@@ -0,0 +1,81 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef CACHE_IO_HPP
+#define CACHE_IO_HPP
+
+#include <boost/cstdint.hpp>
+
+#include <fstream>
+#include <math.h>
+
+// Helpers shared by the caches and maps persisted to disk: raw values in the files,
+// quantized keys and hashes. Internal to the package, the files are not portable.
+namespace cache_io
+{
+  // Initial value of the hashes
+  const boost::uint64_t HASH_SEED = 14695981039346656037ULL;
+
+  template <class T>
+  void writeValue(std::ofstream &file, T value)
+  {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  template <class T>
+  T readValue(std::ifstream &file)
+  {
+    T value = T();
+    file.read(reinterpret_cast<char*>(&value), sizeof(value));
+    return value;
+  }
+
+  // Index of the cell of the value, on a grid of the given resolution
+  inline long quantize(double value, double resolution)
+  {
+    return static_cast<long>(floor(value/resolution + 0.5));
+  }
+
+  // FNV-1a, enough to tell scenes and meshes apart
+  inline void hashBytes(boost::uint64_t &hash, const void *data, size_t size)
+  {
+    const unsigned char *bytes = static_cast<const unsigned char*>(data);
+    for (size_t i=0; i<size; i++){
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,74 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef CALLBACK_EXECUTOR_HPP
+#define CALLBACK_EXECUTOR_HPP
+
+#include <ros/ros.h>
+#include <ros/callback_queue.h>
+
+#include <boost/shared_ptr.hpp>
+
+#include <map>
+#include <string>
+
+// Callback queues served by their own spinner threads, so that slow callbacks of one
+// kind (e.g. scene updates) do not delay the others (e.g. joint states).
+// Must be destroyed after the subscribers and action servers using its queues.
+class CallbackExecutor
+{
+public:
+
+  // Stops the spinners, then releases the queues
+  ~CallbackExecutor();
+
+  // Serve the global queue, used by the node handles by default, with nb_threads threads
+  void spinGlobalQueue(int nb_threads);
+
+  // Node handle whose callbacks go to the named queue, created on first use and served by nb_threads threads
+  ros::NodeHandle nodeHandle(const std::string &queue_name, int nb_threads, const std::string &ns = "");
+
+private:
+
+  struct Queue
+  {
+    boost::shared_ptr<ros::CallbackQueue> queue;
+    boost::shared_ptr<ros::AsyncSpinner> spinner;
+  };
+
+  Queue global_queue_;
+  std::map<std::string, Queue> queues_;
+};
+
+#endif
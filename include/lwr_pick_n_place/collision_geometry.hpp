@@ -0,0 +1,107 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef COLLISION_GEOMETRY_HPP
+#define COLLISION_GEOMETRY_HPP
+
+#include <ros/ros.h>
+
+#include <moveit_msgs/CollisionObject.h>
+#include <shape_msgs/Mesh.h>
+#include <shape_msgs/SolidPrimitive.h>
+#include <geometry_msgs/Pose.h>
+
+#include <lwr_pick_n_place/mesh_cache.hpp>
+
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <string>
+
+// Lighter collision geometry for the scene objects: the mesh decimated by vertex clustering,
+// its convex hull, or its bounding box. Simplified meshes are cached as STL files next to the
+// source mesh, and computed again when the source is more recent.
+class CollisionGeometry
+{
+public:
+
+  enum Mode {
+    FULL,         // The mesh as loaded
+    DECIMATED,    // Vertices merged on a grid of the tolerance size
+    CONVEX_HULL,  // Convex hull of the decimated mesh
+    BOX           // Bounding box in the mesh frame, as a mesh of 12 triangles
+  };
+
+  static Mode modeFromString(const std::string &mode);
+  static std::string modeToString(Mode mode);
+
+  // Constructor, tolerance is the grid size of the decimation (m)
+  CollisionGeometry(Mode mode = FULL, double tolerance = 0.001);
+
+  // Set the geometry of the object from the mesh resource (e.g. package://...) at the pose
+  bool makeGeometry(const std::string &resource, const geometry_msgs::Pose &pose, moveit_msgs::CollisionObject &object);
+
+  // Decimated mesh or convex hull of the resource, from its cache file if it is up to date
+  MeshCache::MeshConstPtr getSimplifiedMesh(const std::string &resource);
+
+  // Cache file of the simplified resource, e.g. package://lwr_pick_n_place/meshes/epingle.decimated_1.00mm.stl
+  std::string getCacheResource(const std::string &resource) const;
+
+  // Merge the vertices falling in the same cell of the grid, and drop the degenerate triangles
+  static shape_msgs::Mesh decimate(const shape_msgs::Mesh &mesh, double cell_size);
+
+  static bool convexHull(const shape_msgs::Mesh &mesh, shape_msgs::Mesh &hull);
+
+  // Box around the vertices, center is its pose in the mesh frame
+  static void boundingBox(const shape_msgs::Mesh &mesh, shape_msgs::SolidPrimitive &box, geometry_msgs::Pose &center);
+
+  // Triangles of the box at its center pose
+  static shape_msgs::Mesh boxMesh(const shape_msgs::SolidPrimitive &box, const geometry_msgs::Pose &center);
+
+  // File path of a package:// or file:// resource, empty if it cannot be resolved
+  static std::string resolvePath(const std::string &resource);
+
+  static bool writeStl(const std::string &path, const shape_msgs::Mesh &mesh);
+
+private:
+
+  Mode mode_;
+  double tolerance_;
+
+  // Simplified meshes which could not be written to their cache file
+  boost::mutex mutex_;
+  std::map<std::string, MeshCache::MeshConstPtr> meshes_;
+};
+
+#endif
@@ -0,0 +1,111 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef IK_SEED_STORE_HPP
+#define IK_SEED_STORE_HPP
+
+#include <ros/ros.h>
+
+#include <geometry_msgs/Pose.h>
+
+#include <boost/array.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+// Joint solutions of past IK requests, used to seed the requests for nearby poses.
+// Poses are hashed into cells of position_resolution meters and orientation_resolution
+// quaternion units, each cell keeps its last solution. The store can be persisted to disk.
+// Solutions must have one value per variable of the group, others are dropped.
+class IkSeedStore
+{
+public:
+
+  struct Stats
+  {
+    Stats() : hits(0), misses(0) {}
+    unsigned long hits;
+    unsigned long misses;
+  };
+
+  // Constructor, loads the seeds of the file if it is not empty
+  IkSeedStore(int nb_joints, double position_resolution, double orientation_resolution, int max_size, const std::string &file_name = "");
+
+  // Destructor, saves the seeds to the file if it is not empty
+  ~IkSeedStore();
+
+  // Solution stored for the closest pose in the neighbouring cells
+  bool lookup(const geometry_msgs::Pose &pose, std::vector<double> &seed);
+
+  // Remember the solution of a pose, the oldest cell is dropped when the store is full
+  void insert(const geometry_msgs::Pose &pose, const std::vector<double> &joints);
+
+  // Write/read all the seeds to/from the file
+  bool save() const;
+  bool load();
+
+  Stats getStats() const;
+  void logStats() const;
+
+private:
+
+  typedef boost::array<long, 6> CellKey;
+
+  struct Seed
+  {
+    geometry_msgs::Pose pose;
+    std::vector<double> joints;
+  };
+
+  CellKey makeKey(const geometry_msgs::Pose &pose) const;
+
+  void insertLocked(const geometry_msgs::Pose &pose, const std::vector<double> &joints);
+
+  int nb_joints_;
+  double position_resolution_;
+  double orientation_resolution_;
+  int max_size_;
+  std::string file_name_;
+
+  mutable boost::mutex mutex_;
+  std::map<CellKey, Seed> cells_;
+  std::deque<CellKey> insertion_order_;
+  Stats stats_;
+};
+
+#endif
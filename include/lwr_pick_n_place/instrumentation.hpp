@@ -0,0 +1,149 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef INSTRUMENTATION_HPP
+#define INSTRUMENTATION_HPP
+
+#include <ros/ros.h>
+
+#include <diagnostic_msgs/DiagnosticArray.h>
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Latency histogram with logarithmic buckets (sqrt(2) wide, starting at 1 us).
+// Only the owning thread writes it, readers may merge it at any time.
+class LatencyHistogram
+{
+public:
+  static const int NB_BUCKETS = 64;
+
+  LatencyHistogram();
+
+  // Add a duration (s)
+  void record(double duration);
+
+  // Add the content of this histogram to the passed bucket counts, total and max (us)
+  void mergeInto(std::vector<boost::uint64_t> &buckets, boost::uint64_t &total_us, boost::uint64_t &max_us) const;
+
+  // Upper bound of a bucket (s)
+  static double bucketUpperBound(int bucket);
+
+private:
+  boost::atomic<boost::uint64_t> buckets_[NB_BUCKETS];
+  boost::atomic<boost::uint64_t> total_us_, max_us_;
+};
+
+// Process-wide scoped timers and counters.
+// Every thread records in its own histograms, so the hot path takes no lock.
+class Instrumentation
+{
+public:
+
+  struct ProbeStats
+  {
+    ProbeStats() : count(0), mean(0.0), p50(0.0), p90(0.0), p99(0.0), max(0.0) {}
+    boost::uint64_t count;
+    double mean, p50, p90, p99, max;
+  };
+
+  // Get the unique instance
+  static Instrumentation& instance();
+
+  // Record a duration (s) for the probe
+  void record(const std::string &probe, double duration);
+
+  // Increment a counter
+  void count(const std::string &counter, long value = 1);
+
+  // Merge the data of all the threads
+  std::map<std::string, ProbeStats> getProbeStats() const;
+  std::map<std::string, long> getCounters() const;
+
+  // Human readable report of all the probes and counters
+  std::string report() const;
+
+  // Periodically publish the probes and counters as diagnostics
+  void startPublishing(ros::NodeHandle &nh, double period);
+
+private:
+
+  struct ThreadData
+  {
+    // The owning thread only locks to add a probe or a counter, readers lock to iterate
+    boost::mutex mutex;
+    std::map<std::string, boost::shared_ptr<LatencyHistogram> > histograms;
+    std::map<std::string, boost::shared_ptr<boost::atomic<long> > > counters;
+  };
+
+  Instrumentation();
+  Instrumentation(const Instrumentation&);
+  Instrumentation& operator=(const Instrumentation&);
+
+  // Data of the calling thread, registered on first use
+  ThreadData& threadData();
+
+  void publishDiagnostics(const ros::WallTimerEvent &event);
+
+  // The data outlives its thread, so short-lived threads still show in the reports
+  static void keepThreadData(ThreadData *) {}
+  boost::thread_specific_ptr<ThreadData> thread_data_;
+
+  mutable boost::mutex registry_mutex_;
+  std::vector<boost::shared_ptr<ThreadData> > registry_;
+
+  ros::Publisher diagnostics_publisher_;
+  ros::WallTimer diagnostics_timer_;
+};
+
+// Record the time spent in a scope
+class ScopedTimer
+{
+public:
+  ScopedTimer(const std::string &probe) : probe_(probe), start_(ros::WallTime::now()) {}
+  ~ScopedTimer() { Instrumentation::instance().record(probe_, (ros::WallTime::now() - start_).toSec()); }
+
+private:
+  std::string probe_;
+  ros::WallTime start_;
+};
+
+#endif
@@ -0,0 +1,64 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef JOB_ORDERING_HPP
+#define JOB_ORDERING_HPP
+
+#include <vector>
+
+// Order pick and place jobs to reduce the joint space travel between them.
+// A job goes from its pick joints to its place joints, only the travel from the
+// place of a job to the pick of the next one depends on the order.
+class JobOrdering
+{
+public:
+
+  // Travel cost between two joint positions: the largest joint displacement,
+  // which drives the duration of a synchronized joint motion
+  static double distance(const std::vector<double> &from, const std::vector<double> &to);
+
+  // Travel cost of doing the jobs in the given order from the start position
+  static double cost(const std::vector<double> &start, const std::vector<std::vector<double> > &picks,
+                     const std::vector<std::vector<double> > &places, const std::vector<int> &order);
+
+  // Greedy order: the next job is the one whose pick is the closest to the current position
+  static std::vector<int> nearestNeighbour(const std::vector<double> &start, const std::vector<std::vector<double> > &picks,
+                                           const std::vector<std::vector<double> > &places);
+
+  // Reverse sub sequences of the order as long as it reduces its cost, returns the final cost
+  static double twoOpt(const std::vector<double> &start, const std::vector<std::vector<double> > &picks,
+                       const std::vector<std::vector<double> > &places, std::vector<int> &order, int max_passes = 20);
+};
+
+#endif
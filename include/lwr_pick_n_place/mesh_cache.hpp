@@ -0,0 +1,97 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef MESH_CACHE_HPP
+#define MESH_CACHE_HPP
+
+#include <ros/ros.h>
+
+#include <geometric_shapes/mesh_operations.h>
+#include <geometric_shapes/shape_operations.h>
+
+#include <shape_msgs/Mesh.h>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <string>
+
+// Process-wide cache of the meshes used as collision objects.
+// Each resource is parsed and converted to a shape_msgs::Mesh only once,
+// then the same immutable message is shared between all the callers.
+class MeshCache
+{
+public:
+
+  typedef boost::shared_ptr<const shape_msgs::Mesh> MeshConstPtr;
+
+  struct Stats
+  {
+    Stats() : hits(0), misses(0), failures(0), load_time(0.0) {}
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long failures;
+    // Total wall time spent loading and converting meshes (s)
+    double load_time;
+  };
+
+  // Get the unique instance of the cache
+  static MeshCache& instance();
+
+  // Get the mesh corresponding to the resource (e.g. package://...), loading it on first use
+  // Returns an empty pointer if the resource could not be loaded
+  MeshConstPtr getMesh(const std::string &resource);
+
+  // Get the hit/miss and load time counters
+  Stats getStats() const;
+
+  // Print the counters
+  void logStats() const;
+
+  // Forget all the loaded meshes and reset the counters
+  void clear();
+
+private:
+
+  MeshCache() {}
+  MeshCache(const MeshCache&);
+  MeshCache& operator=(const MeshCache&);
+
+  mutable boost::mutex mutex_;
+  std::map<std::string, MeshConstPtr> meshes_;
+  Stats stats_;
+};
+
+#endif
@@ -0,0 +1,104 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef MOTION_HANDLE_HPP
+#define MOTION_HANDLE_HPP
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <vector>
+
+// Handle on a motion executed in the background. Copies share the same motion.
+class MotionHandle
+{
+public:
+
+  enum State { ACTIVE, SUCCEEDED, FAILED, CANCELLED };
+
+  typedef boost::function<void(State)> DoneCallback;
+  
+  // True once the motion was asked to stop, the cancel may come before the motion started
+  typedef boost::function<bool()> CancelCheck;
+  typedef boost::function<bool(const CancelCheck&)> Motion;
+
+  // Invalid handle, not attached to any motion
+  MotionHandle();
+
+  // Run the motion on its own thread. cancel is called to interrupt it, the motion must then return.
+  // The motion gets the cancel check so that it does not start what cancel could not stop yet
+  static MotionHandle start(const Motion &motion, const boost::function<void()> &cancel, 
+                            const DoneCallback &done_callback = DoneCallback());
+
+  // Handle on a motion which failed before starting, e.g. at planning
+  static MotionHandle failed(const DoneCallback &done_callback = DoneCallback());
+
+  bool isValid() const;
+  State getState() const;
+  bool isDone() const;
+
+  // Block until the motion is done, or for at most timeout seconds if positive. False on timeout
+  bool wait(double timeout = 0.0) const;
+
+  // Wait for the end of the motion, true if it succeeded
+  bool get() const;
+
+  // Interrupt the motion, which ends as CANCELLED unless it was already done
+  void cancel();
+
+  // Called once from the motion thread when it is done, or right away if it already is
+  void addDoneCallback(const DoneCallback &done_callback);
+
+private:
+
+  struct Shared
+  {
+    boost::mutex mutex;
+    boost::condition_variable done_cond;
+    State state;
+    bool cancel_requested;
+    boost::function<void()> cancel;
+    std::vector<DoneCallback> done_callbacks;
+  };
+
+  static void run(boost::shared_ptr<Shared> shared, Motion motion);
+  static bool isCancelRequested(const boost::shared_ptr<Shared> &shared);
+  static void finish(const boost::shared_ptr<Shared> &shared, bool success);
+
+  boost::shared_ptr<Shared> shared_;
+};
+
+#endif
@@ -59,13 +59,33 @@
 #include <moveit/robot_state/robot_state.h>
 #include <moveit/robot_state/conversions.h>
 #include <moveit/trajectory_processing/iterative_time_parameterization.h>
+#include <moveit/kinematic_constraints/utils.h>
 
 #include <tf/transform_broadcaster.h>
 #include <tf/transform_datatypes.h>
+#include <eigen_conversions/eigen_msg.h>
 
 #include <geometric_shapes/mesh_operations.h>
 #include <geometric_shapes/shape_operations.h>
 
+#include <lwr_pick_n_place/batch_ik.hpp>
+#include <lwr_pick_n_place/callback_executor.hpp>
+#include <lwr_pick_n_place/collision_geometry.hpp>
+#include <lwr_pick_n_place/ik_seed_store.hpp>
+#include <lwr_pick_n_place/instrumentation.hpp>
+#include <lwr_pick_n_place/job_ordering.hpp>
+#include <lwr_pick_n_place/mesh_cache.hpp>
+#include <lwr_pick_n_place/motion_handle.hpp>
+#include <lwr_pick_n_place/plan_cache.hpp>
+#include <lwr_pick_n_place/planner_race.hpp>
+#include <lwr_pick_n_place/reachability_map.hpp>
+#include <lwr_pick_n_place/roadmap.hpp>
+#include <lwr_pick_n_place/scene_snapshot.hpp>
+#include <lwr_pick_n_place/scene_sync.hpp>
+#include <lwr_pick_n_place/scene_transaction.hpp>
+#include <lwr_pick_n_place/target_pose_engine.hpp>
+#include <lwr_pick_n_place/trajectory_processor.hpp>
+
 #include <actionlib/client/simple_action_client.h>
 #include <actionlib/client/terminal_state.h>
 
@@ -77,12 +97,61 @@
 #include <geometry_msgs/PoseArray.h>
 
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <map>
 #include <math.h>
 
 # define M_PI 3.14159265358979323846  /* pi */
 
 typedef move_group_interface::MoveGroup::Plan MoveGroupPlan;
 
+// One step of a pick and place sequence: either a motion or a scene action
+struct MotionSegment
+{
+  enum Type { JOINT_TARGET, POSE_TARGET, LINEAR_PATH, START, ATTACH, DETACH };
+  
+  MotionSegment(Type type = START) : type(type), attach_waypoint(-1), blend_radius(-1.0) {}
+  
+  // True if the segment requires planning and executing a trajectory
+  bool isMotion() const { return type == JOINT_TARGET || type == POSE_TARGET || type == LINEAR_PATH || type == START; }
+  
+  Type type;
+  std::vector<double> joints;       // JOINT_TARGET
+  geometry_msgs::Pose pose;         // POSE_TARGET
+  std::vector<geometry_msgs::Pose> waypoints;  // LINEAR_PATH, reached in straight lines
+  std::string object_name;          // ATTACH, or LINEAR_PATH: attached when going through attach_waypoint
+  int attach_waypoint;
+  double blend_radius;              // Joint space radius of the corner with the next motion, negative to stop in between
+};
+
+// Pick an object, put it in the target and depose it
+struct PickJob
+{
+  PickJob(const std::string &object_id = "epingle", const std::string &target_id = "plaque") :
+    object_id(object_id), target_id(target_id) {}
+  
+  std::string object_id;
+  std::string target_id;
+  geometry_msgs::Pose depose_pose;
+};
+
+// End-effector targets of a pick and place job
+struct PickTargets
+{
+  geometry_msgs::Pose above_object, to_object;
+  geometry_msgs::Pose above_target, to_target;
+  geometry_msgs::Pose depose;
+};
+
+// How an epingle is grasped: rotation about its axis and height of the approach pose
+struct EpingleGrasp
+{
+  EpingleGrasp(double yaw = 0.0, double height = 0.12) : yaw(yaw), height(height) {}
+  
+  double yaw;
+  double height;
+};
+
 class PickNPlace
 {
 public:
@@ -92,7 +161,10 @@ public:
   // Constructor.
   PickNPlace();
   
-  // Update local planning scene variables
+  // Destructor, prints the instrumentation report
+  ~PickNPlace();
+  
+  // Update local planning scene variables, copies the whole scene with its meshes
   void getPlanningScene(moveit_msgs::PlanningScene& planning_scene, planning_scene::PlanningScenePtr& full_planning_scene);
   
   // Compute FK
@@ -101,18 +173,41 @@ public:
   // Compute IK
   bool compute_ik(const geometry_msgs::Pose pose, sensor_msgs::JointState &joints);
   
+  // Compute FK in process with the loaded robot model
+  bool compute_local_fk(const sensor_msgs::JointState joints, geometry_msgs::Pose &pose);
+  
+  // Compute IK in process with the loaded robot model and kinematics solver
+  bool compute_local_ik(const geometry_msgs::Pose pose, sensor_msgs::JointState &joints);
+  
   // Get current cartesian pose
   bool getCurrentCartesianPose(geometry_msgs::Pose &pose, std::string target_frame = "");
   
   // Get current joint state
   bool getCurrentJointPosition(std::vector<double> &joints);
   
-  // Execute a joint trajectory
-  bool executeJointTrajectory(const MoveGroupPlan mg_plan);
+  // Execute a joint trajectory, shortcut first unless the path itself matters
+  bool executeJointTrajectory(const MoveGroupPlan mg_plan, bool shortcut = true);
   
   // Stop current joint trajectory
   void stopJointTrajectory();
   
+  // Checked before executeJointTrajectory sends a trajectory, which is also stopped if the check
+  // becomes true while it runs. A cancel landing during planning then stops the motion. Set it
+  // before any motion runs
+  void setCancelCheck(const MotionHandle::CancelCheck &cancel_check);
+  
+  // Plan a trajectory to the passed joint values, from the current start state
+  bool planToJointPosition(const std::vector<double> target_joints, MoveGroupPlan &plan);
+  
+  // Plan a trajectory to the (x,y,z) position, from the current start state
+  bool planToCartesianPose(const geometry_msgs::Pose target_pose, MoveGroupPlan &plan);
+  
+  // Plan a trajectory to an IK solution, from the current start state
+  bool planToJointState(const sensor_msgs::JointState joints, MoveGroupPlan &plan);
+  
+  // Plan a trajectory to the home position, from the current start state
+  bool planToStart(MoveGroupPlan &plan);
+  
   // The robot tries to go to the passed joint values
   bool moveToJointPosition(const std::vector<double> target_joints);
   
@@ -125,30 +220,89 @@ public:
   // The robot tries to go to a random target
   bool moveToRandomTarget();
   
+  // Non-blocking versions of the motions: planning and execution run in the background, and
+  // cancelling the handle stops them. The PickNPlace must outlive the motion. Only one motion
+  // runs at a time, a new one fails right away while the previous handle is active
+  MotionHandle executeJointTrajectoryAsync(const MoveGroupPlan mg_plan, bool shortcut = true,
+                                           const MotionHandle::DoneCallback &done_callback = MotionHandle::DoneCallback());
+  MotionHandle moveToJointPositionAsync(const std::vector<double> target_joints, 
+                                        const MotionHandle::DoneCallback &done_callback = MotionHandle::DoneCallback());
+  MotionHandle moveToCartesianPoseAsync(const geometry_msgs::Pose target_pose, 
+                                        const MotionHandle::DoneCallback &done_callback = MotionHandle::DoneCallback());
+  MotionHandle moveToStartAsync(const MotionHandle::DoneCallback &done_callback = MotionHandle::DoneCallback());
+  
   // From current pose, move arm vertically to target z
   bool verticalMove(double target_z);
   
   // From current pose, move arm vertically to target z
   bool verticalMoveBis(double target_z);
   
+  // Plan straight end-effector lines through the waypoints with the cartesian path service
+  bool planLinearPath(const std::vector<geometry_msgs::Pose> &waypoints, MoveGroupPlan &plan);
+  
+  // From current pose, move the end-effector in a straight line to the target
+  bool moveLinear(const geometry_msgs::Pose target_pose);
+  
+  // Same, with a planned motion instead when the line cannot be planned
+  bool moveLinearOrPlanned(const geometry_msgs::Pose target_pose);
+  
+  // Pose moved by distance along an axis expressed in its own frame, e.g. to approach along the tool axis
+  static geometry_msgs::Pose offsetPose(const geometry_msgs::Pose pose, const tf::Vector3 axis, double distance);
+  
   // Get the collision object corresponding to object name
   bool getCollisionObject(const std::string obj_name, moveit_msgs::CollisionObject &object);
   
+  // Build the collision object of a cylinder / box / "epingle" / "plaque" at the specified location
+  bool makeCylinderObject(const geometry_msgs::Pose object_pose, moveit_msgs::CollisionObject &collision_object, const std::string id = "cylinder");
+  bool makeBoxObject(const geometry_msgs::Pose object_pose, moveit_msgs::CollisionObject &collision_object, const std::string id = "box");
+  bool makeEpingleObject(const geometry_msgs::Pose object_pose, moveit_msgs::CollisionObject &collision_object, const std::string id = "epingle");
+  bool makePlaqueObject(const geometry_msgs::Pose object_pose, moveit_msgs::CollisionObject &collision_object, const std::string id = "plaque");
+  
   // Add a cylinder in the scene at the specified location
-  bool addCylinderObject(const geometry_msgs::Pose object_pose);
+  bool addCylinderObject(const geometry_msgs::Pose object_pose, const std::string id = "cylinder");
   
   // Add a box in the scene at the specified location
-  bool addBoxObject(const geometry_msgs::Pose object_pose);
+  bool addBoxObject(const geometry_msgs::Pose object_pose, const std::string id = "box");
   
   // Add an "epingle" in the scene at the specified location
-  bool addEpingleObject(const geometry_msgs::Pose object_pose);
+  bool addEpingleObject(const geometry_msgs::Pose object_pose, const std::string id = "epingle");
   
   // Add an "plaque" in the scene at the specified location
-  bool addPlaqueObject(const geometry_msgs::Pose object_pose);
+  bool addPlaqueObject(const geometry_msgs::Pose object_pose, const std::string id = "plaque");
+  
+  // Publish all the operations of the transaction as one diff and wait until the scene reflects them
+  bool applySceneTransaction(const SceneTransaction &transaction);
+  
+  // Id of the index-th instance of an object type, e.g. "epingle_3"
+  static std::string makeInstanceId(const std::string &prefix, int index);
+  
+  // Add one "epingle" per pose in a single diff, with generated ids
+  bool addEpingleTray(const std::vector<geometry_msgs::Pose> &poses, std::vector<std::string> &ids, const std::string prefix = "epingle");
   
   // Look for the object name in the scene and return its collision object
   moveit_msgs::CollisionObjectPtr getCollisionObject(std::string object_name);
+  
+  // Pose of an object of the world, read from the monitored scene without copying its geometry
+  bool getObjectPose(const std::string obj_name, geometry_msgs::PoseStamped &pose);
+  
+  // Ids of the objects in the world / attached to the robot
+  bool getWorldObjectIds(std::vector<std::string> &ids);
+  bool getAttachedObjectIds(std::vector<std::string> &ids);
 
+  // Get the end-effector poses used to go on top of / to an epingle or a hole
+  bool getAboveEpinglePose(const std::string obj_name, geometry_msgs::Pose &target_pose);
+  bool getToEpinglePose(const std::string obj_name, geometry_msgs::Pose &target_pose);
+  bool getAbovePlaquePose(const std::string obj_name, geometry_msgs::Pose &target_pose);
+  bool getToPlaquePose(const std::string obj_name, geometry_msgs::Pose &target_pose);
+  
+  // All the targets of a job from a single scene lookup
+  bool getPickTargets(const PickJob &job, PickTargets &targets);
+  
+  // Solve IK for the grasps around the epingle axis, above and at the epingle, and keep the feasible
+  // one closest to the start of the motion: the plan start state when planning ahead, else the current
+  // joints. The grasp is used by the poses above / to the epingle afterwards
+  bool selectEpingleGrasp(const std::string obj_name, std::vector<double> &above_joints);
+  
   // Go on top of an epingle
   bool moveAboveEpingle(const std::string obj_name);
   
@@ -168,32 +322,218 @@ public:
   bool detachObject();
   
   // Remove all objects of the world and also the ones attached to the robot
-  void cleanObjects();
+  bool cleanObjects();
+  
+  // Write the world and attached objects of the scene to a file
+  bool saveSceneSnapshot(const std::string &file_name);
+  
+  // Replace all the objects of the scene by the ones of a snapshot file, in a single diff
+  bool restoreSceneSnapshot(const std::string &file_name);
+  
+  // Wait until the monitored scene, updated after the sequence number, satisfies the predicate
+  bool waitForScene(const SceneSynchronizer::ScenePredicate &predicate, unsigned long sequence);
+  
+  // Run a sequence of segments. When pipelined, the next motion is planned from the
+  // predicted end state of the current one while it executes, and replanned if the
+  // robot does not end where it was expected to. Motions blending into the next one are
+  // sent together as one trajectory
+  bool executeSequence(const std::vector<MotionSegment> &segments, bool pipelined = true);
+  
+  // Segments of a pick and place job, without going back to start
+  bool getPickJobSegments(const PickJob &job, std::vector<MotionSegment> &segments);
+  
+  // Order the jobs to reduce the travel from a depose to the next pick, from IK solutions
+  bool orderPickJobs(std::vector<PickJob> &jobs);
+  
+  // Run the jobs one after the other then go back to start, returns the number of successful jobs
+  int runPickJobs(const std::vector<PickJob> &jobs, bool pipelined = true);
+  
+  // Effective configuration, after the parameters were read and fallbacks applied
+  const std::string& getPlannerId() const { return planner_id_; }
+  double getMaxPlanningTime() const { return max_planning_time_; }
+  double getCartesianMaxStep() const { return cart_path_srv_req_.max_step; }
+  double getApproachBlendRadius() const { return approach_blend_radius_; }
+  double getDeposeBlendRadius() const { return depose_blend_radius_; }
+  int getIkAttempts() const { return ik_attempts_; }
+  bool usesLocalKinematics() const { return use_local_kinematics_; }
+  bool usesPlanCache() const { return plan_cache_.get() != NULL; }
 
   //*** Class variables ***//
   
-  ros::AsyncSpinner spinner_;
+  // Declared first, its queues must outlive the subscribers using them
+  CallbackExecutor callback_executor_;
   
   boost::shared_ptr<tf::TransformListener> tf_;
   boost::scoped_ptr<move_group_interface::MoveGroup> group_;
   boost::scoped_ptr<planning_scene_monitor::PlanningSceneMonitor> planning_scene_monitor_;
 
+  // Requests are templates copied by each call, the lookahead planning runs IK during an execution
   ros::ServiceClient ik_service_client_, fk_service_client_, cartesian_path_service_client_;
   moveit_msgs::GetPositionIK::Request ik_srv_req_;
-  moveit_msgs::GetPositionIK::Response ik_srv_resp_;
   moveit_msgs::GetPositionFK::Request fk_srv_req_;
-  moveit_msgs::GetPositionFK::Response fk_srv_resp_;
   moveit_msgs::GetCartesianPath::Request cart_path_srv_req_;
   moveit_msgs::GetCartesianPath::Response cart_path_srv_resp_;
   
   ros::Publisher attached_object_publisher_, planning_scene_diff_publisher_;
+  SubscriberWaiter subscriber_waiter_;
+  boost::scoped_ptr<SceneSynchronizer> scene_sync_;
+  double scene_sync_timeout_;
   
   moveit_msgs::PlanningScene planning_scene_msg_;
   planning_scene::PlanningScenePtr full_planning_scene_;
   
-  std::string base_frame_, ee_frame_, group_name_;
-  double gripping_offset_, dz_offset_;
+  robot_model::RobotModelConstPtr robot_model_;
+  const robot_model::JointModelGroup* joint_model_group_;
+  bool use_local_kinematics_;
+  int ik_attempts_;
+  double ik_timeout_;
+  
+  boost::scoped_ptr<BatchIk> batch_ik_;
+  boost::scoped_ptr<CollisionGeometry> collision_geometry_;
+  boost::scoped_ptr<IkSeedStore> ik_seed_store_;
+  boost::scoped_ptr<PlanCache> plan_cache_;
+  boost::scoped_ptr<PlannerRace> planner_race_;
+  planning_pipeline::PlanningPipelinePtr planning_pipeline_;
+  boost::scoped_ptr<ReachabilityMap> reachability_map_;
+  boost::scoped_ptr<Roadmap> roadmap_;
+  boost::scoped_ptr<TrajectoryProcessor> trajectory_processor_;
+  
+  std::string base_frame_, ee_frame_, group_name_, planner_id_;
+  double max_planning_time_;
+  double gripping_offset_, dz_offset_, pipeline_joint_tolerance_, cartesian_min_fraction_;
+  double approach_blend_radius_, depose_blend_radius_;
   MoveGroupPlan next_plan_;
+  
+  // The roadmap is saved back with the edges checked during the run
+  std::string roadmap_file_;
+  double roadmap_timeout_;
+  
+  // Offsets of the targets relative to each object type
+  TargetPoseEngine target_poses_;
+  
+  // Grasp candidates, and the grasp selected for each epingle
+  int grasp_yaw_steps_;
+  std::vector<double> grasp_approach_heights_;
+  std::map<std::string, EpingleGrasp> epingle_grasps_;
+
+private:
+  
+  // IK solution of the group for a pose, in the order of the group variables
+  bool computeGroupIK(const geometry_msgs::Pose pose, std::vector<double> &positions);
+  
+  // Poses of the objects in the base frame, from one lock of the scene
+  bool getObjectPosesInBase(const std::vector<std::string> &ids, std::vector<Eigen::Isometry3d> &poses);
+  
+  // Target of a stage for an object pose, with the grasp selected for the object if any
+  bool makeTargetPose(const std::string obj_name, const Eigen::Isometry3d &object_pose, TargetPoseEngine::Stage stage, 
+                      geometry_msgs::Pose &target_pose);
+  bool getTargetPose(const std::string obj_name, TargetPoseEngine::Stage stage, geometry_msgs::Pose &target_pose);
+  
+  // Targets of a job from the poses of its object and target
+  bool makePickTargets(const PickJob &job, const std::vector<Eigen::Isometry3d> &object_poses, PickTargets &targets);
+  
+  // Grasp selection for an object pose already looked up
+  bool selectEpingleGrasp(const std::string obj_name, const Eigen::Isometry3d &object_pose, std::vector<double> &above_joints);
+  
+  // Drop the grasps of the objects added, moved, removed or detached by a scene diff
+  void forgetEpingleGrasps(const moveit_msgs::PlanningScene &diff);
+  
+  // Seed of an IK request from the past solutions, or from the reachability map
+  bool lookupIkSeed(const geometry_msgs::Pose &pose, std::vector<double> &seed);
+  
+  // Positions of the group joints in a joint state of the robot
+  void jointStateToGroupPositions(const sensor_msgs::JointState &joints, std::vector<double> &positions);
+  
+  // Plan from the passed state instead of the current one, until cleared. The motions are then
+  // planned without the move group, which may be executing the current motion
+  void setPlanStartState(const moveit_msgs::RobotState &start_state);
+  void clearPlanStartState();
+  
+  // Look for a valid cached plan from the plan start state to the goal, which it must reach
+  // within the goal tolerance of the group
+  bool lookupCachedPlan(const std::string &goal_key, const moveit_msgs::Constraints &goal, MoveGroupPlan &plan);
+  
+  // Goals of the cached plans, with the goal tolerances of the group
+  moveit_msgs::Constraints jointGoalConstraints(const std::vector<double> &joint_vals);
+  moveit_msgs::Constraints poseGoalConstraints(const geometry_msgs::Pose &pose);
+  
+  // Store a plan from the plan start state to the goal
+  void storeCachedPlan(const std::string &goal_key, const MoveGroupPlan &plan);
+  
+  // Cache key of a motion from the plan start state in the scene
+  std::string makePlanCacheKey(const planning_scene::PlanningScene &scene, const std::string &goal_key, moveit_msgs::RobotState &start_state);
+  
+  // Plan to the target set in the move group, instrumented
+  bool planWithMoveGroup(MoveGroupPlan &plan);
+  
+  // Plan to the joint values through the roadmap, from the plan start state
+  bool planWithRoadmap(const std::vector<double> &joint_vals, MoveGroupPlan &plan);
+  
+  // Plan to the group joint values on a snapshot of the scene, from the plan start state, without
+  // using the move group. Several planners are raced when configured
+  bool planWithPipeline(const std::vector<double> &joint_vals, MoveGroupPlan &plan);
+  
+  // Plan a motion segment from the start state currently set in the move group
+  bool planSegment(const MotionSegment &segment, MoveGroupPlan &plan);
+  
+  // Plan a linear path grasping an object on the way: the path after the grasp waypoint is
+  // planned with the object attached, then both parts are merged into one trajectory
+  bool planGraspPath(const MotionSegment &segment, MoveGroupPlan &plan);
+  
+  // Apply a scene action segment (attach or detach)
+  bool applySceneSegment(const MotionSegment &segment);
+  
+  // Robot state at the end of the plan, including the scene actions run right after it. An ATTACH action
+  // grasps the object where the end-effector goes through its attach waypoint, or at the end of the plan
+  void predictEndState(const MoveGroupPlan &plan, const std::vector<MotionSegment> &actions, moveit_msgs::RobotState &state);
+  
+  // Check that the arm actually reached the end of the plan
+  bool reachedEndOfPlan(const MoveGroupPlan &plan);
+  
+  // Shorten and retime a trajectory in place, it is left as is if that fails
+  void processTrajectory(MoveGroupPlan &plan, bool shortcut);
+  
+  // Send a trajectory to the controllers as is
+  bool sendTrajectory(const MoveGroupPlan &plan);
+  
+  // Plan the motions following a blending segment and merge them with its plan into one trajectory.
+  // index is moved to the last merged segment, and segment describes the merged motion for its execution
+  bool blendSegments(const std::vector<MotionSegment> &segments, int &index, MoveGroupPlan &plan, MotionSegment &segment);
+  
+  // Execute the plan of a segment, attaching objects on the way for linear paths
+  bool executeSegment(const MotionSegment &segment, const MoveGroupPlan &plan);
+  
+  // Last trajectory point the state went through, following the trajectory from a point already passed
+  int getTrajectoryProgress(const MoveGroupPlan &plan, const robot_state::RobotState &state, int from_index);
+  
+  // Trajectory point at which the end-effector goes through the waypoint
+  int getWaypointIndex(const MoveGroupPlan &plan, const geometry_msgs::Pose &waypoint);
+  
+  // Plan of a non-blocking motion, run from its thread
+  typedef boost::function<bool(MoveGroupPlan&)> Planner;
+  
+  // Start a non-blocking motion, unless the previous one is still active
+  MotionHandle startMotion(const MotionHandle::Motion &motion, const MotionHandle::DoneCallback &done_callback);
+  
+  // Motions of the handles: plan, then process and send the trajectory unless the handle was cancelled meanwhile
+  bool planAndSendTrajectory(const Planner planner, const MotionHandle::CancelCheck &is_cancelled);
+  bool processAndSendTrajectory(const MoveGroupPlan mg_plan, bool shortcut, const MotionHandle::CancelCheck &is_cancelled);
+  
+  // Send a trajectory from the thread of a motion handle, unless the handle is already cancelled
+  bool sendTrajectoryUnlessCancelled(const MoveGroupPlan mg_plan, const MotionHandle::CancelCheck &is_cancelled);
+  
+  // Execute a segment / send a trajectory, storing the result (used from a background thread)
+  void executeSegmentInto(const MotionSegment segment, const MoveGroupPlan mg_plan, bool *success);
+  void sendTrajectoryInto(const MoveGroupPlan mg_plan, bool *success);
+  
+  moveit_msgs::RobotState plan_start_state_;
+  bool has_plan_start_state_;
+  
+  MotionHandle::CancelCheck cancel_check_;
+  
+  // Last non-blocking motion started
+  MotionHandle async_motion_;
+  boost::mutex async_motion_mutex_;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,104 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef PICK_N_PLACE_ACTION_SERVER_HPP
+#define PICK_N_PLACE_ACTION_SERVER_HPP
+
+#include <lwr_pick_n_place/pick_n_place.hpp>
+#include <lwr_pick_n_place/PickPlaceAction.h>
+
+#include <actionlib/server/action_server.h>
+
+#include <boost/thread.hpp>
+#include <deque>
+
+typedef actionlib::ActionServer<lwr_pick_n_place::PickPlaceAction> PickPlaceActionServer;
+typedef PickPlaceActionServer::GoalHandle PickPlaceGoalHandle;
+
+class PickNPlaceActionServer
+{
+public:
+  
+  //*** Class functions ***//
+  
+  // Constructor, the PickNPlace instance is created once and reused for every goal
+  PickNPlaceActionServer(const std::string &action_name);
+  
+  // Destructor, cancels the queued goals and stops the worker thread
+  ~PickNPlaceActionServer();
+  
+  // A new goal is accepted and queued, it never blocks the callback thread
+  void goalCallback(PickPlaceGoalHandle goal_handle);
+  
+  // Remove a queued goal or stop the running one
+  void cancelCallback(PickPlaceGoalHandle goal_handle);
+  
+private:
+  
+  // Process the queued goals one after another
+  void workerLoop();
+  
+  // Run all the stages of a pick and place for the goal
+  void runGoal(PickPlaceGoalHandle &goal_handle);
+  
+  // Publish the feedback for a stage, returns false if the goal was canceled
+  bool startStage(PickPlaceGoalHandle &goal_handle, const std::string &stage, int index);
+  
+  // Check whether the running goal was asked to stop
+  bool cancelRequested();
+  
+  // Detach the object held when a goal stops before depositing it
+  void releaseObject();
+  
+  // Remove a goal from a list, false if it was not in it
+  static bool removeGoal(std::deque<PickPlaceGoalHandle> &goals, const PickPlaceGoalHandle &goal_handle);
+  
+  //*** Class variables ***//
+  
+  PickNPlace pick_n_place_;
+  CallbackExecutor callback_executor_;
+  ros::NodeHandle nh_;
+  PickPlaceActionServer action_server_;
+  
+  boost::mutex mutex_;
+  boost::condition_variable queue_cond_;
+  std::deque<PickPlaceGoalHandle> goal_queue_;
+  // Goals in goalCallback before being queued, and the ones canceled meanwhile
+  std::deque<PickPlaceGoalHandle> accepting_goals_, canceled_goals_;
+  PickPlaceGoalHandle active_goal_;
+  bool has_active_goal_, cancel_requested_, shutdown_;
+  boost::thread worker_thread_;
+};
+
+#endif
@@ -0,0 +1,115 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef PLAN_CACHE_HPP
+#define PLAN_CACHE_HPP
+
+#include <ros/ros.h>
+
+#include <moveit_msgs/RobotTrajectory.h>
+#include <moveit_msgs/RobotState.h>
+#include <moveit_msgs/Constraints.h>
+#include <moveit/planning_scene/planning_scene.h>
+
+#include <geometry_msgs/Pose.h>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/cstdint.hpp>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+// Cache of planned trajectories for the motions repeated at every cycle.
+// Entries are keyed on the quantized start joint values, the goal and a hash of the
+// planning scene, and can be persisted to disk between runs.
+class PlanCache
+{
+public:
+
+  struct Stats
+  {
+    Stats() : hits(0), misses(0), rejected(0) {}
+    unsigned long hits;
+    unsigned long misses;
+    // Entries found but in collision with the current scene
+    unsigned long rejected;
+  };
+
+  // Constructor, loads the entries of the file if it is not empty
+  PlanCache(double joint_resolution, int max_size, const std::string &file_name = "");
+
+  // Destructor, saves the entries to the file if it is not empty
+  ~PlanCache();
+
+  // Build the cache key of a motion
+  std::string makeKey(const std::vector<double> &start_joints, const std::string &goal_key, boost::uint64_t scene_hash) const;
+
+  // Goal keys for the different kinds of targets
+  std::string jointGoalKey(const std::vector<double> &joints) const;
+  static std::string poseGoalKey(const geometry_msgs::Pose &pose);
+  static std::string namedGoalKey(const std::string &name);
+
+  // Hash of the world objects and the attached bodies of the scene, with their geometry and poses
+  static boost::uint64_t hashScene(const planning_scene::PlanningScene &scene);
+
+  // Look for a trajectory, revalidated against the scene before it is returned.
+  // Keys are quantized, so an entry is a miss unless it ends within the goal constraints
+  bool lookup(const std::string &key, const planning_scene::PlanningScene &scene, const moveit_msgs::RobotState &start_state,
+              const moveit_msgs::Constraints &goal, const std::string &group_name, moveit_msgs::RobotTrajectory &trajectory);
+
+  // Store a trajectory, the oldest entry is dropped when the cache is full
+  void insert(const std::string &key, const moveit_msgs::RobotTrajectory &trajectory);
+
+  // Write/read all the entries to/from the file
+  bool save() const;
+  bool load();
+
+  Stats getStats() const;
+  void logStats() const;
+
+private:
+
+  double joint_resolution_;
+  int max_size_;
+  std::string file_name_;
+
+  mutable boost::mutex mutex_;
+  std::map<std::string, moveit_msgs::RobotTrajectory> entries_;
+  std::deque<std::string> insertion_order_;
+  Stats stats_;
+};
+
+#endif
@@ -0,0 +1,99 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef PLANNER_RACE_HPP
+#define PLANNER_RACE_HPP
+
+#include <ros/ros.h>
+
+#include <moveit/planning_pipeline/planning_pipeline.h>
+#include <moveit/planning_interface/planning_interface.h>
+#include <moveit/planning_scene/planning_scene.h>
+#include <moveit_msgs/RobotTrajectory.h>
+
+#include <boost/thread.hpp>
+
+#include <string>
+#include <vector>
+
+// Run several planners concurrently on the same planning problem.
+// Every worker owns its planning pipeline, so the planners do not share any state
+// and the losers can be terminated as soon as the race is decided.
+class PlannerRace
+{
+public:
+
+  enum Mode {
+    FIRST_VALID,  // Keep the first plan found
+    SHORTEST      // Keep the shortest plan found within the budget
+  };
+
+  // Constructor, loads attempts_per_planner pipelines for each planner id.
+  // The planning plugin and the planner configurations are read in the ns namespace
+  PlannerRace(const robot_model::RobotModelConstPtr &robot_model, const std::string &ns,
+              const std::vector<std::string> &planner_ids, int attempts_per_planner, Mode mode, double budget);
+
+  // Race all the planners on the request, in a snapshot of the scene
+  bool plan(const planning_scene::PlanningSceneConstPtr &scene, const planning_interface::MotionPlanRequest &request,
+            moveit_msgs::RobotTrajectory &trajectory);
+
+  // Length of a trajectory in joint space
+  static double pathLength(const moveit_msgs::RobotTrajectory &trajectory);
+
+  static Mode modeFromString(const std::string &mode);
+
+private:
+
+  struct Worker
+  {
+    std::string planner_id;
+    planning_pipeline::PlanningPipelinePtr pipeline;
+    bool done, success;
+    moveit_msgs::RobotTrajectory trajectory;
+  };
+
+  // Run the planner of a worker, then wake up the caller
+  void runWorker(int index, const planning_scene::PlanningSceneConstPtr &scene,
+                 const planning_interface::MotionPlanRequest &request);
+
+  std::vector<Worker> workers_;
+  Mode mode_;
+  double budget_;
+  int first_success_;
+
+  boost::mutex mutex_;
+  boost::condition_variable done_cond_;
+};
+
+#endif
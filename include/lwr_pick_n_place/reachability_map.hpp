@@ -0,0 +1,111 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef REACHABILITY_MAP_HPP
+#define REACHABILITY_MAP_HPP
+
+#include <ros/ros.h>
+
+#include <geometry_msgs/Pose.h>
+
+#include <Eigen/Geometry>
+
+#include <boost/cstdint.hpp>
+
+#include <string>
+#include <vector>
+
+// Reachable end-effector poses of a group over a voxel grid of its workspace, in the base frame.
+// Each voxel records, for a set of approach directions (the z axis of the end-effector), whether
+// a sample reached it and the joints of that sample. The rotation about the approach axis is not
+// discretized. Generated offline by sampling the joint space (see generate_reachability_map).
+class ReachabilityMap
+{
+public:
+
+  // Empty map
+  ReachabilityMap();
+
+  // Grid of cubic voxels of the resolution covering [-extent, extent] around the base, with
+  // nb_directions approach directions spread on the sphere, for groups of nb_joints joints
+  ReachabilityMap(double extent, double resolution, int nb_directions, int nb_joints);
+
+  // Record a reached pose and the joints reaching it, the first sample of an entry is kept
+  void insert(const Eigen::Affine3d &pose, const std::vector<double> &joints);
+
+  // False if no sample reached the voxel of the pose, or its neighbours, with the closest approach direction.
+  // Poses out of the grid are out of reach
+  bool isReachable(const geometry_msgs::Pose &pose) const;
+
+  // True only if no sample reached the voxel of the pose, or its neighbours, with any approach direction.
+  // The directions are coarse, so a pose can be reachable even if isReachable is false. Poses out of the
+  // grid were not sampled and are not known to be out of reach
+  bool isOutOfReach(const geometry_msgs::Pose &pose) const;
+
+  // Joints of the sample of the pose entry, or of a neighbouring voxel
+  bool lookupSeed(const geometry_msgs::Pose &pose, std::vector<double> &seed) const;
+
+  // Number of entries reached at least once
+  size_t size() const;
+  size_t capacity() const;
+  bool empty() const;
+
+  // Write/read the map to/from the file, a map of another number of joints is not loaded
+  bool save(const std::string &file_name) const;
+  bool load(const std::string &file_name, int nb_joints);
+
+private:
+
+  static const boost::uint32_t NO_ENTRY = 0xffffffff;
+
+  void init();
+
+  // Index of the entry of a voxel and a direction, false out of the grid
+  bool getVoxel(const Eigen::Vector3d &position, int voxel[3]) const;
+  int getDirection(const Eigen::Vector3d &approach) const;
+  size_t getIndex(int x, int y, int z, int direction) const;
+
+  // Sample of the entry of the pose, or of a neighbouring voxel, NO_ENTRY if none
+  boost::uint32_t findSample(const geometry_msgs::Pose &pose) const;
+
+  double extent_, resolution_;
+  int nb_voxels_, nb_directions_, nb_joints_;
+  std::vector<Eigen::Vector3d> directions_;
+
+  // Sample index of each entry, and joints of the samples
+  std::vector<boost::uint32_t> entries_;
+  std::vector<float> samples_;
+};
+
+#endif
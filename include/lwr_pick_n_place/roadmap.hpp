@@ -0,0 +1,137 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef ROADMAP_HPP
+#define ROADMAP_HPP
+
+#include <ros/ros.h>
+
+#include <moveit/planning_scene/planning_scene.h>
+#include <moveit/robot_model/robot_model.h>
+#include <trajectory_msgs/JointTrajectory.h>
+
+#include <boost/thread/mutex.hpp>
+#include <boost/cstdint.hpp>
+
+#include <set>
+#include <string>
+#include <vector>
+
+// Probabilistic roadmap of the group for the fixed cell layout, queried instead of planning from scratch.
+// Milestones are sampled once and connected to their nearest neighbours without any check, the edges
+// are only checked when a query first goes through them (lazy PRM) and the result is kept with the roadmap.
+// The static objects only change with the layout of the cell, the other objects of the scene are checked
+// separately and only block the edges they collide with, until they move.
+class Roadmap
+{
+public:
+
+  // Constructor, the edges are checked every resolution radians
+  Roadmap(const robot_model::RobotModelConstPtr &robot_model, const std::string &group_name,
+          int nb_neighbours = 10, double resolution = 0.02);
+
+  // Sample milestones free of self collision and of collision with the static objects of the scene
+  void build(const planning_scene::PlanningSceneConstPtr &scene, const std::vector<std::string> &static_ids, int nb_milestones);
+
+  // Shortest path of valid edges between two group configurations, checked against the scene.
+  // The path starts at start and ends at goal, it is not timed
+  bool query(const planning_scene::PlanningSceneConstPtr &scene, const std::vector<double> &start, const std::vector<double> &goal,
+             trajectory_msgs::JointTrajectory &path, double timeout);
+
+  // Write/read the milestones, the edges and their static state to/from the file
+  bool save(const std::string &file_name) const;
+  bool load(const std::string &file_name);
+
+  size_t size() const;
+  bool empty() const;
+
+private:
+
+  enum EdgeState { UNKNOWN = 0, VALID = 1, INVALID = 2 };
+
+  struct Edge
+  {
+    Edge(boost::uint32_t from, boost::uint32_t to, float length) : from(from), to(to), length(length), static_state(UNKNOWN), dynamic_state(UNKNOWN) {}
+    boost::uint32_t from;
+    boost::uint32_t to;
+    float length;
+    // Against the self collisions and the static objects, kept with the roadmap
+    boost::uint8_t static_state;
+    // Against the other objects and the attached bodies, forgotten when they change
+    boost::uint8_t dynamic_state;
+  };
+
+  // Split the scene into its static and dynamic parts, forget the edge states of the parts that changed
+  void updateScenes(const planning_scene::PlanningSceneConstPtr &scene);
+
+  // Check the edge against the parts of the scene it was not checked against yet
+  bool checkEdge(Edge &edge);
+  bool isSegmentValid(const double *from, const double *to, bool dynamic);
+
+  // A* search over the edges not known to be invalid
+  bool searchPath(boost::uint32_t start, boost::uint32_t goal, std::vector<boost::uint32_t> &edge_path) const;
+
+  // Add a query configuration connected to its nearest milestones among the first nb_milestones
+  boost::uint32_t addNode(const std::vector<double> &positions, size_t nb_milestones);
+  void addEdge(boost::uint32_t from, boost::uint32_t to);
+
+  // Indices of the k closest among the first nb_milestones milestones
+  void nearest(const double *positions, int k, size_t nb_milestones, std::vector<boost::uint32_t> &indices) const;
+  bool isConnected(boost::uint32_t from, boost::uint32_t to) const;
+
+  const double *milestone(boost::uint32_t index) const;
+  double distance(const double *a, const double *b) const;
+
+  robot_model::RobotModelConstPtr robot_model_;
+  std::string group_name_;
+  const robot_model::JointModelGroup *joint_model_group_;
+  int nb_joints_;
+  int nb_neighbours_;
+  double resolution_;
+
+  mutable boost::mutex mutex_;
+  std::vector<double> milestones_;
+  std::vector<Edge> edges_;
+  std::vector<std::vector<boost::uint32_t> > adjacency_;
+
+  std::vector<std::string> static_ids_;
+  boost::uint64_t static_hash_;
+  boost::uint64_t dynamic_hash_;
+  planning_scene::PlanningScenePtr static_scene_;
+  planning_scene::PlanningScenePtr dynamic_scene_;
+  bool has_dynamic_objects_;
+  bool has_attached_bodies_;
+};
+
+#endif
@@ -0,0 +1,75 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef SCENE_SNAPSHOT_HPP
+#define SCENE_SNAPSHOT_HPP
+
+#include <ros/ros.h>
+
+#include <moveit/planning_scene/planning_scene.h>
+#include <moveit_msgs/CollisionObject.h>
+#include <moveit_msgs/AttachedCollisionObject.h>
+
+#include <boost/cstdint.hpp>
+
+#include <string>
+#include <vector>
+
+// Binary snapshot of the world and attached objects of a planning scene, with their geometry and poses.
+// Meshes are stored once per content hash, with their vertices aligned so that they are read in place
+// from the memory mapped file.
+class SceneSnapshot
+{
+public:
+
+  // Take the objects of the scene
+  void capture(const planning_scene::PlanningScene &scene);
+
+  // Write/read the objects to/from the file
+  bool save(const std::string &file_name) const;
+  bool load(const std::string &file_name);
+
+  const std::vector<moveit_msgs::CollisionObject>& getWorldObjects() const;
+  const std::vector<moveit_msgs::AttachedCollisionObject>& getAttachedObjects() const;
+
+  // Hash of the vertices and triangles of a mesh
+  static boost::uint64_t hashMesh(const shape_msgs::Mesh &mesh);
+
+private:
+
+  std::vector<moveit_msgs::CollisionObject> world_objects_;
+  std::vector<moveit_msgs::AttachedCollisionObject> attached_objects_;
+};
+
+#endif
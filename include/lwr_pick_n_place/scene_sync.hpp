@@ -0,0 +1,105 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef SCENE_SYNC_HPP
+#define SCENE_SYNC_HPP
+
+#include <ros/ros.h>
+
+#include <moveit/planning_scene_monitor/planning_scene_monitor.h>
+
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <string>
+#include <vector>
+
+// Wait for the subscribers of publishers without polling.
+// Publishers must be advertised with connectCallback() as their connect callback.
+class SubscriberWaiter
+{
+public:
+
+  // Callback to pass to NodeHandle::advertise
+  ros::SubscriberStatusCallback connectCallback();
+
+  // Block until the publisher has nb_subscribers subscribers, false on timeout
+  bool waitForSubscribers(const ros::Publisher &publisher, int nb_subscribers, double timeout);
+
+private:
+
+  void onConnect(const ros::SingleSubscriberPublisher &publisher);
+
+  boost::mutex mutex_;
+  boost::condition_variable connect_cond_;
+};
+
+// Wait until the planning scene monitor reflects a change, using its update callbacks
+class SceneSynchronizer
+{
+public:
+
+  typedef boost::function<bool(const planning_scene::PlanningScene&)> ScenePredicate;
+
+  // Constructor, registers an update callback on the monitor
+  SceneSynchronizer(planning_scene_monitor::PlanningSceneMonitor *monitor);
+
+  // Number of scene updates received so far, to read before publishing a diff
+  unsigned long getSequence();
+
+  // Block until an update after the sequence number makes the predicate true.
+  // On timeout, the predicate is checked one last time
+  bool waitFor(const ScenePredicate &predicate, unsigned long sequence, double timeout);
+
+  // Common predicates
+  static ScenePredicate objectsInWorld(const std::vector<std::string> &ids);
+  static ScenePredicate objectsNotInWorld(const std::vector<std::string> &ids);
+  static ScenePredicate objectAttached(const std::string &id);
+  static ScenePredicate objectNotAttached(const std::string &id);
+  static ScenePredicate sceneEmpty();
+
+private:
+
+  void onSceneUpdate(planning_scene_monitor::PlanningSceneMonitor::SceneUpdateType type);
+
+  bool checkPredicate(const ScenePredicate &predicate);
+
+  planning_scene_monitor::PlanningSceneMonitor *monitor_;
+  boost::mutex mutex_;
+  boost::condition_variable update_cond_;
+  unsigned long sequence_;
+};
+
+#endif
@@ -0,0 +1,94 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef SCENE_TRANSACTION_HPP
+#define SCENE_TRANSACTION_HPP
+
+#include <moveit_msgs/PlanningScene.h>
+#include <moveit_msgs/CollisionObject.h>
+#include <moveit_msgs/AttachedCollisionObject.h>
+
+#include <lwr_pick_n_place/scene_sync.hpp>
+
+#include <string>
+#include <vector>
+
+// Accumulate world and attached object changes to publish them as a single planning scene diff
+class SceneTransaction
+{
+public:
+
+  // Constructor
+  SceneTransaction();
+
+  // Add an object to the world, replacing any object with the same id
+  void addObject(const moveit_msgs::CollisionObject &object);
+
+  // Move an object of the world to the poses of the given object, its geometry is ignored
+  void moveObject(const moveit_msgs::CollisionObject &object);
+
+  // Remove an object from the world
+  void removeObject(const std::string &id);
+
+  // Detach an object from the robot, it goes back to the world where it was held
+  void detachObject(const std::string &id);
+
+  // Attach an object with its geometry to a link of the robot
+  void attachObject(const moveit_msgs::AttachedCollisionObject &object);
+
+  // Number of operations accumulated so far
+  size_t size() const;
+  bool empty() const;
+
+  // Drop all the accumulated operations
+  void clear();
+
+  // The diff to publish on the planning_scene topic
+  const moveit_msgs::PlanningScene& getDiff() const;
+
+  // True once every operation of the transaction is reflected in a scene
+  SceneSynchronizer::ScenePredicate getPredicate() const;
+
+private:
+
+  moveit_msgs::PlanningScene diff_;
+  std::vector<std::string> present_ids_;
+  std::vector<std::string> removed_ids_;
+  std::vector<std::string> detached_ids_;
+  std::vector<std::string> attached_ids_;
+  // Added or moved objects with the poses of their shapes only
+  std::vector<moveit_msgs::CollisionObject> placed_objects_;
+};
+
+#endif
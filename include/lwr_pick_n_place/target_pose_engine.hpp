@@ -0,0 +1,94 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef TARGET_POSE_ENGINE_HPP
+#define TARGET_POSE_ENGINE_HPP
+
+#include <ros/ros.h>
+#include <geometry_msgs/Pose.h>
+
+#include <Eigen/Geometry>
+
+#include <map>
+#include <string>
+#include <vector>
+
+// End-effector targets relative to the objects. Each object type has an approach
+// (ABOVE) and a grasp or insertion (AT) offset, expressed in the object frame.
+class TargetPoseEngine
+{
+public:
+
+  enum Stage { ABOVE, AT };
+
+  // Offsets of the "epingle" and "plaque" types
+  TargetPoseEngine();
+
+  // Read the offsets of the types listed in <ns>/target_types from <ns>/target_offsets/<type>/above
+  // and <ns>/target_offsets/<type>/at, as [x, y, z, roll, pitch, yaw]
+  void loadParams(const ros::NodeHandle &nh);
+
+  void setOffsets(const std::string &type, const Eigen::Isometry3d &above, const Eigen::Isometry3d &at);
+
+  // Type of an object id: the longest registered type it is an instance of, e.g. "epingle" for "epingle_3"
+  bool getType(const std::string &object_id, std::string &type) const;
+
+  // Offset of a stage for an object id
+  bool getOffset(const std::string &object_id, Stage stage, Eigen::Isometry3d &offset) const;
+
+  // Target for an object pose, with the offset rotated by yaw about the object z axis
+  static Eigen::Isometry3d apply(const Eigen::Isometry3d &object_pose, const Eigen::Isometry3d &offset, double yaw = 0.0);
+
+  // Same rotation as the offset, at another height along the object z axis
+  static Eigen::Isometry3d atHeight(const Eigen::Isometry3d &offset, double height);
+
+  // Offset from a translation and roll, pitch, yaw angles (same convention as tf::Quaternion::setRPY)
+  static Eigen::Isometry3d makeOffset(double x, double y, double z, double roll, double pitch, double yaw);
+
+  static void toMsg(const Eigen::Isometry3d &pose, geometry_msgs::Pose &msg);
+
+private:
+
+  struct Offsets
+  {
+    Eigen::Isometry3d above, at;
+  };
+
+  // Offset from a parameter, or the default if the parameter is missing or malformed
+  static Eigen::Isometry3d loadOffset(const ros::NodeHandle &nh, const std::string &name, const Eigen::Isometry3d &default_offset);
+
+  std::map<std::string, Offsets> offsets_;
+};
+
+#endif
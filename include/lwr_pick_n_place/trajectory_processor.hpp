@@ -0,0 +1,112 @@
+//| This file is a part of the sferes2 framework.
+//| Copyright 2016, ISIR / Universite Pierre et Marie Curie (UPMC)
+//| Main contributor(s): Jimmy Da Silva, jimmy.dasilva@isir.upmc.fr
+//|
+//| This software is a computer program whose purpose is to facilitate
+//| experiments in evolutionary computation and evolutionary robotics.
+//|
+//| This software is governed by the CeCILL license under French law
+//| and abiding by the rules of distribution of free software. You
+//| can use, modify and/ or redistribute the software under the terms
+//| of the CeCILL license as circulated by CEA, CNRS and INRIA at the
+//| following URL "http://www.cecill.info".
+//|
+//| As a counterpart to the access to the source code and rights to
+//| copy, modify and redistribute granted by the license, users are
+//| provided only with a limited warranty and the software's author,
+//| the holder of the economic rights, and the successive licensors
+//| have only limited liability.
+//|
+//| In this respect, the user's attention is drawn to the risks
+//| associated with loading, using, modifying and/or developing or
+//| reproducing the software by the user in light of its specific
+//| status of free software, that may mean that it is complicated to
+//| manipulate, and that also therefore means that it is reserved for
+//| developers and experienced professionals having in-depth computer
+//| knowledge. Users are therefore encouraged to load and test the
+//| software's suitability as regards their requirements in conditions
+//| enabling the security of their systems and/or data to be ensured
+//| and, more generally, to use and operate it in the same conditions
+//| as regards security.
+//|
+//| The fact that you are presently reading this means that you have
+//| had knowledge of the CeCILL license and that you accept its terms.
+
+#ifndef TRAJECTORY_PROCESSOR_HPP
+#define TRAJECTORY_PROCESSOR_HPP
+
+#include <ros/ros.h>
+
+#include <moveit/planning_scene/planning_scene.h>
+#include <moveit/robot_model/robot_model.h>
+#include <moveit/robot_trajectory/robot_trajectory.h>
+#include <moveit/trajectory_processing/iterative_time_parameterization.h>
+#include <moveit_msgs/RobotState.h>
+#include <moveit_msgs/RobotTrajectory.h>
+
+#include <boost/random/mersenne_twister.hpp>
+
+#include <string>
+#include <vector>
+
+// Post-process planned trajectories before they are executed: drop the redundant waypoints,
+// shortcut and smooth the path in a planning scene, then retime within the scaled joint limits.
+class TrajectoryProcessor
+{
+public:
+
+  // Constructor, scalings are fractions of the velocity/acceleration limits of the model
+  TrajectoryProcessor(const robot_model::RobotModelConstPtr &robot_model, const std::string &group_name,
+                      double velocity_scaling = 1.0, double acceleration_scaling = 1.0, double waypoint_tolerance = 1e-4);
+
+  // Process the trajectory in place, it starts from start_state.
+  // The path is only shortcut and smoothed when a scene is given to check it against
+  bool process(const moveit_msgs::RobotState &start_state, moveit_msgs::RobotTrajectory &trajectory,
+               const planning_scene::PlanningSceneConstPtr &scene = planning_scene::PlanningSceneConstPtr());
+
+  // Merge consecutive trajectories into one timed trajectory that does not stop between them. The corner at the end
+  // of the i-th trajectory is rounded within blend_radii[i] radians when the rounded path is valid in the scene,
+  // and passed through without stopping otherwise
+  bool blend(const moveit_msgs::RobotState &start_state, const std::vector<moveit_msgs::RobotTrajectory> &trajectories,
+             const std::vector<double> &blend_radii, const planning_scene::PlanningScene &scene, moveit_msgs::RobotTrajectory &blended);
+  
+  // Remove the waypoints equal to the previous one or lying on the segment between their neighbours,
+  // returns the number of removed waypoints
+  int removeRedundantWaypoints(trajectory_msgs::JointTrajectory &trajectory) const;
+
+  // Replace parts of the path by straight joint space segments free of collision, until the deadline.
+  // Returns the number of shortcuts
+  int shortcut(const planning_scene::PlanningScene &scene, trajectory_msgs::JointTrajectory &trajectory, const ros::WallTime &deadline);
+
+  // Move the waypoints towards the middle of their neighbours while the path stays free of collision, until the deadline.
+  // Returns the number of moved waypoints
+  int smooth(const planning_scene::PlanningScene &scene, trajectory_msgs::JointTrajectory &trajectory, const ros::WallTime &deadline);
+
+  void setVelocityScaling(double velocity_scaling);
+  void setAccelerationScaling(double acceleration_scaling);
+
+  // CPU time given to shortcutting and smoothing, 0 to disable them, and the joint step of the collision checks
+  void setSmoothing(double budget, double resolution);
+
+private:
+
+  // Replace the waypoints within radius of the corner by a parabolic arc, if it is free of collision
+  bool roundCorner(const planning_scene::PlanningScene &scene, robot_state::RobotState &state, trajectory_msgs::JointTrajectory &trajectory,
+                   int corner, double radius);
+  
+  // Check the straight joint space segment between two waypoints, every resolution_ radians
+  bool isSegmentValid(const planning_scene::PlanningScene &scene, robot_state::RobotState &state, const std::vector<std::string> &joint_names,
+                      const std::vector<double> &from, const std::vector<double> &to) const;
+
+  robot_model::RobotModelConstPtr robot_model_;
+  std::string group_name_;
+  double velocity_scaling_;
+  double acceleration_scaling_;
+  double waypoint_tolerance_;
+  double smoothing_budget_;
+  double resolution_;
+  boost::mt19937 random_generator_;
+  trajectory_processing::IterativeParabolicTimeParameterization time_parameterization_;
+};
+
+#endif
@@ -4,7 +4,9 @@ int main(int argc, char **argv)
 {
   ros::init(argc, argv, "add_object");
   ros::NodeHandle nh, nh_param("~");
-  ros::AsyncSpinner spinner(1);
+  int spinner_threads;
+  nh_param.param<int>("spinner_threads", spinner_threads, 1);
+  ros::AsyncSpinner spinner(spinner_threads);
   spinner.start();
 
   double x_goal, y_goal, z_goal, angle;
@@ -13,12 +15,10 @@ int main(int argc, char **argv)
   // Load the planning_scene and make sure we can publish the scene //
   moveit_msgs::PlanningScene planning_scene;
   moveit::planning_interface::PlanningSceneInterface planning_scene_interface;
-  ros::WallDuration sleep_t(0.5);
-  ros::Publisher planning_scene_diff_publisher = nh.advertise<moveit_msgs::PlanningScene>("planning_scene", 1);
-  while(planning_scene_diff_publisher.getNumSubscribers() < 1)
-  {
-    sleep_t.sleep();
-  }
+  SubscriberWaiter subscriber_waiter;
+  ros::Publisher planning_scene_diff_publisher = nh.advertise<moveit_msgs::PlanningScene>("planning_scene", 1, subscriber_waiter.connectCallback());
+  while(ros::ok() && !subscriber_waiter.waitForSubscribers(planning_scene_diff_publisher, 1, 5.0))
+    ROS_INFO("Waiting for planning scene");
 
   std::vector<std::string> objects_names = planning_scene_interface.getKnownObjectNames();
   int nb_bins = objects_names.size();
@@ -32,12 +32,11 @@ int main(int argc, char **argv)
   collision_object.id = object_id;
 
   // Define the mesh //
-  shapes::Mesh* m = shapes::createMeshFromResource("package://lwr_pick_n_place/meshes/bin_small.stl");
-
-  shape_msgs::Mesh co_mesh;
-  shapes::ShapeMsg co_mesh_msg;
-  shapes::constructMsgFromShape(m,co_mesh_msg);
-  co_mesh = boost::get<shape_msgs::Mesh>(co_mesh_msg);
+  MeshCache::MeshConstPtr co_mesh = MeshCache::instance().getMesh("package://lwr_pick_n_place/meshes/bin_small.stl");
+  if (!co_mesh){
+    ros::shutdown();
+    return 1;
+  }
 
   // Define bin's position //
   geometry_msgs::Pose mesh_pose;
@@ -64,7 +63,7 @@ int main(int argc, char **argv)
   ROS_INFO_STREAM(info.str());
 
   // Attach object operation //
-  collision_object.meshes.push_back(co_mesh);
+  collision_object.meshes.push_back(*co_mesh);
   collision_object.mesh_poses.push_back(mesh_pose);
   collision_object.operation = collision_object.ADD;
 
@@ -0,0 +1,105 @@
+#include <lwr_pick_n_place/batch_ik.hpp>
+#include <lwr_pick_n_place/job_ordering.hpp>
+
+#include <moveit/robot_state/robot_state.h>
+#include <eigen_conversions/eigen_msg.h>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+
+namespace {
+  // The solution comes from the model of the worker, check it with a state of the scene model
+  bool isSolutionCollisionFree(const planning_scene::PlanningScene *scene, robot_state::RobotState *scene_state,
+                               const robot_model::JointModelGroup *scene_group, const double *ik_solution)
+  {
+    scene_state->setJointGroupPositions(scene_group, ik_solution);
+    scene_state->update();
+    return !scene->isStateColliding(*scene_state, scene_group->getName());
+  }
+}
+
+bool BatchIk::closerSolution(const Solution &a, const Solution &b)
+{
+  return a.distance < b.distance;
+}
+
+BatchIk::BatchIk(const std::string &robot_description, const std::string &group_name, const std::string &base_frame,
+                 const std::string &tip_frame, int nb_workers, int attempts, double timeout) :
+  group_name_(group_name),
+  base_frame_(base_frame),
+  tip_frame_(tip_frame),
+  attempts_(attempts),
+  timeout_(timeout),
+  next_pose_(0)
+{
+  for (int i=0; i<nb_workers; i++){
+    Worker worker;
+    worker.loader.reset(new robot_model_loader::RobotModelLoader(robot_description, true));
+    worker.group = worker.loader->getModel() ? worker.loader->getModel()->getJointModelGroup(group_name_) : 0;
+    if (!worker.group || !worker.group->getSolverInstance()){
+      ROS_WARN_STREAM("No kinematics solver loaded for group "<< group_name_ <<", batch IK is disabled");
+      workers_.clear();
+      return;
+    }
+    workers_.push_back(worker);
+  }
+  ROS_INFO("Batch IK ready with %zu workers", workers_.size());
+}
+
+bool BatchIk::isAvailable() const
+{
+  return !workers_.empty();
+}
+
+void BatchIk::runWorker(int index, const planning_scene::PlanningSceneConstPtr &scene, const std::vector<double> &start_joints,
+                        const std::vector<geometry_msgs::Pose> &poses, std::vector<Solution> &solutions, std::vector<char> &found)
+{
+  const Worker &worker = workers_[index];
+  robot_state::RobotState state(worker.loader->getModel());
+  state.setToDefaultValues();
+  robot_state::RobotState scene_state(scene->getCurrentState());
+  const robot_model::JointModelGroup *scene_group = scene->getRobotModel()->getJointModelGroup(group_name_);
+  moveit::core::GroupStateValidityCallbackFn validity = boost::bind(&isSolutionCollisionFree, scene.get(), &scene_state, scene_group, _3);
+  
+  // Each worker takes the next pose until there are none left, results go to their own slot
+  for (int i = next_pose_++; i < (int)poses.size(); i = next_pose_++){
+    state.setJointGroupPositions(worker.group, start_joints);
+    state.update();
+    Eigen::Affine3d target_pose;
+    tf::poseMsgToEigen(poses[i], target_pose);
+    target_pose = state.getFrameTransform(base_frame_) * target_pose;
+    if (!state.setFromIK(worker.group, target_pose, tip_frame_, attempts_, timeout_, validity))
+      continue;
+    
+    solutions[i].index = i;
+    state.copyJointGroupPositions(worker.group, solutions[i].joints);
+    solutions[i].distance = JobOrdering::distance(start_joints, solutions[i].joints);
+    found[i] = 1;
+  }
+}
+
+std::vector<BatchIk::Solution> BatchIk::solve(const planning_scene::PlanningSceneConstPtr &scene, const std::vector<double> &start_joints,
+                                              const std::vector<geometry_msgs::Pose> &poses)
+{
+  ros::WallTime start = ros::WallTime::now();
+  std::vector<Solution> slots(poses.size());
+  std::vector<char> found(poses.size(), 0);
+  
+  next_pose_ = 0;
+  boost::thread_group threads;
+  for (int i=0; i<workers_.size() && i<poses.size(); i++)
+    threads.create_thread(boost::bind(&BatchIk::runWorker, this, i, boost::cref(scene), boost::cref(start_joints), 
+                                      boost::cref(poses), boost::ref(slots), boost::ref(found)));
+  threads.join_all();
+  
+  std::vector<Solution> solutions;
+  for (int i=0; i<slots.size(); i++)
+    if (found[i])
+      solutions.push_back(slots[i]);
+  std::stable_sort(solutions.begin(), solutions.end(), &BatchIk::closerSolution);
+  
+  ROS_INFO("Batch IK: %zu/%zu candidates feasible in %.3f s", solutions.size(), poses.size(), (ros::WallTime::now() - start).toSec());
+  return solutions;
+}
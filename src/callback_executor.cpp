@@ -0,0 +1,35 @@
+#include <lwr_pick_n_place/callback_executor.hpp>
+
+#include <algorithm>
+
+CallbackExecutor::~CallbackExecutor()
+{
+  if (global_queue_.spinner)
+    global_queue_.spinner->stop();
+  for (std::map<std::string, Queue>::iterator it = queues_.begin(); it != queues_.end(); ++it)
+    it->second.spinner->stop();
+}
+
+void CallbackExecutor::spinGlobalQueue(int nb_threads)
+{
+  if (global_queue_.spinner)
+    return;
+  global_queue_.spinner.reset(new ros::AsyncSpinner(std::max(nb_threads, 1)));
+  global_queue_.spinner->start();
+  ROS_INFO("Spinning the global callback queue with %d threads", std::max(nb_threads, 1));
+}
+
+ros::NodeHandle CallbackExecutor::nodeHandle(const std::string &queue_name, int nb_threads, const std::string &ns)
+{
+  Queue &queue = queues_[queue_name];
+  if (!queue.queue){
+    queue.queue.reset(new ros::CallbackQueue());
+    queue.spinner.reset(new ros::AsyncSpinner(std::max(nb_threads, 1), queue.queue.get()));
+    queue.spinner->start();
+    ROS_INFO("Spinning the %s callback queue with %d threads", queue_name.c_str(), std::max(nb_threads, 1));
+  }
+  
+  ros::NodeHandle nh(ns);
+  nh.setCallbackQueue(queue.queue.get());
+  return nh;
+}
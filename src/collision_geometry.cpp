@@ -0,0 +1,300 @@
+#include <lwr_pick_n_place/collision_geometry.hpp>
+
+#include <ros/package.h>
+#include <eigen_conversions/eigen_msg.h>
+#include <geometric_shapes/body_operations.h>
+#include <geometric_shapes/shape_operations.h>
+
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/tuple/tuple_comparison.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <set>
+#include <sstream>
+#include <sys/stat.h>
+#include <math.h>
+
+namespace {
+  typedef boost::tuple<long, long, long> Cell;
+  
+  // Modification time of a file, 0 if it does not exist
+  time_t modificationTime(const std::string &path)
+  {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+      return 0;
+    return info.st_mtime;
+  }
+  
+  void writeFloats(std::ofstream &file, double x, double y, double z)
+  {
+    float values[3] = {(float)x, (float)y, (float)z};
+    file.write(reinterpret_cast<const char*>(values), sizeof(values));
+  }
+}
+
+CollisionGeometry::Mode CollisionGeometry::modeFromString(const std::string &mode)
+{
+  if (mode == "decimated")
+    return DECIMATED;
+  if (mode == "convex_hull")
+    return CONVEX_HULL;
+  if (mode == "box")
+    return BOX;
+  if (mode != "full")
+    ROS_WARN_STREAM("Unknown collision geometry "<< mode <<", using full");
+  return FULL;
+}
+
+std::string CollisionGeometry::modeToString(Mode mode)
+{
+  switch (mode){
+    case DECIMATED: return "decimated";
+    case CONVEX_HULL: return "convex_hull";
+    case BOX: return "box";
+    default: return "full";
+  }
+}
+
+CollisionGeometry::CollisionGeometry(Mode mode, double tolerance) :
+  mode_(mode),
+  tolerance_(tolerance)
+{
+}
+
+bool CollisionGeometry::makeGeometry(const std::string &resource, const geometry_msgs::Pose &pose, moveit_msgs::CollisionObject &object)
+{
+  object.meshes.clear();
+  object.mesh_poses.clear();
+  object.primitives.clear();
+  object.primitive_poses.clear();
+  
+  MeshCache::MeshConstPtr mesh = MeshCache::instance().getMesh(resource);
+  if (!mesh)
+    return false;
+  
+  // The box is a mesh in the mesh frame, a primitive would be posed at its center and the
+  // first shape would no longer give the pose of the object
+  if (mode_ == BOX){
+    shape_msgs::SolidPrimitive box;
+    geometry_msgs::Pose center;
+    boundingBox(*mesh, box, center);
+    object.meshes.push_back(boxMesh(box, center));
+    object.mesh_poses.push_back(pose);
+    return true;
+  }
+  
+  // Fall back to the full mesh if it cannot be simplified
+  if (mode_ != FULL){
+    MeshCache::MeshConstPtr simplified = getSimplifiedMesh(resource);
+    if (simplified)
+      mesh = simplified;
+  }
+  object.meshes.push_back(*mesh);
+  object.mesh_poses.push_back(pose);
+  return true;
+}
+
+std::string CollisionGeometry::getCacheResource(const std::string &resource) const
+{
+  std::string::size_type dot = resource.rfind('.');
+  std::string::size_type slash = resource.rfind('/');
+  std::string stem = (dot == std::string::npos || (slash != std::string::npos && dot < slash)) ? resource : resource.substr(0, dot);
+  // Fixed precision, so that the same tolerance always maps to the same file
+  std::ostringstream os;
+  os << stem << "." << modeToString(mode_) << "_" << std::fixed << std::setprecision(2) << tolerance_*1000.0 << "mm.stl";
+  return os.str();
+}
+
+MeshCache::MeshConstPtr CollisionGeometry::getSimplifiedMesh(const std::string &resource)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  std::map<std::string, MeshCache::MeshConstPtr>::const_iterator it = meshes_.find(resource);
+  if (it != meshes_.end())
+    return it->second;
+  
+  // The cache file is used as long as it is more recent than the source
+  std::string cache_resource = getCacheResource(resource);
+  std::string source_path = resolvePath(resource), cache_path = resolvePath(cache_resource);
+  if (!cache_path.empty() && modificationTime(cache_path) >= modificationTime(source_path) && modificationTime(cache_path) > 0)
+    return MeshCache::instance().getMesh(cache_resource);
+  
+  MeshCache::MeshConstPtr mesh = MeshCache::instance().getMesh(resource);
+  if (!mesh)
+    return MeshCache::MeshConstPtr();
+  ros::WallTime start = ros::WallTime::now();
+  boost::shared_ptr<shape_msgs::Mesh> simplified(new shape_msgs::Mesh(decimate(*mesh, tolerance_)));
+  if (mode_ == CONVEX_HULL && !convexHull(*simplified, *simplified)){
+    ROS_ERROR_STREAM("Failed to compute the convex hull of "<< resource);
+    return MeshCache::MeshConstPtr();
+  }
+  ROS_INFO("Simplified %s from %zu to %zu triangles in %.3f s", resource.c_str(), mesh->triangles.size(), 
+           simplified->triangles.size(), (ros::WallTime::now() - start).toSec());
+  
+  if (cache_path.empty() || !writeStl(cache_path, *simplified))
+    ROS_WARN_STREAM("Could not write "<< cache_resource<< ", the simplified mesh will be computed again next time");
+  meshes_[resource] = simplified;
+  return simplified;
+}
+
+shape_msgs::Mesh CollisionGeometry::decimate(const shape_msgs::Mesh &mesh, double cell_size)
+{
+  // Each cell is replaced by the average of its vertices
+  std::map<Cell, unsigned int> cell_indices;
+  std::vector<unsigned int> new_indices(mesh.vertices.size());
+  std::vector<Eigen::Vector3d> sums;
+  std::vector<int> counts;
+  for (int i=0; i<mesh.vertices.size(); i++){
+    const geometry_msgs::Point &v = mesh.vertices[i];
+    Cell cell((long)floor(v.x/cell_size), (long)floor(v.y/cell_size), (long)floor(v.z/cell_size));
+    std::map<Cell, unsigned int>::iterator it = cell_indices.find(cell);
+    if (it == cell_indices.end()){
+      it = cell_indices.insert(std::make_pair(cell, (unsigned int)sums.size())).first;
+      sums.push_back(Eigen::Vector3d::Zero());
+      counts.push_back(0);
+    }
+    new_indices[i] = it->second;
+    sums[it->second] += Eigen::Vector3d(v.x, v.y, v.z);
+    counts[it->second]++;
+  }
+  
+  shape_msgs::Mesh decimated;
+  decimated.vertices.resize(sums.size());
+  for (int i=0; i<sums.size(); i++){
+    decimated.vertices[i].x = sums[i].x()/counts[i];
+    decimated.vertices[i].y = sums[i].y()/counts[i];
+    decimated.vertices[i].z = sums[i].z()/counts[i];
+  }
+  
+  // Triangles whose vertices were merged are dropped, as well as duplicates
+  std::set<Cell> kept;
+  for (int i=0; i<mesh.triangles.size(); i++){
+    shape_msgs::MeshTriangle triangle;
+    for (int j=0; j<3; j++)
+      triangle.vertex_indices[j] = new_indices[mesh.triangles[i].vertex_indices[j]];
+    unsigned int a = triangle.vertex_indices[0], b = triangle.vertex_indices[1], c = triangle.vertex_indices[2];
+    if (a == b || b == c || a == c)
+      continue;
+    unsigned int sorted[3] = {a, b, c};
+    std::sort(sorted, sorted + 3);
+    if (!kept.insert(Cell(sorted[0], sorted[1], sorted[2])).second)
+      continue;
+    decimated.triangles.push_back(triangle);
+  }
+  return decimated;
+}
+
+bool CollisionGeometry::convexHull(const shape_msgs::Mesh &mesh, shape_msgs::Mesh &hull)
+{
+  // A mesh body is the convex hull of the mesh (computed by qhull)
+  boost::scoped_ptr<shapes::Shape> shape(shapes::constructShapeFromMsg(mesh));
+  if (!shape)
+    return false;
+  boost::scoped_ptr<bodies::Body> body(bodies::createBodyFromShape(shape.get()));
+  if (!body)
+    return false;
+  shapes::ShapePtr hull_shape = bodies::constructShapeFromBody(body.get());
+  shapes::ShapeMsg hull_msg;
+  if (!hull_shape || !shapes::constructMsgFromShape(hull_shape.get(), hull_msg))
+    return false;
+  hull = boost::get<shape_msgs::Mesh>(hull_msg);
+  return !hull.triangles.empty();
+}
+
+void CollisionGeometry::boundingBox(const shape_msgs::Mesh &mesh, shape_msgs::SolidPrimitive &box, geometry_msgs::Pose &center)
+{
+  Eigen::Vector3d min_corner = Eigen::Vector3d::Constant(std::numeric_limits<double>::max());
+  Eigen::Vector3d max_corner = -min_corner;
+  for (int i=0; i<mesh.vertices.size(); i++){
+    Eigen::Vector3d v(mesh.vertices[i].x, mesh.vertices[i].y, mesh.vertices[i].z);
+    min_corner = min_corner.cwiseMin(v);
+    max_corner = max_corner.cwiseMax(v);
+  }
+  if (mesh.vertices.empty())
+    min_corner = max_corner = Eigen::Vector3d::Zero();
+  
+  box.type = shape_msgs::SolidPrimitive::BOX;
+  box.dimensions.resize(3);
+  box.dimensions[shape_msgs::SolidPrimitive::BOX_X] = max_corner.x() - min_corner.x();
+  box.dimensions[shape_msgs::SolidPrimitive::BOX_Y] = max_corner.y() - min_corner.y();
+  box.dimensions[shape_msgs::SolidPrimitive::BOX_Z] = max_corner.z() - min_corner.z();
+  center = geometry_msgs::Pose();
+  center.position.x = 0.5*(min_corner.x() + max_corner.x());
+  center.position.y = 0.5*(min_corner.y() + max_corner.y());
+  center.position.z = 0.5*(min_corner.z() + max_corner.z());
+  center.orientation.w = 1.0;
+}
+
+shape_msgs::Mesh CollisionGeometry::boxMesh(const shape_msgs::SolidPrimitive &box, const geometry_msgs::Pose &center)
+{
+  // Corner i is on the positive side of x, y, z for its bits 0, 1, 2
+  static const boost::uint32_t triangles[12][3] = {{0,4,6}, {0,6,2}, {1,3,7}, {1,7,5}, {0,1,5}, {0,5,4},
+                                                   {2,6,7}, {2,7,3}, {0,2,3}, {0,3,1}, {4,5,7}, {4,7,6}};
+  Eigen::Affine3d center_pose;
+  tf::poseMsgToEigen(center, center_pose);
+  Eigen::Vector3d half_size(0.5*box.dimensions[shape_msgs::SolidPrimitive::BOX_X], 
+                            0.5*box.dimensions[shape_msgs::SolidPrimitive::BOX_Y],
+                            0.5*box.dimensions[shape_msgs::SolidPrimitive::BOX_Z]);
+  shape_msgs::Mesh mesh;
+  mesh.vertices.resize(8);
+  for (int i=0; i<8; i++){
+    Eigen::Vector3d corner(i & 1 ? half_size.x() : -half_size.x(), i & 2 ? half_size.y() : -half_size.y(), 
+                           i & 4 ? half_size.z() : -half_size.z());
+    tf::pointEigenToMsg(center_pose * corner, mesh.vertices[i]);
+  }
+  mesh.triangles.resize(12);
+  for (int i=0; i<12; i++)
+    std::copy(triangles[i], triangles[i] + 3, mesh.triangles[i].vertex_indices.begin());
+  return mesh;
+}
+
+std::string CollisionGeometry::resolvePath(const std::string &resource)
+{
+  const std::string package_prefix = "package://", file_prefix = "file://";
+  if (resource.compare(0, file_prefix.size(), file_prefix) == 0)
+    return resource.substr(file_prefix.size());
+  if (resource.compare(0, package_prefix.size(), package_prefix) != 0)
+    return "";
+  
+  std::string::size_type slash = resource.find('/', package_prefix.size());
+  if (slash == std::string::npos)
+    return "";
+  std::string package_path = ros::package::getPath(resource.substr(package_prefix.size(), slash - package_prefix.size()));
+  if (package_path.empty())
+    return "";
+  return package_path + resource.substr(slash);
+}
+
+bool CollisionGeometry::writeStl(const std::string &path, const shape_msgs::Mesh &mesh)
+{
+  std::ofstream file(path.c_str(), std::ios::binary | std::ios::trunc);
+  if (!file)
+    return false;
+  
+  // Binary STL: 80 bytes header, triangle count, then normal, vertices and attribute of each triangle
+  char header[80] = "lwr_pick_n_place simplified collision mesh";
+  file.write(header, sizeof(header));
+  boost::uint32_t count = mesh.triangles.size();
+  file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+  for (int i=0; i<mesh.triangles.size(); i++){
+    Eigen::Vector3d v[3];
+    for (int j=0; j<3; j++){
+      const geometry_msgs::Point &p = mesh.vertices[mesh.triangles[i].vertex_indices[j]];
+      v[j] = Eigen::Vector3d(p.x, p.y, p.z);
+    }
+    Eigen::Vector3d normal = (v[1] - v[0]).cross(v[2] - v[0]);
+    if (normal.norm() > 0.0)
+      normal.normalize();
+    writeFloats(file, normal.x(), normal.y(), normal.z());
+    for (int j=0; j<3; j++)
+      writeFloats(file, v[j].x(), v[j].y(), v[j].z());
+    boost::uint16_t attribute = 0;
+    file.write(reinterpret_cast<const char*>(&attribute), sizeof(attribute));
+  }
+  return file.good();
+}
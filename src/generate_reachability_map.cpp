@@ -0,0 +1,59 @@
+#include <lwr_pick_n_place/reachability_map.hpp>
+
+#include <moveit/robot_model_loader/robot_model_loader.h>
+#include <moveit/planning_scene/planning_scene.h>
+#include <moveit/robot_state/robot_state.h>
+
+// Sample the joint space of the group and record the end-effector poses reached without self collision
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "generate_reachability_map");
+  
+  std::string group_name, base_frame, ee_frame, file_name;
+  int nb_samples, nb_directions;
+  double extent, resolution;
+  ros::NodeHandle nh_param("~");
+  nh_param.param<std::string>("group_name", group_name, "arm");
+  nh_param.param<std::string>("base_frame", base_frame, "base_link");
+  nh_param.param<std::string>("ee_frame", ee_frame, "link_7");
+  nh_param.param<std::string>("file", file_name, "reachability.map");
+  nh_param.param<int>("samples", nb_samples, 2000000);
+  nh_param.param<int>("directions", nb_directions, 32);
+  nh_param.param<double>("extent", extent, 1.2);
+  nh_param.param<double>("resolution", resolution, 0.05);
+  
+  robot_model_loader::RobotModelLoader loader("robot_description");
+  robot_model::RobotModelConstPtr robot_model = loader.getModel();
+  const robot_model::JointModelGroup *group = robot_model ? robot_model->getJointModelGroup(group_name) : 0;
+  if (!group){
+    ROS_ERROR_STREAM("No group "<< group_name<< " in the robot model");
+    return 1;
+  }
+  
+  // An empty scene, only the self collisions are checked
+  planning_scene::PlanningScene scene(robot_model);
+  robot_state::RobotState state(robot_model);
+  state.setToDefaultValues();
+  ReachabilityMap map(extent, resolution, nb_directions, group->getVariableCount());
+  
+  ros::WallTime start = ros::WallTime::now();
+  int nb_valid = 0;
+  for (int i=0; i<nb_samples && ros::ok(); i++){
+    state.setToRandomPositions(group);
+    state.update();
+    if (scene.isStateColliding(state, group_name))
+      continue;
+    nb_valid++;
+    
+    Eigen::Affine3d ee_pose = state.getFrameTransform(base_frame).inverse() * state.getGlobalLinkTransform(ee_frame);
+    std::vector<double> joints;
+    state.copyJointGroupPositions(group, joints);
+    map.insert(ee_pose, joints);
+    if ((i+1) % (nb_samples/10 + 1) == 0)
+      ROS_INFO("%d/%d samples, %zu entries reached", i+1, nb_samples, map.size());
+  }
+  ROS_INFO("%d collision free samples reached %zu/%zu entries in %.1f s", nb_valid, map.size(), map.capacity(), 
+           (ros::WallTime::now() - start).toSec());
+  
+  return map.save(file_name) ? 0 : 1;
+}
@@ -0,0 +1,234 @@
+#include <lwr_pick_n_place/ik_seed_store.hpp>
+#include <lwr_pick_n_place/cache_io.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <math.h>
+
+using cache_io::quantize;
+
+namespace {
+  const char IK_SEED_MAGIC[8] = {'L','W','R','I','K','S','D','1'};
+
+  // Weight of the orientation in the pose distance, in meters per radian
+  const double ORIENTATION_WEIGHT = 0.1;
+
+  // q and -q are the same rotation, keep the one with a positive w
+  geometry_msgs::Quaternion canonicalQuaternion(const geometry_msgs::Quaternion &q)
+  {
+    geometry_msgs::Quaternion canonical = q;
+    if (q.w < 0.0){
+      canonical.x = -q.x;
+      canonical.y = -q.y;
+      canonical.z = -q.z;
+      canonical.w = -q.w;
+    }
+    return canonical;
+  }
+
+  double poseDistance(const geometry_msgs::Pose &a, const geometry_msgs::Pose &b)
+  {
+    double dx = a.position.x - b.position.x, dy = a.position.y - b.position.y, dz = a.position.z - b.position.z;
+    double dot = fabs(a.orientation.x*b.orientation.x + a.orientation.y*b.orientation.y 
+                      + a.orientation.z*b.orientation.z + a.orientation.w*b.orientation.w);
+    double angle = 2.0*acos(std::min(1.0, dot));
+    return sqrt(dx*dx + dy*dy + dz*dz) + ORIENTATION_WEIGHT*angle;
+  }
+
+  void writeDouble(std::ofstream &file, double value)
+  {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  double readDouble(std::ifstream &file)
+  {
+    double value = 0.0;
+    file.read(reinterpret_cast<char*>(&value), sizeof(value));
+    return value;
+  }
+}
+
+IkSeedStore::IkSeedStore(int nb_joints, double position_resolution, double orientation_resolution, int max_size, const std::string &file_name) :
+  nb_joints_(nb_joints),
+  position_resolution_(position_resolution),
+  orientation_resolution_(orientation_resolution),
+  max_size_(max_size),
+  file_name_(file_name)
+{
+  if (!file_name_.empty())
+    load();
+}
+
+IkSeedStore::~IkSeedStore()
+{
+  if (!file_name_.empty())
+    save();
+  logStats();
+}
+
+IkSeedStore::CellKey IkSeedStore::makeKey(const geometry_msgs::Pose &pose) const
+{
+  geometry_msgs::Quaternion q = canonicalQuaternion(pose.orientation);
+  CellKey key;
+  key[0] = quantize(pose.position.x, position_resolution_);
+  key[1] = quantize(pose.position.y, position_resolution_);
+  key[2] = quantize(pose.position.z, position_resolution_);
+  key[3] = quantize(q.x, orientation_resolution_);
+  key[4] = quantize(q.y, orientation_resolution_);
+  key[5] = quantize(q.z, orientation_resolution_);
+  return key;
+}
+
+bool IkSeedStore::lookup(const geometry_msgs::Pose &pose, std::vector<double> &seed)
+{
+  CellKey center = makeKey(pose);
+  geometry_msgs::Pose canonical_pose = pose;
+  canonical_pose.orientation = canonicalQuaternion(pose.orientation);
+  
+  // Look in the cell of the pose and its position neighbours
+  boost::mutex::scoped_lock lock(mutex_);
+  const Seed *best = 0;
+  double best_distance = std::numeric_limits<double>::max();
+  CellKey key = center;
+  for (int dx=-1; dx<=1; dx++){
+    for (int dy=-1; dy<=1; dy++){
+      for (int dz=-1; dz<=1; dz++){
+        key[0] = center[0] + dx;
+        key[1] = center[1] + dy;
+        key[2] = center[2] + dz;
+        std::map<CellKey, Seed>::const_iterator it = cells_.find(key);
+        if (it == cells_.end() || it->second.joints.size() != nb_joints_)
+          continue;
+        double distance = poseDistance(canonical_pose, it->second.pose);
+        if (distance < best_distance){
+          best_distance = distance;
+          best = &it->second;
+        }
+      }
+    }
+  }
+  if (!best){
+    stats_.misses++;
+    return false;
+  }
+  stats_.hits++;
+  seed = best->joints;
+  return true;
+}
+
+void IkSeedStore::insert(const geometry_msgs::Pose &pose, const std::vector<double> &joints)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  insertLocked(pose, joints);
+}
+
+void IkSeedStore::insertLocked(const geometry_msgs::Pose &pose, const std::vector<double> &joints)
+{
+  if (joints.size() != nb_joints_)
+    return;
+  CellKey key = makeKey(pose);
+  if (cells_.find(key) == cells_.end())
+    insertion_order_.push_back(key);
+  Seed &seed = cells_[key];
+  seed.pose = pose;
+  seed.pose.orientation = canonicalQuaternion(pose.orientation);
+  seed.joints = joints;
+
+  while (max_size_ > 0 && cells_.size() > max_size_){
+    cells_.erase(insertion_order_.front());
+    insertion_order_.pop_front();
+  }
+}
+
+bool IkSeedStore::save() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  std::ofstream file(file_name_.c_str(), std::ios::binary | std::ios::trunc);
+  if (!file){
+    ROS_ERROR_STREAM("Failed to open IK seed file "<< file_name_);
+    return false;
+  }
+
+  file.write(IK_SEED_MAGIC, sizeof(IK_SEED_MAGIC));
+  boost::uint32_t count = insertion_order_.size();
+  file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+  for (int i=0; i<insertion_order_.size(); i++){
+    const Seed &seed = cells_.find(insertion_order_[i])->second;
+    writeDouble(file, seed.pose.position.x);
+    writeDouble(file, seed.pose.position.y);
+    writeDouble(file, seed.pose.position.z);
+    writeDouble(file, seed.pose.orientation.x);
+    writeDouble(file, seed.pose.orientation.y);
+    writeDouble(file, seed.pose.orientation.z);
+    writeDouble(file, seed.pose.orientation.w);
+    boost::uint32_t nb_joints = seed.joints.size();
+    file.write(reinterpret_cast<const char*>(&nb_joints), sizeof(nb_joints));
+    for (int j=0; j<seed.joints.size(); j++)
+      writeDouble(file, seed.joints[j]);
+  }
+  ROS_INFO("Saved %u IK seeds to %s", count, file_name_.c_str());
+  return file.good();
+}
+
+bool IkSeedStore::load()
+{
+  std::ifstream file(file_name_.c_str(), std::ios::binary);
+  if (!file){
+    ROS_INFO_STREAM("No IK seed file "<< file_name_ <<" yet, starting empty");
+    return false;
+  }
+
+  char magic[sizeof(IK_SEED_MAGIC)];
+  boost::uint32_t count = 0;
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char*>(&count), sizeof(count));
+  if (!file || !std::equal(magic, magic + sizeof(magic), IK_SEED_MAGIC)){
+    ROS_ERROR_STREAM("File "<< file_name_ <<" is not an IK seed store");
+    return false;
+  }
+
+  // Cells are rebuilt with the current resolutions, seeds of another group are dropped
+  boost::mutex::scoped_lock lock(mutex_);
+  int nb_dropped = 0;
+  for (boost::uint32_t i=0; i<count; i++){
+    geometry_msgs::Pose pose;
+    pose.position.x = readDouble(file);
+    pose.position.y = readDouble(file);
+    pose.position.z = readDouble(file);
+    pose.orientation.x = readDouble(file);
+    pose.orientation.y = readDouble(file);
+    pose.orientation.z = readDouble(file);
+    pose.orientation.w = readDouble(file);
+    boost::uint32_t nb_joints = 0;
+    file.read(reinterpret_cast<char*>(&nb_joints), sizeof(nb_joints));
+    if (!file || nb_joints > 64)
+      break;
+    std::vector<double> joints(nb_joints);
+    for (int j=0; j<nb_joints; j++)
+      joints[j] = readDouble(file);
+    if (!file)
+      break;
+    if (nb_joints != nb_joints_){
+      nb_dropped++;
+      continue;
+    }
+    insertLocked(pose, joints);
+  }
+  if (nb_dropped > 0)
+    ROS_WARN("Dropped %d IK seeds of %s without %d joints", nb_dropped, file_name_.c_str(), nb_joints_);
+  ROS_INFO("Loaded %zu IK seeds from %s", cells_.size(), file_name_.c_str());
+  return true;
+}
+
+IkSeedStore::Stats IkSeedStore::getStats() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return stats_;
+}
+
+void IkSeedStore::logStats() const
+{
+  Stats stats = getStats();
+  ROS_INFO("IK seed store: %lu hits, %lu misses", stats.hits, stats.misses);
+}
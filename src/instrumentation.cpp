@@ -0,0 +1,197 @@
+#include <lwr_pick_n_place/instrumentation.hpp>
+
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <math.h>
+
+LatencyHistogram::LatencyHistogram() :
+  total_us_(0),
+  max_us_(0)
+{
+  for (int i=0; i<NB_BUCKETS; i++)
+    buckets_[i].store(0, boost::memory_order_relaxed);
+}
+
+void LatencyHistogram::record(double duration)
+{
+  boost::uint64_t us = duration > 0.0 ? static_cast<boost::uint64_t>(duration*1e6) : 0;
+  int bucket = us < 1 ? 0 : std::min(NB_BUCKETS-1, (int)floor(2.0*log2((double)us)) + 1);
+
+  // Single writer: relaxed read-modify-write without any lock
+  buckets_[bucket].store(buckets_[bucket].load(boost::memory_order_relaxed) + 1, boost::memory_order_relaxed);
+  total_us_.store(total_us_.load(boost::memory_order_relaxed) + us, boost::memory_order_relaxed);
+  if (us > max_us_.load(boost::memory_order_relaxed))
+    max_us_.store(us, boost::memory_order_relaxed);
+}
+
+void LatencyHistogram::mergeInto(std::vector<boost::uint64_t> &buckets, boost::uint64_t &total_us, boost::uint64_t &max_us) const
+{
+  buckets.resize(NB_BUCKETS, 0);
+  for (int i=0; i<NB_BUCKETS; i++)
+    buckets[i] += buckets_[i].load(boost::memory_order_relaxed);
+  total_us += total_us_.load(boost::memory_order_relaxed);
+  max_us = std::max(max_us, max_us_.load(boost::memory_order_relaxed));
+}
+
+double LatencyHistogram::bucketUpperBound(int bucket)
+{
+  return pow(2.0, bucket/2.0)*1e-6;
+}
+
+Instrumentation::Instrumentation() :
+  thread_data_(&Instrumentation::keepThreadData)
+{
+}
+
+Instrumentation& Instrumentation::instance()
+{
+  static Instrumentation instrumentation;
+  return instrumentation;
+}
+
+Instrumentation::ThreadData& Instrumentation::threadData()
+{
+  ThreadData *data = thread_data_.get();
+  if (!data){
+    boost::shared_ptr<ThreadData> new_data(new ThreadData());
+    {
+      boost::mutex::scoped_lock lock(registry_mutex_);
+      registry_.push_back(new_data);
+    }
+    thread_data_.reset(new_data.get());
+    data = new_data.get();
+  }
+  return *data;
+}
+
+void Instrumentation::record(const std::string &probe, double duration)
+{
+  ThreadData &data = threadData();
+  std::map<std::string, boost::shared_ptr<LatencyHistogram> >::iterator it = data.histograms.find(probe);
+  if (it == data.histograms.end()){
+    boost::mutex::scoped_lock lock(data.mutex);
+    it = data.histograms.insert(std::make_pair(probe, boost::shared_ptr<LatencyHistogram>(new LatencyHistogram()))).first;
+  }
+  it->second->record(duration);
+}
+
+void Instrumentation::count(const std::string &counter, long value)
+{
+  ThreadData &data = threadData();
+  std::map<std::string, boost::shared_ptr<boost::atomic<long> > >::iterator it = data.counters.find(counter);
+  if (it == data.counters.end()){
+    boost::mutex::scoped_lock lock(data.mutex);
+    it = data.counters.insert(std::make_pair(counter, boost::shared_ptr<boost::atomic<long> >(new boost::atomic<long>(0)))).first;
+  }
+  it->second->fetch_add(value, boost::memory_order_relaxed);
+}
+
+std::map<std::string, Instrumentation::ProbeStats> Instrumentation::getProbeStats() const
+{
+  // Merge the histograms of all the threads
+  std::map<std::string, std::vector<boost::uint64_t> > buckets;
+  std::map<std::string, boost::uint64_t> totals, maxs;
+  {
+    boost::mutex::scoped_lock lock(registry_mutex_);
+    for (int i=0; i<registry_.size(); i++){
+      boost::mutex::scoped_lock data_lock(registry_[i]->mutex);
+      std::map<std::string, boost::shared_ptr<LatencyHistogram> >::const_iterator it = registry_[i]->histograms.begin();
+      for (; it != registry_[i]->histograms.end(); it++)
+        it->second->mergeInto(buckets[it->first], totals[it->first], maxs[it->first]);
+    }
+  }
+
+  std::map<std::string, ProbeStats> stats;
+  std::map<std::string, std::vector<boost::uint64_t> >::const_iterator it = buckets.begin();
+  for (; it != buckets.end(); it++){
+    ProbeStats &probe = stats[it->first];
+    for (int i=0; i<it->second.size(); i++)
+      probe.count += it->second[i];
+    if (probe.count == 0)
+      continue;
+    probe.mean = totals[it->first]*1e-6/probe.count;
+    probe.max = maxs[it->first]*1e-6;
+
+    // Percentiles are reported as the upper bound of their bucket
+    boost::uint64_t cumulated = 0;
+    for (int i=0; i<it->second.size(); i++){
+      boost::uint64_t previous = cumulated;
+      cumulated += it->second[i];
+      double bound = std::min(LatencyHistogram::bucketUpperBound(i), probe.max);
+      if (previous < 0.50*probe.count && cumulated >= 0.50*probe.count) probe.p50 = bound;
+      if (previous < 0.90*probe.count && cumulated >= 0.90*probe.count) probe.p90 = bound;
+      if (previous < 0.99*probe.count && cumulated >= 0.99*probe.count) probe.p99 = bound;
+    }
+  }
+  return stats;
+}
+
+std::map<std::string, long> Instrumentation::getCounters() const
+{
+  std::map<std::string, long> counters;
+  boost::mutex::scoped_lock lock(registry_mutex_);
+  for (int i=0; i<registry_.size(); i++){
+    boost::mutex::scoped_lock data_lock(registry_[i]->mutex);
+    std::map<std::string, boost::shared_ptr<boost::atomic<long> > >::const_iterator it = registry_[i]->counters.begin();
+    for (; it != registry_[i]->counters.end(); it++)
+      counters[it->first] += it->second->load(boost::memory_order_relaxed);
+  }
+  return counters;
+}
+
+std::string Instrumentation::report() const
+{
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(4);
+  os << "Latencies (s):\n";
+  std::map<std::string, ProbeStats> stats = getProbeStats();
+  for (std::map<std::string, ProbeStats>::const_iterator it = stats.begin(); it != stats.end(); it++)
+    os << "  " << std::setw(20) << std::left << it->first << " count " << it->second.count << "  mean " << it->second.mean
+       << "  p50 " << it->second.p50 << "  p90 " << it->second.p90 << "  p99 " << it->second.p99 << "  max " << it->second.max << "\n";
+  os << "Counters:\n";
+  std::map<std::string, long> counters = getCounters();
+  for (std::map<std::string, long>::const_iterator it = counters.begin(); it != counters.end(); it++)
+    os << "  " << std::setw(20) << std::left << it->first << " " << it->second << "\n";
+  return os.str();
+}
+
+void Instrumentation::startPublishing(ros::NodeHandle &nh, double period)
+{
+  diagnostics_publisher_ = nh.advertise<diagnostic_msgs::DiagnosticArray>("diagnostics", 1);
+  diagnostics_timer_ = nh.createWallTimer(ros::WallDuration(period), &Instrumentation::publishDiagnostics, this);
+}
+
+void Instrumentation::publishDiagnostics(const ros::WallTimerEvent &event)
+{
+  diagnostic_msgs::DiagnosticStatus status;
+  status.level = diagnostic_msgs::DiagnosticStatus::OK;
+  status.name = ros::this_node::getName() + ": latencies";
+  status.hardware_id = ros::this_node::getName();
+
+  std::map<std::string, ProbeStats> stats = getProbeStats();
+  for (std::map<std::string, ProbeStats>::const_iterator it = stats.begin(); it != stats.end(); it++){
+    const char* fields[] = {"count", "mean", "p50", "p90", "p99", "max"};
+    double values[] = {(double)it->second.count, it->second.mean, it->second.p50, it->second.p90, it->second.p99, it->second.max};
+    for (int i=0; i<6; i++){
+      diagnostic_msgs::KeyValue key_value;
+      key_value.key = it->first + "/" + fields[i];
+      key_value.value = boost::lexical_cast<std::string>(values[i]);
+      status.values.push_back(key_value);
+    }
+  }
+  std::map<std::string, long> counters = getCounters();
+  for (std::map<std::string, long>::const_iterator it = counters.begin(); it != counters.end(); it++){
+    diagnostic_msgs::KeyValue key_value;
+    key_value.key = it->first;
+    key_value.value = boost::lexical_cast<std::string>(it->second);
+    status.values.push_back(key_value);
+  }
+
+  diagnostic_msgs::DiagnosticArray diagnostics;
+  diagnostics.header.stamp = ros::Time::now();
+  diagnostics.status.push_back(status);
+  diagnostics_publisher_.publish(diagnostics);
+}
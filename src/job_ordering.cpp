@@ -0,0 +1,75 @@
+#include <lwr_pick_n_place/job_ordering.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+double JobOrdering::distance(const std::vector<double> &from, const std::vector<double> &to)
+{
+  double max_displacement = 0.0;
+  for (int i=0; i<from.size() && i<to.size(); i++)
+    max_displacement = std::max(max_displacement, std::fabs(to[i] - from[i]));
+  return max_displacement;
+}
+
+double JobOrdering::cost(const std::vector<double> &start, const std::vector<std::vector<double> > &picks,
+                         const std::vector<std::vector<double> > &places, const std::vector<int> &order)
+{
+  double total = 0.0;
+  const std::vector<double> *position = &start;
+  for (int i=0; i<order.size(); i++){
+    total += distance(*position, picks[order[i]]);
+    position = &places[order[i]];
+  }
+  return total;
+}
+
+std::vector<int> JobOrdering::nearestNeighbour(const std::vector<double> &start, const std::vector<std::vector<double> > &picks,
+                                               const std::vector<std::vector<double> > &places)
+{
+  std::vector<int> order;
+  std::vector<bool> done(picks.size(), false);
+  const std::vector<double> *position = &start;
+  for (int n=0; n<picks.size(); n++){
+    int best = -1;
+    double best_distance = std::numeric_limits<double>::max();
+    for (int j=0; j<picks.size(); j++){
+      if (done[j])
+        continue;
+      double d = distance(*position, picks[j]);
+      if (d < best_distance){
+        best_distance = d;
+        best = j;
+      }
+    }
+    done[best] = true;
+    order.push_back(best);
+    position = &places[best];
+  }
+  return order;
+}
+
+double JobOrdering::twoOpt(const std::vector<double> &start, const std::vector<std::vector<double> > &picks,
+                           const std::vector<std::vector<double> > &places, std::vector<int> &order, int max_passes)
+{
+  // Picks and places differ, so the travel is not symmetric and a reversed
+  // sub sequence is evaluated on the whole order rather than on its two ends
+  double best_cost = cost(start, picks, places, order);
+  bool improved = true;
+  for (int pass=0; pass<max_passes && improved; pass++){
+    improved = false;
+    for (int i=0; i+1<order.size(); i++){
+      for (int j=i+1; j<order.size(); j++){
+        std::reverse(order.begin()+i, order.begin()+j+1);
+        double new_cost = cost(start, picks, places, order);
+        if (new_cost < best_cost - 1e-9){
+          best_cost = new_cost;
+          improved = true;
+        }
+        else
+          std::reverse(order.begin()+i, order.begin()+j+1);
+      }
+    }
+  }
+  return best_cost;
+}
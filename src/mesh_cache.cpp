@@ -0,0 +1,66 @@
+#include <lwr_pick_n_place/mesh_cache.hpp>
+
+#include <boost/scoped_ptr.hpp>
+
+MeshCache& MeshCache::instance()
+{
+  static MeshCache cache;
+  return cache;
+}
+
+MeshCache::MeshConstPtr MeshCache::getMesh(const std::string &resource)
+{
+  // The lock is held while loading so that a resource is only ever parsed once
+  boost::mutex::scoped_lock lock(mutex_);
+
+  std::map<std::string, MeshConstPtr>::const_iterator it = meshes_.find(resource);
+  if (it != meshes_.end()){
+    stats_.hits++;
+    return it->second;
+  }
+  stats_.misses++;
+
+  ros::WallTime start = ros::WallTime::now();
+  boost::scoped_ptr<shapes::Mesh> m(shapes::createMeshFromResource(resource));
+  if (!m){
+    stats_.failures++;
+    ROS_ERROR_STREAM("Failed to load mesh "<< resource);
+    return MeshConstPtr();
+  }
+
+  shapes::ShapeMsg co_mesh_msg;
+  if (!shapes::constructMsgFromShape(m.get(), co_mesh_msg)){
+    stats_.failures++;
+    ROS_ERROR_STREAM("Failed to convert mesh "<< resource <<" to a message");
+    return MeshConstPtr();
+  }
+  MeshConstPtr co_mesh(new shape_msgs::Mesh(boost::get<shape_msgs::Mesh>(co_mesh_msg)));
+  double load_time = (ros::WallTime::now() - start).toSec();
+  stats_.load_time += load_time;
+
+  ROS_INFO("Loaded mesh %s (%zu vertices, %zu triangles) in %.3f s", resource.c_str(),
+      co_mesh->vertices.size(), co_mesh->triangles.size(), load_time);
+
+  meshes_[resource] = co_mesh;
+  return co_mesh;
+}
+
+MeshCache::Stats MeshCache::getStats() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return stats_;
+}
+
+void MeshCache::logStats() const
+{
+  Stats stats = getStats();
+  ROS_INFO("Mesh cache: %lu hits, %lu misses, %lu failures, %.3f s spent loading", 
+      stats.hits, stats.misses, stats.failures, stats.load_time);
+}
+
+void MeshCache::clear()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  meshes_.clear();
+  stats_ = Stats();
+}
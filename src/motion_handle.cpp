@@ -0,0 +1,135 @@
+#include <lwr_pick_n_place/motion_handle.hpp>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+MotionHandle::MotionHandle()
+{
+}
+
+MotionHandle MotionHandle::start(const Motion &motion, const boost::function<void()> &cancel, 
+                                 const DoneCallback &done_callback)
+{
+  MotionHandle handle;
+  handle.shared_.reset(new Shared);
+  handle.shared_->state = ACTIVE;
+  handle.shared_->cancel_requested = false;
+  handle.shared_->cancel = cancel;
+  if (done_callback)
+    handle.shared_->done_callbacks.push_back(done_callback);
+  
+  // The thread keeps the shared state alive, the handle can be dropped before the end of the motion
+  boost::thread motion_thread(boost::bind(&MotionHandle::run, handle.shared_, motion));
+  motion_thread.detach();
+  return handle;
+}
+
+MotionHandle MotionHandle::failed(const DoneCallback &done_callback)
+{
+  MotionHandle handle;
+  handle.shared_.reset(new Shared);
+  handle.shared_->state = FAILED;
+  handle.shared_->cancel_requested = false;
+  if (done_callback)
+    done_callback(FAILED);
+  return handle;
+}
+
+void MotionHandle::run(boost::shared_ptr<Shared> shared, Motion motion)
+{
+  finish(shared, motion(boost::bind(&MotionHandle::isCancelRequested, shared)));
+}
+
+bool MotionHandle::isCancelRequested(const boost::shared_ptr<Shared> &shared)
+{
+  boost::mutex::scoped_lock lock(shared->mutex);
+  return shared->cancel_requested;
+}
+
+void MotionHandle::finish(const boost::shared_ptr<Shared> &shared, bool success)
+{
+  std::vector<DoneCallback> done_callbacks;
+  State state;
+  {
+    boost::mutex::scoped_lock lock(shared->mutex);
+    shared->state = shared->cancel_requested ? CANCELLED : (success ? SUCCEEDED : FAILED);
+    state = shared->state;
+    done_callbacks.swap(shared->done_callbacks);
+    shared->done_cond.notify_all();
+  }
+  
+  // Outside of the lock, so that callbacks can use the handle
+  for (int i=0; i<done_callbacks.size(); i++)
+    done_callbacks[i](state);
+}
+
+bool MotionHandle::isValid() const
+{
+  return shared_.get() != 0;
+}
+
+MotionHandle::State MotionHandle::getState() const
+{
+  if (!shared_)
+    return FAILED;
+  boost::mutex::scoped_lock lock(shared_->mutex);
+  return shared_->state;
+}
+
+bool MotionHandle::isDone() const
+{
+  return getState() != ACTIVE;
+}
+
+bool MotionHandle::wait(double timeout) const
+{
+  if (!shared_)
+    return true;
+  boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds((long)(timeout*1000.0));
+  boost::mutex::scoped_lock lock(shared_->mutex);
+  while (shared_->state == ACTIVE){
+    if (timeout <= 0.0)
+      shared_->done_cond.wait(lock);
+    else if (!shared_->done_cond.timed_wait(lock, deadline))
+      return shared_->state != ACTIVE;
+  }
+  return true;
+}
+
+bool MotionHandle::get() const
+{
+  wait();
+  return getState() == SUCCEEDED;
+}
+
+void MotionHandle::cancel()
+{
+  if (!shared_)
+    return;
+  boost::function<void()> cancel;
+  {
+    boost::mutex::scoped_lock lock(shared_->mutex);
+    if (shared_->state != ACTIVE || shared_->cancel_requested)
+      return;
+    shared_->cancel_requested = true;
+    cancel = shared_->cancel;
+  }
+  if (cancel)
+    cancel();
+}
+
+void MotionHandle::addDoneCallback(const DoneCallback &done_callback)
+{
+  if (!shared_ || !done_callback)
+    return;
+  State state;
+  {
+    boost::mutex::scoped_lock lock(shared_->mutex);
+    if (shared_->state == ACTIVE){
+      shared_->done_callbacks.push_back(done_callback);
+      return;
+    }
+    state = shared_->state;
+  }
+  done_callback(state);
+}
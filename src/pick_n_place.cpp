@@ -1,28 +1,111 @@
 #include <lwr_pick_n_place/pick_n_place.hpp>
 
+#include <algorithm>
+#include <limits>
+
+namespace {
+  // Period at which the joints are checked against the grasp point during a linear path
+  const int GRASP_MONITOR_PERIOD_MS = 10;
+  
+  // Period at which a cancelled background motion is stopped again until its execution returns
+  const int CANCEL_MONITOR_PERIOD_MS = 50;
+  
+  // Reject IK solutions in collision with the planning scene
+  bool isIKSolutionCollisionFree(const planning_scene::PlanningScene *scene, robot_state::RobotState *state, 
+                                 const robot_model::JointModelGroup *group, const double *ik_solution)
+  {
+    state->setJointGroupPositions(group, ik_solution);
+    state->update();
+    return !scene->isStateColliding(*state, group->getName());
+  }
+}
+
 PickNPlace::PickNPlace() : 
-  spinner_(1)
+  has_plan_start_state_(false)
 {
-  // Start AsyncSpinner
-  spinner_.start();
-  
   // Get params
-  double max_planning_time;
+  double plan_cache_joint_resolution, racing_budget, cartesian_max_step, diagnostics_period, startup_timeout;
+  double velocity_scaling, acceleration_scaling, waypoint_tolerance, smoothing_budget, smoothing_resolution;
+  bool use_plan_cache, retime_trajectories, use_ik_seeds;
+  int plan_cache_max_size, racing_attempts_per_planner, ik_seed_max_size, ik_threads, batch_ik_attempts;
+  int spinner_threads, state_spinner_threads;
+  double ik_seed_position_resolution, ik_seed_orientation_resolution;
+  std::string planning_namespace, plan_cache_file, racing_mode, racing_namespace, ik_seed_file, collision_geometry, reachability_map;
+  double collision_tolerance, roadmap_resolution;
+  int roadmap_milestones, roadmap_neighbours;
+  std::vector<std::string> roadmap_static_objects;
+  std::vector<std::string> racing_planner_ids;
   ros::NodeHandle nh, nh_param("~");
   nh_param.param<std::string>("base_frame", base_frame_ , "base_link");
   nh_param.param<std::string>("ee_frame", ee_frame_, "link_7");
   nh_param.param<std::string>("group_name", group_name_, "arm");
-  nh_param.param<double>("max_planning_time", max_planning_time, 8.0);
+  nh_param.param<double>("max_planning_time", max_planning_time_, 8.0);
+  nh_param.param<std::string>("planner_id", planner_id_, "RRTConnectkConfigDefault");
+  nh_param.param<std::string>("planning_namespace", planning_namespace, "move_group");
   nh_param.param<double>("gripping_offset", gripping_offset_, 0.1);
   nh_param.param<double>("dz_offset", dz_offset_, 0.3);
+  nh_param.param<double>("cartesian_max_step", cartesian_max_step, 0.05);
+  nh_param.param<double>("pipeline_joint_tolerance", pipeline_joint_tolerance_, 0.01);
+  nh_param.param<bool>("use_local_kinematics", use_local_kinematics_, false);
+  nh_param.param<int>("ik_attempts", ik_attempts_, 100);
+  nh_param.param<double>("ik_timeout", ik_timeout_, 0.1);
+  nh_param.param<bool>("use_plan_cache", use_plan_cache, false);
+  nh_param.param<std::string>("plan_cache_file", plan_cache_file, "");
+  nh_param.param<double>("plan_cache_joint_resolution", plan_cache_joint_resolution, 0.01);
+  nh_param.param<int>("plan_cache_max_size", plan_cache_max_size, 1000);
+  nh_param.param<std::vector<std::string> >("racing_planner_ids", racing_planner_ids, std::vector<std::string>());
+  nh_param.param<int>("racing_attempts_per_planner", racing_attempts_per_planner, 1);
+  nh_param.param<std::string>("racing_mode", racing_mode, "first");
+  nh_param.param<double>("racing_budget", racing_budget, max_planning_time_);
+  nh_param.param<std::string>("racing_namespace", racing_namespace, "move_group");
+  nh_param.param<double>("diagnostics_period", diagnostics_period, 1.0);
+  nh_param.param<double>("startup_timeout", startup_timeout, 5.0);
+  nh_param.param<bool>("retime_trajectories", retime_trajectories, true);
+  nh_param.param<double>("velocity_scaling", velocity_scaling, 1.0);
+  nh_param.param<double>("acceleration_scaling", acceleration_scaling, 1.0);
+  nh_param.param<double>("waypoint_tolerance", waypoint_tolerance, 1e-4);
+  nh_param.param<double>("smoothing_budget", smoothing_budget, 0.05);
+  nh_param.param<double>("smoothing_resolution", smoothing_resolution, 0.02);
+  nh_param.param<double>("cartesian_min_fraction", cartesian_min_fraction_, 0.99);
+  nh_param.param<double>("approach_blend_radius", approach_blend_radius_, -1.0);
+  nh_param.param<double>("depose_blend_radius", depose_blend_radius_, -1.0);
+  nh_param.param<bool>("use_ik_seeds", use_ik_seeds, true);
+  nh_param.param<std::string>("ik_seed_file", ik_seed_file, "");
+  nh_param.param<double>("ik_seed_position_resolution", ik_seed_position_resolution, 0.05);
+  nh_param.param<double>("ik_seed_orientation_resolution", ik_seed_orientation_resolution, 0.2);
+  nh_param.param<int>("ik_seed_max_size", ik_seed_max_size, 10000);
+  nh_param.param<std::string>("reachability_map", reachability_map, "");
+  nh_param.param<double>("scene_sync_timeout", scene_sync_timeout_, 2.0);
+  nh_param.param<std::string>("roadmap_file", roadmap_file_, "");
+  nh_param.param<int>("roadmap_milestones", roadmap_milestones, 5000);
+  nh_param.param<int>("roadmap_neighbours", roadmap_neighbours, 10);
+  nh_param.param<double>("roadmap_resolution", roadmap_resolution, 0.02);
+  nh_param.param<double>("roadmap_timeout", roadmap_timeout_, 0.5);
+  nh_param.param<std::vector<std::string> >("roadmap_static_objects", roadmap_static_objects, std::vector<std::string>());
+  nh_param.param<std::string>("collision_geometry", collision_geometry, "full");
+  nh_param.param<double>("collision_tolerance", collision_tolerance, 0.001);
+  nh_param.param<int>("spinner_threads", spinner_threads, 1);
+  nh_param.param<int>("state_spinner_threads", state_spinner_threads, 1);
+  nh_param.param<int>("ik_threads", ik_threads, 4);
+  nh_param.param<int>("batch_ik_attempts", batch_ik_attempts, 3);
+  nh_param.param<int>("grasp_yaw_steps", grasp_yaw_steps_, 8);
+  target_poses_.loadParams(nh_param);
+  nh_param.param<std::vector<double> >("grasp_approach_heights", grasp_approach_heights_, std::vector<double>(1, 0.12));
+  
+  // The publishers use the global queue. The move group and the planning scene monitor follow
+  // the joint states on their own queues, so that the current state is not delayed by scene
+  // updates. The tf listeners spin their own thread
+  callback_executor_.spinGlobalQueue(spinner_threads);
+  ros::NodeHandle state_nh = callback_executor_.nodeHandle("move_group", state_spinner_threads);
+  ros::NodeHandle scene_state_nh = callback_executor_.nodeHandle("scene_state", state_spinner_threads);
   
   // Initialize move group
-  group_.reset(new move_group_interface::MoveGroup(group_name_));
-  group_->setPlanningTime(max_planning_time);
+  group_.reset(new move_group_interface::MoveGroup(move_group_interface::MoveGroup::Options(group_name_, "robot_description", state_nh)));
+  group_->setPlanningTime(max_planning_time_);
   group_->allowReplanning(false);
   // TODO What is this 1.0 exactly ?
   group_->startStateMonitor(1.0);
-  group_->setPlannerId("RRTConnectkConfigDefault");
+  group_->setPlannerId(planner_id_);
   group_->setEndEffectorLink(ee_frame_);
   group_->setPoseReferenceFrame(ee_frame_);
   group_->setGoalPositionTolerance(0.001);
@@ -33,50 +116,125 @@ PickNPlace::PickNPlace() :
   fk_srv_req_.fk_link_names.push_back(ee_frame_);
   ik_srv_req_.ik_request.group_name = group_name_;
   ik_srv_req_.ik_request.pose_stamped.header.frame_id = base_frame_;
-  ik_srv_req_.ik_request.attempts = 100;
-  ik_srv_req_.ik_request.timeout = ros::Duration(0.1);
+  ik_srv_req_.ik_request.attempts = ik_attempts_;
+  ik_srv_req_.ik_request.timeout = ros::Duration(ik_timeout_);
   ik_srv_req_.ik_request.ik_link_name = ee_frame_;
   ik_srv_req_.ik_request.ik_link_names.push_back(ee_frame_);
   ik_srv_req_.ik_request.avoid_collisions = true;
   cart_path_srv_req_.group_name = group_name_;
   cart_path_srv_req_.header.frame_id = base_frame_;
-  cart_path_srv_req_.max_step = 0.05;
+  cart_path_srv_req_.max_step = cartesian_max_step;
   cart_path_srv_req_.jump_threshold = 0.0;
   cart_path_srv_req_.avoid_collisions = true;
   cart_path_srv_req_.link_name = ee_frame_;
   
   // Initialize planning scene monitor
   tf_.reset(new tf::TransformListener(ros::Duration(2.0)));
-  planning_scene_monitor_.reset(new planning_scene_monitor::PlanningSceneMonitor("robot_description", tf_));
+  robot_model_loader::RobotModelLoaderPtr model_loader(new robot_model_loader::RobotModelLoader("robot_description"));
+  planning_scene_monitor_.reset(new planning_scene_monitor::PlanningSceneMonitor(planning_scene::PlanningScenePtr(), model_loader, 
+                                                                                 scene_state_nh, tf_));
   planning_scene_monitor_->startSceneMonitor();
   planning_scene_monitor_->startStateMonitor();
   planning_scene_monitor_->startWorldGeometryMonitor();
+  scene_sync_.reset(new SceneSynchronizer(planning_scene_monitor_.get()));
+  
+  // The local kinematics use the model already loaded by the planning scene monitor
+  robot_model_ = planning_scene_monitor_->getRobotModel();
+  joint_model_group_ = robot_model_->getJointModelGroup(group_name_);
+  if (use_local_kinematics_ && (!joint_model_group_ || !joint_model_group_->getSolverInstance())){
+    ROS_WARN_STREAM("No kinematics solver loaded for group "<< group_name_ <<", falling back to the IK/FK services");
+    use_local_kinematics_ = false;
+  }
+  
+  // Every trajectory is retimed before execution, and shortcut unless it is a cartesian path
+  if (retime_trajectories){
+    trajectory_processor_.reset(new TrajectoryProcessor(robot_model_, group_name_, velocity_scaling, acceleration_scaling, waypoint_tolerance));
+    trajectory_processor_->setSmoothing(smoothing_budget, smoothing_resolution);
+  }
+  
+  // IK requests start from the solutions found for nearby poses
+  if (use_ik_seeds && joint_model_group_)
+    ik_seed_store_.reset(new IkSeedStore(joint_model_group_->getVariableCount(), ik_seed_position_resolution, 
+                                         ik_seed_orientation_resolution, ik_seed_max_size, ik_seed_file));
+  
+  // Scene objects are added with lighter meshes, cached next to the original ones
+  collision_geometry_.reset(new CollisionGeometry(CollisionGeometry::modeFromString(collision_geometry), collision_tolerance));
+  
+  // Grasp candidates are solved in parallel, each worker with its own kinematics solver
+  if (ik_threads > 0){
+    batch_ik_.reset(new BatchIk("robot_description", group_name_, base_frame_, ee_frame_, ik_threads, batch_ik_attempts, ik_timeout_));
+    if (!batch_ik_->isAvailable())
+      batch_ik_.reset();
+  }
+  
+  // Seeds the IK, and rejects poses where the arm never went before calling it
+  if (!reachability_map.empty() && joint_model_group_){
+    reachability_map_.reset(new ReachabilityMap());
+    if (!reachability_map_->load(reachability_map, joint_model_group_->getVariableCount()))
+      reachability_map_.reset();
+  }
+  
+  // Trajectories of the repeated motions are reused while the scene does not change
+  if (use_plan_cache)
+    plan_cache_.reset(new PlanCache(plan_cache_joint_resolution, plan_cache_max_size, plan_cache_file));
+  
+  // Motions planned ahead do not go through the move group, which executes the current motion
+  planning_pipeline_.reset(new planning_pipeline::PlanningPipeline(robot_model_, ros::NodeHandle(planning_namespace)));
+  
+  // Cartesian targets are planned by several planners in parallel
+  if (!racing_planner_ids.empty())
+    planner_race_.reset(new PlannerRace(robot_model_, racing_namespace, racing_planner_ids, racing_attempts_per_planner,
+                                        PlannerRace::modeFromString(racing_mode), racing_budget));
   
   // Wait until the required ROS services are available
   ik_service_client_ = nh.serviceClient<moveit_msgs::GetPositionIK> ("compute_ik");
   fk_service_client_ = nh.serviceClient<moveit_msgs::GetPositionFK> ("compute_fk");
   cartesian_path_service_client_ = nh.serviceClient<moveit_msgs::GetCartesianPath>(move_group::CARTESIAN_PATH_SERVICE_NAME);
-  while(!ik_service_client_.exists() || !fk_service_client_.exists() || !cartesian_path_service_client_.exists() )
-  {
-    ROS_INFO("Waiting for service");
-    sleep(1.0);
+  ros::ServiceClient* service_clients[] = {&ik_service_client_, &fk_service_client_, &cartesian_path_service_client_};
+  for (int i=0; i<3; i++){
+    while(ros::ok() && !service_clients[i]->waitForExistence(ros::Duration(startup_timeout)))
+      ROS_INFO_STREAM("Waiting for service "<< service_clients[i]->getService());
   }
 
   // Wait for subscribers to make sure we can publish attached/unattached objects //
-  attached_object_publisher_ = nh.advertise<moveit_msgs::AttachedCollisionObject>("attached_collision_object", 1);
-  planning_scene_diff_publisher_ = nh.advertise<moveit_msgs::PlanningScene>("planning_scene", 1);
-  while(attached_object_publisher_.getNumSubscribers() < 1 || planning_scene_diff_publisher_.getNumSubscribers() < 1)
-  {
+  attached_object_publisher_ = nh.advertise<moveit_msgs::AttachedCollisionObject>("attached_collision_object", 1, subscriber_waiter_.connectCallback());
+  planning_scene_diff_publisher_ = nh.advertise<moveit_msgs::PlanningScene>("planning_scene", 1, subscriber_waiter_.connectCallback());
+  while(ros::ok() && !(subscriber_waiter_.waitForSubscribers(attached_object_publisher_, 1, startup_timeout) && 
+                       subscriber_waiter_.waitForSubscribers(planning_scene_diff_publisher_, 1, startup_timeout)))
     ROS_INFO("Waiting for planning scene");
-    sleep(1.0);
+  
+  // Make sure the planning scene is loaded
+  planning_scene_monitor_->requestPlanningSceneState();
+  
+  // Joint targets are first looked up in the roadmap of the cell, built once from the loaded scene
+  if (!roadmap_file_.empty()){
+    roadmap_.reset(new Roadmap(robot_model_, group_name_, roadmap_neighbours, roadmap_resolution));
+    if (!roadmap_->load(roadmap_file_)){
+      planning_scene::PlanningScenePtr snapshot;
+      {
+        planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+        snapshot = planning_scene::PlanningScene::clone(scene);
+      }
+      roadmap_->build(snapshot, roadmap_static_objects, roadmap_milestones);
+      roadmap_->save(roadmap_file_);
+    }
   }
   
-  // Add some extra sleep to make sure the planning scene is loaded
-  usleep(1000000*3);
+  // Publish the latencies of the hot paths
+  if (diagnostics_period > 0.0)
+    Instrumentation::instance().startPublishing(nh, diagnostics_period);
+}
+
+PickNPlace::~PickNPlace()
+{
+  if (roadmap_)
+    roadmap_->save(roadmap_file_);
+  ROS_INFO_STREAM("PickNPlace instrumentation report\n" << Instrumentation::instance().report());
 }
 
 void PickNPlace::getPlanningScene(moveit_msgs::PlanningScene& planning_scene, planning_scene::PlanningScenePtr& full_planning_scene)
 {
+  ScopedTimer timer("get_planning_scene");
   planning_scene_monitor_->requestPlanningSceneState();
   full_planning_scene = planning_scene_monitor_->getPlanningScene();
   full_planning_scene->getPlanningSceneMsg(planning_scene);
@@ -84,26 +242,44 @@ void PickNPlace::getPlanningScene(moveit_msgs::PlanningScene& planning_scene, pl
 
 bool PickNPlace::compute_fk(const sensor_msgs::JointState joints, geometry_msgs::Pose &pose)
 {
+  ScopedTimer timer("compute_fk");
+  if (use_local_kinematics_)
+    return compute_local_fk(joints, pose);
+  
   // Update planning scene and robot state
 //   getPlanningScene(planning_scene_msg_, full_planning_scene_);
   
-  fk_srv_req_.header.stamp = ros::Time::now();
-  fk_srv_req_.robot_state = planning_scene_msg_.robot_state;
-  fk_srv_req_.robot_state.joint_state = joints;
-  fk_service_client_.call(fk_srv_req_, fk_srv_resp_);
+  moveit_msgs::GetPositionFK::Request fk_srv_req = fk_srv_req_;
+  moveit_msgs::GetPositionFK::Response fk_srv_resp;
+  fk_srv_req.header.stamp = ros::Time::now();
+  {
+    planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+    robot_state::robotStateToRobotStateMsg(scene->getCurrentState(), fk_srv_req.robot_state, false);
+  }
+  fk_srv_req.robot_state.joint_state = joints;
+  fk_service_client_.call(fk_srv_req, fk_srv_resp);
   
-  if(fk_srv_resp_.error_code.val !=1){
-    ROS_ERROR("FK couldn't find a solution (error code %d)", fk_srv_resp_.error_code.val);
+  if(fk_srv_resp.error_code.val !=1){
+    ROS_ERROR("FK couldn't find a solution (error code %d)", fk_srv_resp.error_code.val);
     return false;
   }
   
-  ROS_INFO("ee_frame has pose (%.2f, %.2f, %.2f)", fk_srv_resp_.pose_stamped[0].pose.position.x, fk_srv_resp_.pose_stamped[0].pose.position.y, fk_srv_resp_.pose_stamped[0].pose.position.z);
-  pose = fk_srv_resp_.pose_stamped[0].pose;
+  ROS_INFO("ee_frame has pose (%.2f, %.2f, %.2f)", fk_srv_resp.pose_stamped[0].pose.position.x, fk_srv_resp.pose_stamped[0].pose.position.y, fk_srv_resp.pose_stamped[0].pose.position.z);
+  pose = fk_srv_resp.pose_stamped[0].pose;
   return true;
 }
 
 bool PickNPlace::compute_ik(const geometry_msgs::Pose pose, sensor_msgs::JointState &joints)
 {
+  ScopedTimer timer("compute_ik");
+  if (reachability_map_ && reachability_map_->isOutOfReach(pose)){
+    ROS_ERROR("Pose (%.2f, %.2f, %.2f) is out of reach", pose.position.x, pose.position.y, pose.position.z);
+    Instrumentation::instance().count("ik_out_of_reach");
+    return false;
+  }
+  if (use_local_kinematics_)
+    return compute_local_ik(pose, joints);
+  
   // Update planning scene and robot state
 //   getPlanningScene(planning_scene_msg_, full_planning_scene_);
 //   group_->getCurrentState()->update(true);
@@ -111,31 +287,103 @@ bool PickNPlace::compute_ik(const geometry_msgs::Pose pose, sensor_msgs::JointSt
 //   std::vector<double> test_joints;
 //   this->getCurrentJointPosition(test_joints);
   
-  // setup IK request
-//   ik_srv_req_.ik_request.robot_state = planning_scene_msg_.robot_state;
-  ik_srv_req_.ik_request.pose_stamped.header.stamp = ros::Time::now();
-  ik_srv_req_.ik_request.pose_stamped.header.frame_id = base_frame_;
-  ik_srv_req_.ik_request.pose_stamped.pose = pose;
+  // setup IK request, seeded with the solution of a nearby pose
+//   ik_srv_req.ik_request.robot_state = planning_scene_msg_.robot_state;
+  moveit_msgs::GetPositionIK::Request ik_srv_req = ik_srv_req_;
+  moveit_msgs::GetPositionIK::Response ik_srv_resp;
+  ik_srv_req.ik_request.robot_state = moveit_msgs::RobotState();
+  ik_srv_req.ik_request.robot_state.is_diff = true;
+  std::vector<double> seed;
+  if (lookupIkSeed(pose, seed)){
+    ik_srv_req.ik_request.robot_state.joint_state.name = joint_model_group_->getVariableNames();
+    ik_srv_req.ik_request.robot_state.joint_state.position = seed;
+  }
+  ik_srv_req.ik_request.pose_stamped.header.stamp = ros::Time::now();
+  ik_srv_req.ik_request.pose_stamped.header.frame_id = base_frame_;
+  ik_srv_req.ik_request.pose_stamped.pose = pose;
   
-  ik_service_client_.call(ik_srv_req_, ik_srv_resp_);
-  if(ik_srv_resp_.error_code.val !=1){
-    ROS_ERROR("IK couldn't find a solution (error code %d)", ik_srv_resp_.error_code.val);
+  ik_service_client_.call(ik_srv_req, ik_srv_resp);
+  if(ik_srv_resp.error_code.val !=1){
+    ROS_ERROR("IK couldn't find a solution (error code %d)", ik_srv_resp.error_code.val);
+    Instrumentation::instance().count("ik_failures");
     return false;
   }
   ROS_INFO("IK returned succesfully");
 
-  joints = ik_srv_resp_.solution.joint_state;
+  joints = ik_srv_resp.solution.joint_state;
+  if (ik_seed_store_){
+    std::vector<double> solution;
+    jointStateToGroupPositions(joints, solution);
+    ik_seed_store_->insert(pose, solution);
+  }
   
 //   this->IKCorrection(joints);
   
   return true;
 }
 
-bool PickNPlace::getCurrentCartesianPose(geometry_msgs::Pose &pose, std::string target_frame)
+bool PickNPlace::lookupIkSeed(const geometry_msgs::Pose &pose, std::vector<double> &seed)
 {
-  // Update planning scene and robot state
-  getPlanningScene(planning_scene_msg_, full_planning_scene_);
+  // Past solutions first, they were found with the current scene. The seed is set as the
+  // group positions, so it must have a value per variable of the group
+  if ((ik_seed_store_ && ik_seed_store_->lookup(pose, seed)) 
+      || (reachability_map_ && reachability_map_->lookupSeed(pose, seed)))
+    return seed.size() == joint_model_group_->getVariableCount();
+  return false;
+}
+
+bool PickNPlace::compute_local_fk(const sensor_msgs::JointState joints, geometry_msgs::Pose &pose)
+{
+  planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+  robot_state::RobotState state(scene->getCurrentState());
+  state.setVariableValues(joints);
+  state.update();
+  
+  // Express the end-effector pose in the base frame, as the FK service does
+  Eigen::Affine3d ee_pose = state.getFrameTransform(base_frame_).inverse() * state.getGlobalLinkTransform(ee_frame_);
+  tf::poseEigenToMsg(ee_pose, pose);
+  
+  ROS_DEBUG("ee_frame has pose (%.2f, %.2f, %.2f)", pose.position.x, pose.position.y, pose.position.z);
+  return true;
+}
+
+bool PickNPlace::compute_local_ik(const geometry_msgs::Pose pose, sensor_msgs::JointState &joints)
+{
+  // The solver may run for ik_attempts_ timeouts, the monitor keeps updating the original scene meanwhile
+  planning_scene::PlanningScenePtr snapshot;
+  {
+    planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+    snapshot = planning_scene::PlanningScene::clone(scene);
+  }
+  robot_state::RobotState state(snapshot->getCurrentState());
+  
+  // The solver starts from the group positions of the state
+  std::vector<double> seed;
+  if (lookupIkSeed(pose, seed))
+    state.setJointGroupPositions(joint_model_group_, seed);
+  
+  // The requested pose is in the base frame, setFromIK expects it in the model frame
+  Eigen::Affine3d target_pose;
+  tf::poseMsgToEigen(pose, target_pose);
+  target_pose = state.getFrameTransform(base_frame_) * target_pose;
   
+  if (!state.setFromIK(joint_model_group_, target_pose, ee_frame_, ik_attempts_, ik_timeout_,
+                       boost::bind(&isIKSolutionCollisionFree, snapshot.get(), _1, _2, _3))){
+    ROS_ERROR("Local IK couldn't find a solution");
+    Instrumentation::instance().count("ik_failures");
+    return false;
+  }
+  ROS_DEBUG("Local IK returned succesfully");
+  
+  joints.name = joint_model_group_->getVariableNames();
+  state.copyJointGroupPositions(joint_model_group_, joints.position);
+  if (ik_seed_store_)
+    ik_seed_store_->insert(pose, joints.position);
+  return true;
+}
+
+bool PickNPlace::getCurrentCartesianPose(geometry_msgs::Pose &pose, std::string target_frame)
+{
   // Call IK with current joint state
 //   return compute_fk(planning_scene_msg_.robot_state.joint_state, pose);
   pose = group_->getCurrentPose(target_frame).pose;
@@ -144,10 +392,15 @@ bool PickNPlace::getCurrentCartesianPose(geometry_msgs::Pose &pose, std::string
 
 bool PickNPlace::getCurrentJointPosition(std::vector<double> &joints)
 {
-  // Update planning scene and robot state
-  getPlanningScene(planning_scene_msg_, full_planning_scene_);
-  
-  joints = planning_scene_msg_.robot_state.joint_state.position;
+  // Read the robot state kept up to date by the planning scene monitor, all the joints of
+  // the robot in the order of the planning scene message
+  moveit_msgs::RobotState state;
+  {
+    ScopedTimer timer("scene_query");
+    planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+    robot_state::robotStateToRobotStateMsg(scene->getCurrentState(), state, false);
+  }
+  joints = state.joint_state.position;
   
   for (int i=0; i<joints.size() ;i++){
     ROS_WARN_STREAM("Joint "<<i<<" is : "<<joints[i]);
@@ -156,13 +409,51 @@ bool PickNPlace::getCurrentJointPosition(std::vector<double> &joints)
   return true;
 }
 
-bool PickNPlace::executeJointTrajectory(const MoveGroupPlan mg_plan)
+bool PickNPlace::executeJointTrajectory(const MoveGroupPlan mg_plan, bool shortcut)
+{
+  MoveGroupPlan plan = mg_plan;
+  processTrajectory(plan, shortcut);
+  if (cancel_check_)
+    return sendTrajectoryUnlessCancelled(plan, cancel_check_);
+  return sendTrajectory(plan);
+}
+
+void PickNPlace::setCancelCheck(const MotionHandle::CancelCheck &cancel_check)
+{
+  cancel_check_ = cancel_check;
+}
+
+void PickNPlace::processTrajectory(MoveGroupPlan &plan, bool shortcut)
+{
+  if (!trajectory_processor_)
+    return;
+  
+  // Shorten and retime the trajectory, or send it as planned if that fails. The shortcutting
+  // works on a copy of the scene so that the monitor keeps applying updates meanwhile
+  ScopedTimer timer("trajectory_processing");
+  planning_scene::PlanningScenePtr snapshot;
+  if (shortcut){
+    planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+    snapshot = planning_scene::PlanningScene::clone(scene);
+  }
+  MoveGroupPlan processed_plan = plan;
+  if (trajectory_processor_->process(processed_plan.start_state_, processed_plan.trajectory_, snapshot))
+    plan = processed_plan;
+  else
+    ROS_WARN("Executing the trajectory without retiming");
+}
+
+bool PickNPlace::sendTrajectory(const MoveGroupPlan &plan)
 {
-  int num_pts = mg_plan.trajectory_.joint_trajectory.points.size();
+  int num_pts = plan.trajectory_.joint_trajectory.points.size();
   ROS_INFO("Executing joint trajectory with %d knots and duration %f", num_pts, 
-      mg_plan.trajectory_.joint_trajectory.points[num_pts-1].time_from_start.toSec());
+      plan.trajectory_.joint_trajectory.points[num_pts-1].time_from_start.toSec());
   
-  return group_->execute(mg_plan);
+  ScopedTimer timer("execute");
+  bool success = group_->execute(plan);
+  if (!success)
+    Instrumentation::instance().count("execution_failures");
+  return success;
 }
 
 void PickNPlace::stopJointTrajectory()
@@ -171,20 +462,170 @@ void PickNPlace::stopJointTrajectory()
   group_->stop();
 }
 
-bool PickNPlace::moveToJointPosition(const std::vector<double> joint_vals)
+bool PickNPlace::planToJointPosition(const std::vector<double> joint_vals, MoveGroupPlan &plan)
 {
-//   getPlanningScene(planning_scene_msg_, full_planning_scene_);
-//   group_->getCurrentState()->update(true);
+  std::string goal_key = plan_cache_ ? plan_cache_->jointGoalKey(joint_vals) : "";
+  if (plan_cache_ && lookupCachedPlan(goal_key, jointGoalConstraints(joint_vals), plan)){
+    ROS_INFO("Motion to joint position found in the plan cache");
+    return true;
+  }
+  
+  if (roadmap_ && planWithRoadmap(joint_vals, plan)){
+    storeCachedPlan(goal_key, plan);
+    return true;
+  }
+  
+  // Plan trajectory, the move group may be executing when planning ahead
+  bool success;
+  if (has_plan_start_state_)
+    success = planWithPipeline(joint_vals, plan);
+  else{
+    group_->setJointValueTarget(joint_vals);
+    success = planWithMoveGroup(plan);
+  }
+  if (!success){
+    ROS_INFO("Motion planning to joint position failed");
+    return false;
+  }
+  ROS_INFO("Motion planning to joint position successful");
+  storeCachedPlan(goal_key, plan);
+  return true;
+}
+
+bool PickNPlace::planToCartesianPose(const geometry_msgs::Pose pose, MoveGroupPlan &plan)
+{
+  // A cached plan also saves the IK call
+  std::string goal_key = PlanCache::poseGoalKey(pose);
+  if (plan_cache_ && lookupCachedPlan(goal_key, poseGoalConstraints(pose), plan)){
+    ROS_INFO("Motion to position (%.2f, %.2f, %.2f) found in the plan cache", 
+        pose.position.x, pose.position.y, pose.position.z);
+    return true;
+  }
+  
+  // Compute ik
+  sensor_msgs::JointState joints_ik;
+  if (!compute_ik(pose, joints_ik))
+    return false;
+
+  // Plan trajectory
+  if (!planToJointState(joints_ik, plan)){
+      ROS_INFO("Motion planning to position (%.2f, %.2f, %.2f) failed", 
+      pose.position.x, pose.position.y, pose.position.z);
+    return false;
+  }
+  ROS_INFO("Motion planning to position (%.2f, %.2f, %.2f) successful", 
+      pose.position.x, pose.position.y, pose.position.z);
+  storeCachedPlan(goal_key, plan);
+  return true;
+}
+
+bool PickNPlace::planToJointState(const sensor_msgs::JointState joints, MoveGroupPlan &plan)
+{
+  std::vector<double> joint_vals;
+  jointStateToGroupPositions(joints, joint_vals);
+  if (roadmap_ && planWithRoadmap(joint_vals, plan))
+    return true;
+  if (planner_race_ || has_plan_start_state_)
+    return planWithPipeline(joint_vals, plan);
   
   // Set joint target
-  group_->setJointValueTarget(joint_vals);
+  group_->setJointValueTarget(joints);
 
   // Plan trajectory
-  if (!group_->plan(next_plan_)){
-      ROS_INFO("Motion planning to joint position failed");
+  return planWithMoveGroup(plan);
+}
+
+bool PickNPlace::planWithMoveGroup(MoveGroupPlan &plan)
+{
+  ScopedTimer timer("plan");
+  bool success = group_->plan(plan);
+  if (!success)
+    Instrumentation::instance().count("plan_failures");
+  return success;
+}
+
+bool PickNPlace::planWithRoadmap(const std::vector<double> &joint_vals, MoveGroupPlan &plan)
+{
+  // The roadmap splits its own copy of the scene, the monitor keeps updating the original
+  planning_scene::PlanningScenePtr snapshot;
+  {
+    planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+    snapshot = planning_scene::PlanningScene::clone(scene);
+  }
+  
+  moveit_msgs::RobotState start_state;
+  if (has_plan_start_state_){
+    start_state = plan_start_state_;
+    snapshot->setCurrentState(start_state);
+  }
+  else
+    robot_state::robotStateToRobotStateMsg(snapshot->getCurrentState(), start_state);
+  std::vector<double> start_joints;
+  snapshot->getCurrentState().copyJointGroupPositions(joint_model_group_, start_joints);
+  
+  ScopedTimer timer("roadmap_plan");
+  moveit_msgs::RobotTrajectory trajectory;
+  if (!roadmap_->query(snapshot, start_joints, joint_vals, trajectory.joint_trajectory, roadmap_timeout_)){
+    Instrumentation::instance().count("roadmap_failures");
     return false;
   }
-  ROS_INFO("Motion planning to joint position successful");
+  
+  // The path is timed here, the trajectory processor only retimes it when enabled
+  robot_trajectory::RobotTrajectory robot_trajectory(robot_model_, group_name_);
+  robot_trajectory.setRobotTrajectoryMsg(snapshot->getCurrentState(), trajectory);
+  trajectory_processing::IterativeParabolicTimeParameterization time_parameterization;
+  if (!time_parameterization.computeTimeStamps(robot_trajectory)){
+    ROS_ERROR("Time parameterization of the roadmap path failed");
+    return false;
+  }
+  robot_trajectory.getRobotTrajectoryMsg(plan.trajectory_);
+  plan.start_state_ = start_state;
+  plan.planning_time_ = 0.0;
+  return true;
+}
+
+bool PickNPlace::planToStart(MoveGroupPlan &plan)
+{
+  std::string goal_key = PlanCache::namedGoalKey("start");
+  std::vector<double> start_vals;
+  robot_state::RobotState home_state(robot_model_);
+  home_state.setToDefaultValues(joint_model_group_, "start");
+  home_state.copyJointGroupPositions(joint_model_group_, start_vals);
+  if (plan_cache_ && lookupCachedPlan(goal_key, jointGoalConstraints(start_vals), plan)){
+    ROS_INFO("Home position motion found in the plan cache");
+    return true;
+  }
+  
+  // Plan trajectory, the move group may be executing when planning ahead
+  bool success;
+  if (has_plan_start_state_){
+    robot_state::RobotState start_state(robot_model_);
+    start_state.setToDefaultValues(joint_model_group_, "start");
+    std::vector<double> joint_vals;
+    start_state.copyJointGroupPositions(joint_model_group_, joint_vals);
+    success = planWithPipeline(joint_vals, plan);
+  }
+  else{
+    group_->setNamedTarget("start");
+    success = planWithMoveGroup(plan);
+  }
+  if (!success){
+    ROS_INFO("Home position motion planning failed");
+    return false;
+  }
+  ROS_INFO("Home position motion planning successful");
+  storeCachedPlan(goal_key, plan);
+  return true;
+}
+
+bool PickNPlace::moveToJointPosition(const std::vector<double> joint_vals)
+{
+//   getPlanningScene(planning_scene_msg_, full_planning_scene_);
+//   group_->getCurrentState()->update(true);
+  
+  // Plan trajectory
+  if (!planToJointPosition(joint_vals, next_plan_))
+    return false;
 
   // Execute trajectory
   if (executeJointTrajectory(next_plan_)) {
@@ -203,22 +644,9 @@ bool PickNPlace::moveToCartesianPose(const geometry_msgs::Pose pose)
 //   getPlanningScene(planning_scene_msg_, full_planning_scene_);
 //   group_->getCurrentState()->update(true);
   
-  // Compute ik
-  sensor_msgs::JointState joints_ik;
-  if (!compute_ik(pose, joints_ik))
-    return false;
-
-  // Set joint target
-  group_->setJointValueTarget(joints_ik);
-
-  // Plan trajectory
-  if (!group_->plan(next_plan_)){
-      ROS_INFO("Motion planning to position (%.2f, %.2f, %.2f) failed", 
-      pose.position.x, pose.position.y, pose.position.z);
+  // Compute ik and plan trajectory
+  if (!planToCartesianPose(pose, next_plan_))
     return false;
-  }
-  ROS_INFO("Motion planning to position (%.2f, %.2f, %.2f) successful", 
-      pose.position.x, pose.position.y, pose.position.z);
 
   // Execute trajectory
   if (executeJointTrajectory(next_plan_)) {
@@ -233,14 +661,9 @@ bool PickNPlace::moveToCartesianPose(const geometry_msgs::Pose pose)
 
 bool PickNPlace::moveToStart()
 {
-  group_->setNamedTarget("start");
-  
   // Plan trajectory
-  if (!group_->plan(next_plan_)){
-    ROS_INFO("Home position motion planning failed");
+  if (!planToStart(next_plan_))
     return false;
-  }
-  ROS_INFO("Home position motion planning successful");
 
   // Execute trajectory
   if (executeJointTrajectory(next_plan_)) {
@@ -258,7 +681,7 @@ bool PickNPlace::moveToRandomTarget()
   group_->setRandomTarget();
   
   // Plan trajectory
-  if (!group_->plan(next_plan_)){
+  if (!planWithMoveGroup(next_plan_)){
     ROS_INFO("Motion planning to random target failed");
     return false;
   }
@@ -275,22 +698,126 @@ bool PickNPlace::moveToRandomTarget()
   }
 }
 
-bool PickNPlace::getCollisionObject(const std::string obj_name, moveit_msgs::CollisionObject &object)
+MotionHandle PickNPlace::executeJointTrajectoryAsync(const MoveGroupPlan mg_plan, bool shortcut, 
+                                                     const MotionHandle::DoneCallback &done_callback)
+{
+  return startMotion(boost::bind(&PickNPlace::processAndSendTrajectory, this, mg_plan, shortcut, _1), done_callback);
+}
+
+MotionHandle PickNPlace::moveToJointPositionAsync(const std::vector<double> joint_vals, const MotionHandle::DoneCallback &done_callback)
 {
-  // Update planning scene
-  getPlanningScene(planning_scene_msg_, full_planning_scene_);
+  Planner planner = boost::bind(&PickNPlace::planToJointPosition, this, joint_vals, _1);
+  return startMotion(boost::bind(&PickNPlace::planAndSendTrajectory, this, planner, _1), done_callback);
+}
+
+MotionHandle PickNPlace::moveToCartesianPoseAsync(const geometry_msgs::Pose pose, const MotionHandle::DoneCallback &done_callback)
+{
+  Planner planner = boost::bind(&PickNPlace::planToCartesianPose, this, pose, _1);
+  return startMotion(boost::bind(&PickNPlace::planAndSendTrajectory, this, planner, _1), done_callback);
+}
 
-  for(int i=0;i<planning_scene_msg_.world.collision_objects.size();i++){
-    if(planning_scene_msg_.world.collision_objects[i].id == obj_name){
-      object = planning_scene_msg_.world.collision_objects[i];
-      ROS_INFO_STREAM("Found object "<< obj_name <<" in the planning scene");
-      return true;
+MotionHandle PickNPlace::moveToStartAsync(const MotionHandle::DoneCallback &done_callback)
+{
+  Planner planner = boost::bind(&PickNPlace::planToStart, this, _1);
+  return startMotion(boost::bind(&PickNPlace::planAndSendTrajectory, this, planner, _1), done_callback);
+}
+
+MotionHandle PickNPlace::startMotion(const MotionHandle::Motion &motion, const MotionHandle::DoneCallback &done_callback)
+{
+  {
+    boost::mutex::scoped_lock lock(async_motion_mutex_);
+    if (async_motion_.isDone()){
+      async_motion_ = MotionHandle::start(motion, boost::bind(&PickNPlace::stopJointTrajectory, this), done_callback);
+      return async_motion_;
     }
   }
+  // Failed outside of the lock, the done callback may start another motion
+  ROS_ERROR("A motion is already running, the new one is rejected");
+  return MotionHandle::failed(done_callback);
+}
+
+bool PickNPlace::planAndSendTrajectory(const Planner planner, const MotionHandle::CancelCheck &is_cancelled)
+{
+  MoveGroupPlan plan;
+  if (!planner(plan))
+    return false;
+  return processAndSendTrajectory(plan, true, is_cancelled);
+}
+
+bool PickNPlace::processAndSendTrajectory(const MoveGroupPlan mg_plan, bool shortcut, const MotionHandle::CancelCheck &is_cancelled)
+{
+  if (is_cancelled())
+    return false;
+  MoveGroupPlan plan = mg_plan;
+  processTrajectory(plan, shortcut);
+  return sendTrajectoryUnlessCancelled(plan, is_cancelled);
+}
+
+bool PickNPlace::sendTrajectoryUnlessCancelled(const MoveGroupPlan mg_plan, const MotionHandle::CancelCheck &is_cancelled)
+{
+  if (is_cancelled()){
+    ROS_INFO("Motion cancelled before its trajectory was sent");
+    return false;
+  }
+  
+  // A stop landing while the trajectory is being sent stops nothing, so stop again until the execution returns
+  bool success = false;
+  boost::thread exec_thread(boost::bind(&PickNPlace::sendTrajectoryInto, this, mg_plan, &success));
+  while (!exec_thread.timed_join(boost::posix_time::milliseconds(CANCEL_MONITOR_PERIOD_MS))){
+    if (is_cancelled())
+      stopJointTrajectory();
+  }
+  return success;
+}
+
+bool PickNPlace::getCollisionObject(const std::string obj_name, moveit_msgs::CollisionObject &object)
+{
+  ScopedTimer timer("scene_query");
+  planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+  if (scene->getCollisionObjectMsg(object, obj_name)){
+    ROS_INFO_STREAM("Found object "<< obj_name <<" in the planning scene");
+    return true;
+  }
   ROS_ERROR_STREAM("Failed to find object "<< obj_name <<" in the planning scene");
   return false;
 }
 
+bool PickNPlace::getObjectPose(const std::string obj_name, geometry_msgs::PoseStamped &pose)
+{
+  ScopedTimer timer("scene_query");
+  planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+  const planning_scene::PlanningSceneConstPtr &scene_ptr = scene;
+  collision_detection::World::ObjectConstPtr object = scene_ptr->getWorld()->getObject(obj_name);
+  if (!object || object->shape_poses_.empty()){
+    ROS_ERROR_STREAM("Failed to find object "<< obj_name<< " in the scene !!!");
+    return false;
+  }
+  
+  // Pose of the first shape, in the planning frame
+  pose.header.frame_id = scene_ptr->getPlanningFrame();
+  pose.header.stamp = ros::Time(0);
+  tf::poseEigenToMsg(object->shape_poses_[0], pose.pose);
+  return true;
+}
+
+bool PickNPlace::getWorldObjectIds(std::vector<std::string> &ids)
+{
+  planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+  ids = scene->getWorld()->getObjectIds();
+  return true;
+}
+
+bool PickNPlace::getAttachedObjectIds(std::vector<std::string> &ids)
+{
+  planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+  std::vector<const robot_state::AttachedBody*> attached_bodies;
+  scene->getCurrentState().getAttachedBodies(attached_bodies);
+  ids.clear();
+  for (int i=0; i<attached_bodies.size(); i++)
+    ids.push_back(attached_bodies[i]->getName());
+  return true;
+}
+
 bool PickNPlace::verticalMove(double target_z)
 {
   ROS_INFO("Vertical move to target z: %f", target_z);
@@ -307,29 +834,15 @@ bool PickNPlace::verticalMove(double target_z)
       pose2.position.x, pose2.position.y, pose2.position.z, pose2.orientation.x, pose2.orientation.y, pose2.orientation.z, pose2.orientation.w);
   
   // Find linear trajectory
-  moveit_msgs::RobotTrajectory lin_traj_msg;
   std::vector<geometry_msgs::Pose> waypoints;
 //   waypoints.push_back(pose1);
   waypoints.push_back(pose2);
-
-  // Call cartesian path service
-  cart_path_srv_req_.header.stamp = ros::Time::now();
-  cart_path_srv_req_.waypoints = waypoints;
-  robot_state::robotStateToRobotStateMsg(*group_->getCurrentState(), cart_path_srv_req_.start_state);
-  cartesian_path_service_client_.call(cart_path_srv_req_,cart_path_srv_resp_);
-  if (cart_path_srv_resp_.error_code.val != 1) {
-    ROS_ERROR("Cartesian path service returned with error code %d", cart_path_srv_resp_.error_code.val);
-    return false;
-  }
-  if(cart_path_srv_resp_.fraction < 0.0) {
-    ROS_ERROR("Failed compute a correct CartesianPath");
+  MoveGroupPlan lin_traj_plan;
+  if (!planLinearPath(waypoints, lin_traj_plan))
     return false;
-  }
 
-  // Execute plan
-  MoveGroupPlan lin_traj_plan;
-  lin_traj_plan.trajectory_ = cart_path_srv_resp_.solution;
-  if (executeJointTrajectory(lin_traj_plan)) {
+  // Execute plan, shortcuts would leave the vertical line
+  if (executeJointTrajectory(lin_traj_plan, false)) {
     ROS_INFO("Vertical joint trajectory execution successful");
     return true;
   }
@@ -339,13 +852,98 @@ bool PickNPlace::verticalMove(double target_z)
   }
 }
 
+bool PickNPlace::planLinearPath(const std::vector<geometry_msgs::Pose> &waypoints, MoveGroupPlan &plan)
+{
+  // Start from the plan start state when planning ahead, as the other planners do
+  moveit_msgs::GetCartesianPath::Request request = cart_path_srv_req_;
+  moveit_msgs::GetCartesianPath::Response response;
+  request.header.stamp = ros::Time::now();
+  request.waypoints = waypoints;
+  if (has_plan_start_state_)
+    request.start_state = plan_start_state_;
+  else
+    robot_state::robotStateToRobotStateMsg(*group_->getCurrentState(), request.start_state);
+  {
+    ScopedTimer timer("cartesian_path");
+    if (!cartesian_path_service_client_.call(request, response)){
+      ROS_ERROR("Failed to call the cartesian path service");
+      return false;
+    }
+  }
+  if (response.error_code.val != 1) {
+    ROS_ERROR("Cartesian path service returned with error code %d", response.error_code.val);
+    Instrumentation::instance().count("plan_failures");
+    return false;
+  }
+  if (response.fraction < cartesian_min_fraction_) {
+    ROS_ERROR("Only %.0f%% of the cartesian path could be computed", 100.0*response.fraction);
+    Instrumentation::instance().count("plan_failures");
+    return false;
+  }
+  
+  plan.trajectory_ = response.solution;
+  plan.start_state_ = request.start_state;
+  plan.planning_time_ = 0.0;
+  return true;
+}
+
+bool PickNPlace::moveLinear(const geometry_msgs::Pose target_pose)
+{
+  MoveGroupPlan plan;
+  if (!planLinearPath(std::vector<geometry_msgs::Pose>(1, target_pose), plan))
+    return false;
+  return executeJointTrajectory(plan, false);
+}
+
+bool PickNPlace::moveLinearOrPlanned(const geometry_msgs::Pose target_pose)
+{
+  // Only a line that cannot be planned falls back to a free motion. A failed or stopped
+  // execution is returned as is, the arm must not start again after a preemption
+  MoveGroupPlan plan;
+  if (!planLinearPath(std::vector<geometry_msgs::Pose>(1, target_pose), plan)){
+    ROS_WARN("No straight line to the target, planning a free motion");
+    return moveToCartesianPose(target_pose);
+  }
+  return executeJointTrajectory(plan, false);
+}
+
+geometry_msgs::Pose PickNPlace::offsetPose(const geometry_msgs::Pose pose, const tf::Vector3 axis, double distance)
+{
+  // The axis is expressed in the frame of the pose, e.g. the tool or object axis
+  tf::Pose tf_pose;
+  tf::poseMsgToTF(pose, tf_pose);
+  tf_pose.setOrigin(tf_pose.getOrigin() + tf::quatRotate(tf_pose.getRotation(), axis.normalized()) * distance);
+  geometry_msgs::Pose offset_pose;
+  tf::poseTFToMsg(tf_pose, offset_pose);
+  return offset_pose;
+}
+
+int PickNPlace::getWaypointIndex(const MoveGroupPlan &plan, const geometry_msgs::Pose &waypoint)
+{
+  // Trajectory point where the end-effector is the closest to the waypoint
+  const trajectory_msgs::JointTrajectory &traj = plan.trajectory_.joint_trajectory;
+  robot_state::RobotState state(robot_model_);
+  state.setToDefaultValues();
+  Eigen::Vector3d target(waypoint.position.x, waypoint.position.y, waypoint.position.z);
+  double best_distance = std::numeric_limits<double>::max();
+  int best_index = 0;
+  for (int i=0; i<traj.points.size(); i++){
+    state.setVariablePositions(traj.joint_names, traj.points[i].positions);
+    state.update();
+    Eigen::Affine3d ee_pose = state.getFrameTransform(base_frame_).inverse() * state.getGlobalLinkTransform(ee_frame_);
+    double distance = (ee_pose.translation() - target).norm();
+    if (distance < best_distance){
+      best_distance = distance;
+      best_index = i;
+    }
+  }
+  return best_index;
+}
+
 bool PickNPlace::verticalMoveBis(double target_z)
 {
   ROS_INFO("Vertical move to target z: %f", target_z);
 
-  // Update planning scene and robot state
-  getPlanningScene(planning_scene_msg_, full_planning_scene_);
-
   // Set two waypoints for the linear trajectory
   geometry_msgs::Pose pose = group_->getCurrentPose(ee_frame_).pose;
   pose.position.z = target_z;
@@ -372,7 +970,7 @@ bool PickNPlace::verticalMoveBis(double target_z)
   group_->setJointValueTarget(joints_ik);
   
     // Plan trajectory
-  if (!group_->plan(next_plan_)){
+  if (!planWithMoveGroup(next_plan_)){
     group_->clearPathConstraints();
       ROS_INFO("Motion planning to position (%.2f, %.2f, %.2f) failed", 
       pose.position.x, pose.position.y, pose.position.z);
@@ -382,8 +980,8 @@ bool PickNPlace::verticalMoveBis(double target_z)
   ROS_INFO("Motion planning to position (%.2f, %.2f, %.2f) successful", 
       pose.position.x, pose.position.y, pose.position.z);
 
-  // Execute trajectory
-  if (executeJointTrajectory(next_plan_)) {
+  // Execute trajectory, shortcuts do not check the path constraints
+  if (executeJointTrajectory(next_plan_, false)) {
     ROS_INFO("Trajectory execution successful");
     return true;
   }
@@ -394,12 +992,9 @@ bool PickNPlace::verticalMoveBis(double target_z)
   
 }
 
-bool PickNPlace::addCylinderObject(const geometry_msgs::Pose object_pose)
+bool PickNPlace::makeCylinderObject(const geometry_msgs::Pose object_pose, moveit_msgs::CollisionObject &collision_object, const std::string id)
 {
-  getPlanningScene(planning_scene_msg_, full_planning_scene_);
-  
-  moveit_msgs::CollisionObject collision_object;
-  collision_object.id = "cylinder";
+  collision_object.id = id;
   collision_object.header.frame_id = "base_link";
   collision_object.header.stamp = ros::Time::now();
   collision_object.operation = moveit_msgs::CollisionObject::ADD;
@@ -409,135 +1004,154 @@ bool PickNPlace::addCylinderObject(const geometry_msgs::Pose object_pose)
   primitive_object.type = shape_msgs::SolidPrimitive::CYLINDER;
   primitive_object.dimensions.push_back(0.13); // height
   primitive_object.dimensions.push_back(0.015); // radius
+  collision_object.primitives.clear();
+  collision_object.primitive_poses.clear();
   collision_object.primitives.push_back(primitive_object);
   collision_object.primitive_poses.push_back(object_pose);
-
-  // Put the object in the environment //
-  planning_scene_msg_.world.collision_objects.clear();
-  planning_scene_msg_.world.collision_objects.push_back(collision_object);
-  planning_scene_msg_.is_diff = true;
-  planning_scene_diff_publisher_.publish(planning_scene_msg_);
-    
   return true;
 }
 
-
-bool PickNPlace::addBoxObject(const geometry_msgs::Pose object_pose)
+bool PickNPlace::makeBoxObject(const geometry_msgs::Pose object_pose, moveit_msgs::CollisionObject &collision_object, const std::string id)
 {
-  getPlanningScene(planning_scene_msg_, full_planning_scene_);
-  
-  moveit_msgs::CollisionObject collision_object;
-  collision_object.id = "box";
+  collision_object.id = id;
   collision_object.header.frame_id = "base_link";
   collision_object.header.stamp = ros::Time::now();
   collision_object.operation = moveit_msgs::CollisionObject::ADD;
   
-  // Define the collision object as a cylinder
+  // Define the collision object as a box
   shape_msgs::SolidPrimitive primitive_object;
   primitive_object.type = shape_msgs::SolidPrimitive::BOX;
   primitive_object.dimensions.push_back(0.5); 
   primitive_object.dimensions.push_back(0.5);
   primitive_object.dimensions.push_back(0.5);
+  collision_object.primitives.clear();
+  collision_object.primitive_poses.clear();
   collision_object.primitives.push_back(primitive_object);
   collision_object.primitive_poses.push_back(object_pose);
-
-  // Put the object in the environment //
-  planning_scene_msg_.world.collision_objects.clear();
-  planning_scene_msg_.world.collision_objects.push_back(collision_object);
-  planning_scene_msg_.is_diff = true;
-  planning_scene_diff_publisher_.publish(planning_scene_msg_);
-    
   return true;
 }
 
-bool PickNPlace::addEpingleObject(const geometry_msgs::Pose object_pose)
+bool PickNPlace::makeEpingleObject(const geometry_msgs::Pose object_pose, moveit_msgs::CollisionObject &collision_object, const std::string id)
 {
-  getPlanningScene(planning_scene_msg_, full_planning_scene_);
-  
-  moveit_msgs::CollisionObject collision_object;
-  collision_object.id = "epingle";
+  collision_object.id = id;
   collision_object.header.frame_id = "base_link";
   collision_object.header.stamp = ros::Time::now();
   collision_object.operation = moveit_msgs::CollisionObject::ADD;
   
-  // Define the collision object as a mesh
-  shapes::Mesh* m;
-  shape_msgs::Mesh co_mesh;
-  shapes::ShapeMsg co_mesh_msg;  
-  m = shapes::createMeshFromResource("package://lwr_pick_n_place/meshes/epingle.stl");
-  shapes::constructMsgFromShape(m,co_mesh_msg);
-  co_mesh = boost::get<shape_msgs::Mesh>(co_mesh_msg);
-  collision_object.meshes.clear();
-  collision_object.mesh_poses.clear();
-  collision_object.meshes.push_back(co_mesh);
-  collision_object.mesh_poses.push_back(object_pose);
-
-  // Put the object in the environment //
-  planning_scene_msg_.world.collision_objects.clear();
-  planning_scene_msg_.world.collision_objects.push_back(collision_object);
-  planning_scene_msg_.is_diff = true;
-  planning_scene_diff_publisher_.publish(planning_scene_msg_);
-    
-  return true;
+  // Define the collision object from the mesh, simplified as configured
+  return collision_geometry_->makeGeometry("package://lwr_pick_n_place/meshes/epingle.stl", object_pose, collision_object);
 }
 
-bool PickNPlace::addPlaqueObject(const geometry_msgs::Pose object_pose)
+bool PickNPlace::makePlaqueObject(const geometry_msgs::Pose object_pose, moveit_msgs::CollisionObject &collision_object, const std::string id)
 {
-  getPlanningScene(planning_scene_msg_, full_planning_scene_);
-  
-  moveit_msgs::CollisionObject collision_object;
-  collision_object.id = "plaque";
+  collision_object.id = id;
   collision_object.header.frame_id = "base_link";
   collision_object.header.stamp = ros::Time::now();
   collision_object.operation = moveit_msgs::CollisionObject::ADD;
   
-  // Define the collision object as a mesh
-  shapes::Mesh* m;
-  shape_msgs::Mesh co_mesh;
-  shapes::ShapeMsg co_mesh_msg;  
-  m = shapes::createMeshFromResource("package://lwr_pick_n_place/meshes/plaque.stl");
-  shapes::constructMsgFromShape(m,co_mesh_msg);
-  co_mesh = boost::get<shape_msgs::Mesh>(co_mesh_msg);
-  collision_object.meshes.clear();
-  collision_object.mesh_poses.clear();
-  collision_object.meshes.push_back(co_mesh);
-  collision_object.mesh_poses.push_back(object_pose);
-
-  // Put the object in the environment //
-  planning_scene_msg_.world.collision_objects.clear();
-  planning_scene_msg_.world.collision_objects.push_back(collision_object);
-  planning_scene_msg_.is_diff = true;
-  planning_scene_diff_publisher_.publish(planning_scene_msg_);
-    
+  // Define the collision object from the mesh, simplified as configured
+  return collision_geometry_->makeGeometry("package://lwr_pick_n_place/meshes/plaque.stl", object_pose, collision_object);
+}
+
+bool PickNPlace::addCylinderObject(const geometry_msgs::Pose object_pose, const std::string id)
+{
+  SceneTransaction transaction;
+  moveit_msgs::CollisionObject collision_object;
+  if (!makeCylinderObject(object_pose, collision_object, id))
+    return false;
+  transaction.addObject(collision_object);
+  return applySceneTransaction(transaction);
+}
+
+bool PickNPlace::addBoxObject(const geometry_msgs::Pose object_pose, const std::string id)
+{
+  SceneTransaction transaction;
+  moveit_msgs::CollisionObject collision_object;
+  if (!makeBoxObject(object_pose, collision_object, id))
+    return false;
+  transaction.addObject(collision_object);
+  return applySceneTransaction(transaction);
+}
+
+bool PickNPlace::addEpingleObject(const geometry_msgs::Pose object_pose, const std::string id)
+{
+  SceneTransaction transaction;
+  moveit_msgs::CollisionObject collision_object;
+  if (!makeEpingleObject(object_pose, collision_object, id))
+    return false;
+  transaction.addObject(collision_object);
+  return applySceneTransaction(transaction);
+}
+
+bool PickNPlace::addPlaqueObject(const geometry_msgs::Pose object_pose, const std::string id)
+{
+  SceneTransaction transaction;
+  moveit_msgs::CollisionObject collision_object;
+  if (!makePlaqueObject(object_pose, collision_object, id))
+    return false;
+  transaction.addObject(collision_object);
+  return applySceneTransaction(transaction);
+}
+
+bool PickNPlace::applySceneTransaction(const SceneTransaction &transaction)
+{
+  if (transaction.empty())
+    return true;
+  
+  // One diff and one synchronization, whatever the number of objects
+  ScopedTimer timer("scene_transaction");
+  forgetEpingleGrasps(transaction.getDiff());
+  unsigned long sequence = scene_sync_->getSequence();
+  planning_scene_diff_publisher_.publish(transaction.getDiff());
+  if (!waitForScene(transaction.getPredicate(), sequence)){
+    ROS_ERROR_STREAM("The planning scene did not reflect the "<< transaction.size()<< " object operation(s)");
+    return false;
+  }
   return true;
 }
 
 
-moveit_msgs::CollisionObjectPtr PickNPlace::getCollisionObject(std::string object_name)
+std::string PickNPlace::makeInstanceId(const std::string &prefix, int index)
 {
-  // update the planning scene to get the robot's state
-  getPlanningScene(planning_scene_msg_, full_planning_scene_);
+  return prefix + "_" + boost::lexical_cast<std::string>(index);
+}
 
-  for(int i=0;i<planning_scene_msg_.world.collision_objects.size();i++){
-    if(planning_scene_msg_.world.collision_objects[i].id == object_name){ 
-      return moveit_msgs::CollisionObjectPtr(new moveit_msgs::CollisionObject(planning_scene_msg_.world.collision_objects[i]));
-    }
+bool PickNPlace::addEpingleTray(const std::vector<geometry_msgs::Pose> &poses, std::vector<std::string> &ids, const std::string prefix)
+{
+  SceneTransaction transaction;
+  ids.clear();
+  for (int i=0; i<poses.size(); i++){
+    moveit_msgs::CollisionObject collision_object;
+    if (!makeEpingleObject(poses[i], collision_object, makeInstanceId(prefix, i)))
+      return false;
+    transaction.addObject(collision_object);
+    ids.push_back(collision_object.id);
   }
-  ROS_ERROR_STREAM("Failed to find object "<< object_name<< " in the scene !!!");
-  return moveit_msgs::CollisionObjectPtr();
+  ROS_INFO("Adding a tray of %d %s", (int)ids.size(), prefix.c_str());
+  return applySceneTransaction(transaction);
+}
+
+moveit_msgs::CollisionObjectPtr PickNPlace::getCollisionObject(std::string object_name)
+{
+  moveit_msgs::CollisionObjectPtr object(new moveit_msgs::CollisionObject);
+  if (!getCollisionObject(object_name, *object))
+    return moveit_msgs::CollisionObjectPtr();
+  return object;
 }
 
 bool PickNPlace::attachObject(std::string object_name){ 
 
-  moveit_msgs::CollisionObjectPtr coll_obj = getCollisionObject(object_name);
-  if (coll_obj) {
+  // Only check the object is there, the geometry is taken from the world when attaching by id
+  geometry_msgs::PoseStamped object_pose;
+  if (getObjectPose(object_name, object_pose)) {
     ROS_INFO_STREAM("Attaching object "<<object_name<<" to the end-effector");
     moveit_msgs::AttachedCollisionObject attached_object;
     attached_object.link_name = ee_frame_;
-    attached_object.object = *coll_obj;
+    attached_object.object.id = object_name;
     attached_object.object.operation = attached_object.object.ADD;
+    unsigned long sequence = scene_sync_->getSequence();
     attached_object_publisher_.publish(attached_object);
-    return true;
+    return waitForScene(SceneSynchronizer::objectAttached(object_name), sequence);
   } else 
     return false;
   
@@ -546,13 +1160,23 @@ bool PickNPlace::attachObject(std::string object_name){
 bool PickNPlace::detachObject(){
   ROS_INFO_STREAM("Detaching object from the robot");
 
-  // update the planning scene to get the robot's state
-  getPlanningScene(planning_scene_msg_, full_planning_scene_);
-
-  if (planning_scene_msg_.robot_state.attached_collision_objects.size()>0){
-    moveit_msgs::AttachedCollisionObject attached_object = planning_scene_msg_.robot_state.attached_collision_objects[0];
+  SceneTransaction transaction;
+  {
+    ScopedTimer timer("scene_query");
+    planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+    const planning_scene::PlanningSceneConstPtr &scene_ptr = scene;
+    const robot_state::RobotState &state = scene_ptr->getCurrentState();
+    std::vector<const robot_state::AttachedBody*> attached_bodies;
+    state.getAttachedBodies(attached_bodies);
+    if (attached_bodies.empty()){
+      ROS_ERROR("There was no object attached to the robot");
+      return false;
+    }
+    const robot_state::AttachedBody *attached_body = attached_bodies[0];
+    
+    // End-effector pose in the base frame
     geometry_msgs::Pose object_pose;
-    this->compute_fk(planning_scene_msg_.robot_state.joint_state, object_pose);
+    tf::poseEigenToMsg(state.getFrameTransform(base_frame_).inverse() * state.getGlobalLinkTransform(ee_frame_), object_pose);
 
     // TODO
     // Translation between /link_7 and /ati_link
@@ -562,88 +1186,288 @@ bool PickNPlace::detachObject(){
     tf::quaternionMsgToTF(object_pose.orientation, co_quat);
     double roll, pitch, yaw;
     tf::Matrix3x3(co_quat).getRPY(roll, pitch, yaw);
-    tf::Quaternion quat = tf::createQuaternionFromRPY(0,0,yaw);
+    tf::quaternionTFToMsg(tf::createQuaternionFromRPY(0,0,yaw), object_pose.orientation);
     
-    attached_object.object.header.frame_id = "base_link";
-    
-    if (attached_object.object.primitive_poses.size() >0){
-
-    attached_object.object.primitive_poses[0].position = object_pose.position;
-    attached_object.object.primitive_poses[0].orientation.x = quat.x();
-    attached_object.object.primitive_poses[0].orientation.y = quat.y();
-    attached_object.object.primitive_poses[0].orientation.z = quat.z();
-    attached_object.object.primitive_poses[0].orientation.w = quat.w();
-    }else{
-      attached_object.object.mesh_poses[0].position = object_pose.position;
-      attached_object.object.mesh_poses[0].orientation.x = quat.x();
-      attached_object.object.mesh_poses[0].orientation.y = quat.y();
-      attached_object.object.mesh_poses[0].orientation.z = quat.z();
-      attached_object.object.mesh_poses[0].orientation.w = quat.w();
+    // Back in the world, then put upright on the table
+    transaction.detachObject(attached_body->getName());
+    if (attached_body->getShapes().size() == 1){
+      moveit_msgs::CollisionObject moved_object;
+      moved_object.id = attached_body->getName();
+      moved_object.header.frame_id = base_frame_;
+      if (attached_body->getShapes()[0]->type == shapes::MESH)
+        moved_object.mesh_poses.push_back(object_pose);
+      else
+        moved_object.primitive_poses.push_back(object_pose);
+      transaction.moveObject(moved_object);
     }
-    
-    planning_scene_msg_.robot_state.attached_collision_objects.clear();
-    planning_scene_msg_.world.collision_objects.push_back(attached_object.object);
-    planning_scene_msg_.is_diff = true;
-    planning_scene_diff_publisher_.publish(planning_scene_msg_);
-    return true;
-  }else{
-    ROS_ERROR("There was no object attached to the robot");
+  }
+  return applySceneTransaction(transaction);
+}
+
+bool PickNPlace::waitForScene(const SceneSynchronizer::ScenePredicate &predicate, unsigned long sequence)
+{
+  ScopedTimer timer("scene_sync");
+  return scene_sync_->waitFor(predicate, sequence, scene_sync_timeout_);
+}
+
+bool PickNPlace::cleanObjects(){
+  std::vector<std::string> world_ids, attached_ids;
+  getWorldObjectIds(world_ids);
+  getAttachedObjectIds(attached_ids);
+  
+  SceneTransaction transaction;
+  for (int i = 0; i<attached_ids.size(); i++){
+    transaction.detachObject(attached_ids[i]);
+    transaction.removeObject(attached_ids[i]);
+  }
+  for (int i = 0; i<world_ids.size(); i++)
+    transaction.removeObject(world_ids[i]);
+  
+  if (!applySceneTransaction(transaction)){
+    ROS_ERROR("Cleaning the scene failed, %d world and %d attached objects were to be removed", 
+              (int)world_ids.size(), (int)attached_ids.size());
     return false;
   }
+  return true;
 }
 
-void PickNPlace::cleanObjects(){
-  // update the planning scene to get the robot's state
-  getPlanningScene(planning_scene_msg_, full_planning_scene_);
+bool PickNPlace::saveSceneSnapshot(const std::string &file_name)
+{
+  SceneSnapshot snapshot;
+  {
+    planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+    const planning_scene::PlanningSceneConstPtr &scene_ptr = scene;
+    snapshot.capture(*scene_ptr);
+  }
+  return snapshot.save(file_name);
+}
+
+bool PickNPlace::restoreSceneSnapshot(const std::string &file_name)
+{
+  ScopedTimer timer("scene_restore");
+  SceneSnapshot snapshot;
+  if (!snapshot.load(file_name))
+    return false;
+  
+  std::vector<std::string> world_ids, attached_ids;
+  getWorldObjectIds(world_ids);
+  getAttachedObjectIds(attached_ids);
+  const std::vector<moveit_msgs::AttachedCollisionObject> &attached_objects = snapshot.getAttachedObjects();
+  std::vector<std::string> restored_attached_ids;
+  for (int i=0; i<attached_objects.size(); i++)
+    restored_attached_ids.push_back(attached_objects[i].object.id);
   
-  for (int i = 0; i<planning_scene_msg_.robot_state.attached_collision_objects.size(); i++)
-    planning_scene_msg_.robot_state.attached_collision_objects[i].object.operation = moveit_msgs::CollisionObject::REMOVE;
-  for (int i = 0; i<planning_scene_msg_.world.collision_objects.size(); i++)
-    planning_scene_msg_.world.collision_objects[i].operation = moveit_msgs::CollisionObject::REMOVE;
+  // Clean the scene as cleanObjects does, except the world objects taken by the restored attached ones
+  SceneTransaction transaction;
+  for (int i=0; i<attached_ids.size(); i++){
+    transaction.detachObject(attached_ids[i]);
+    transaction.removeObject(attached_ids[i]);
+  }
+  for (int i=0; i<world_ids.size(); i++)
+    if (std::find(restored_attached_ids.begin(), restored_attached_ids.end(), world_ids[i]) == restored_attached_ids.end())
+      transaction.removeObject(world_ids[i]);
   
-  planning_scene_msg_.is_diff = true;
-  planning_scene_diff_publisher_.publish(planning_scene_msg_);
+  for (int i=0; i<snapshot.getWorldObjects().size(); i++)
+    transaction.addObject(snapshot.getWorldObjects()[i]);
+  for (int i=0; i<attached_objects.size(); i++)
+    transaction.attachObject(attached_objects[i]);
+  return applySceneTransaction(transaction);
 }
 
-bool PickNPlace::moveAboveEpingle(const std::string obj_name)
+bool PickNPlace::getObjectPosesInBase(const std::vector<std::string> &ids, std::vector<Eigen::Isometry3d> &poses)
 {
-  ROS_INFO_STREAM("Moving above "<<obj_name);
-  moveit_msgs::CollisionObjectPtr coll_obj = getCollisionObject(obj_name);
-  if (!coll_obj)
+  ScopedTimer timer("scene_query");
+  planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+  const planning_scene::PlanningSceneConstPtr &scene_ptr = scene;
+  
+  // The base frame is a robot link, its pose comes with the scene instead of tf
+  Eigen::Isometry3d planning_to_base(scene_ptr->getFrameTransform(base_frame_).matrix());
+  planning_to_base = planning_to_base.inverse();
+  poses.clear();
+  for (int i=0; i<ids.size(); i++){
+    collision_detection::World::ObjectConstPtr object = scene_ptr->getWorld()->getObject(ids[i]);
+    if (!object || object->shape_poses_.empty()){
+      ROS_ERROR_STREAM("Failed to find object "<< ids[i]<< " in the scene !!!");
+      return false;
+    }
+    poses.push_back(planning_to_base * Eigen::Isometry3d(object->shape_poses_[0].matrix()));
+  }
+  return true;
+}
+
+bool PickNPlace::makeTargetPose(const std::string obj_name, const Eigen::Isometry3d &object_pose, TargetPoseEngine::Stage stage, 
+                                geometry_msgs::Pose &target_pose)
+{
+  Eigen::Isometry3d offset;
+  if (!target_poses_.getOffset(obj_name, stage, offset))
     return false;
+  
+  // The selected grasp turns the offsets about the object axis, and sets the approach height
+  double yaw = 0.0;
+  std::map<std::string, EpingleGrasp>::const_iterator it = epingle_grasps_.find(obj_name);
+  if (it != epingle_grasps_.end()){
+    yaw = it->second.yaw;
+    if (stage == TargetPoseEngine::ABOVE)
+      offset = TargetPoseEngine::atHeight(offset, it->second.height);
+  }
+  TargetPoseEngine::toMsg(TargetPoseEngine::apply(object_pose, offset, yaw), target_pose);
+  return true;
+}
+
+bool PickNPlace::getTargetPose(const std::string obj_name, TargetPoseEngine::Stage stage, geometry_msgs::Pose &target_pose)
+{
+  std::vector<Eigen::Isometry3d> object_poses;
+  return getObjectPosesInBase(std::vector<std::string>(1, obj_name), object_poses) &&
+         makeTargetPose(obj_name, object_poses[0], stage, target_pose);
+}
+
+bool PickNPlace::getAboveEpinglePose(const std::string obj_name, geometry_msgs::Pose &target_pose)
+{
+  return getTargetPose(obj_name, TargetPoseEngine::ABOVE, target_pose);
+}
 
-  geometry_msgs::PoseStamped obj_pose;
+bool PickNPlace::getToEpinglePose(const std::string obj_name, geometry_msgs::Pose &target_pose)
+{
+  return getTargetPose(obj_name, TargetPoseEngine::AT, target_pose);
+}
+
+bool PickNPlace::getAbovePlaquePose(const std::string obj_name, geometry_msgs::Pose &target_pose)
+{
+  return getTargetPose(obj_name, TargetPoseEngine::ABOVE, target_pose);
+}
+
+bool PickNPlace::getToPlaquePose(const std::string obj_name, geometry_msgs::Pose &target_pose)
+{
+  return getTargetPose(obj_name, TargetPoseEngine::AT, target_pose);
+}
+
+bool PickNPlace::getPickTargets(const PickJob &job, PickTargets &targets)
+{
+  std::vector<std::string> ids;
+  ids.push_back(job.object_id);
+  ids.push_back(job.target_id);
+  std::vector<Eigen::Isometry3d> object_poses;
+  return getObjectPosesInBase(ids, object_poses) && makePickTargets(job, object_poses, targets);
+}
+
+bool PickNPlace::makePickTargets(const PickJob &job, const std::vector<Eigen::Isometry3d> &object_poses, PickTargets &targets)
+{
+  targets.depose = job.depose_pose;
+  return makeTargetPose(job.object_id, object_poses[0], TargetPoseEngine::ABOVE, targets.above_object) &&
+         makeTargetPose(job.object_id, object_poses[0], TargetPoseEngine::AT, targets.to_object) &&
+         makeTargetPose(job.target_id, object_poses[1], TargetPoseEngine::ABOVE, targets.above_target) &&
+         makeTargetPose(job.target_id, object_poses[1], TargetPoseEngine::AT, targets.to_target);
+}
+
+bool PickNPlace::selectEpingleGrasp(const std::string obj_name, std::vector<double> &above_joints)
+{
+  std::vector<Eigen::Isometry3d> object_poses;
+  if (!getObjectPosesInBase(std::vector<std::string>(1, obj_name), object_poses))
+    return false;
+  return selectEpingleGrasp(obj_name, object_poses[0], above_joints);
+}
+
+bool PickNPlace::selectEpingleGrasp(const std::string obj_name, const Eigen::Isometry3d &object_pose, std::vector<double> &above_joints)
+{
+  ScopedTimer timer("grasp_selection");
+  // The targets fall back to the default grasp if no grasp is feasible from this pose
+  epingle_grasps_.erase(obj_name);
+  Eigen::Isometry3d above_offset, to_offset;
+  if (!target_poses_.getOffset(obj_name, TargetPoseEngine::ABOVE, above_offset) ||
+      !target_poses_.getOffset(obj_name, TargetPoseEngine::AT, to_offset))
+    return false;
+  std::vector<EpingleGrasp> grasps;
+  std::vector<geometry_msgs::Pose> above_poses, to_poses;
+  for (int i=0; i<grasp_approach_heights_.size(); i++){
+    for (int j=0; j<grasp_yaw_steps_; j++){
+      EpingleGrasp grasp(2.0*M_PI*j/grasp_yaw_steps_, grasp_approach_heights_[i]);
+      geometry_msgs::Pose above_pose, to_pose;
+      TargetPoseEngine::toMsg(TargetPoseEngine::apply(object_pose, TargetPoseEngine::atHeight(above_offset, grasp.height), grasp.yaw), above_pose);
+      TargetPoseEngine::toMsg(TargetPoseEngine::apply(object_pose, to_offset, grasp.yaw), to_pose);
+      if (reachability_map_ && reachability_map_->isOutOfReach(above_pose))
+        continue;
+      grasps.push_back(grasp);
+      above_poses.push_back(above_pose);
+      to_poses.push_back(to_pose);
+    }
+  }
+  
+  // The solvers share a copy of the scene, the monitor keeps updating the original.
+  // Solutions are ranked from where the job starts, the plan start state when planning ahead
+  planning_scene::PlanningScenePtr snapshot;
+  {
+    planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+    snapshot = planning_scene::PlanningScene::clone(scene);
+  }
+  if (has_plan_start_state_)
+    snapshot->setCurrentState(plan_start_state_);
+  std::vector<double> start;
+  snapshot->getCurrentState().copyJointGroupPositions(joint_model_group_, start);
+  
+  // The grasp also needs a solution where the end-effector goes down to the object
+  std::vector<BatchIk::Solution> solutions, to_solutions;
+  if (batch_ik_){
+    solutions = batch_ik_->solve(snapshot, start, above_poses);
+    to_solutions = batch_ik_->solve(snapshot, start, to_poses);
+  }
+  else{
+    for (int i=0; i<above_poses.size(); i++){
+      BatchIk::Solution solution, to_solution;
+      if (!computeGroupIK(above_poses[i], solution.joints) || !computeGroupIK(to_poses[i], to_solution.joints))
+        continue;
+      solution.index = to_solution.index = i;
+      solution.distance = JobOrdering::distance(start, solution.joints);
+      solutions.push_back(solution);
+      to_solutions.push_back(to_solution);
+    }
+    std::sort(solutions.begin(), solutions.end(), &BatchIk::closerSolution);
+  }
+  std::vector<char> reaches_object(above_poses.size(), 0);
+  for (int i=0; i<to_solutions.size(); i++)
+    reaches_object[to_solutions[i].index] = 1;
+  int nb_feasible = 0, best = -1;
+  for (int i=0; i<solutions.size(); i++){
+    if (!reaches_object[solutions[i].index])
+      continue;
+    if (best < 0)
+      best = i;
+    nb_feasible++;
+  }
+  
+  if (best < 0){
+    ROS_WARN_STREAM("No feasible grasp for "<< obj_name);
+    return false;
+  }
+  const EpingleGrasp &grasp = grasps[solutions[best].index];
+  ROS_INFO_STREAM("Grasping "<< obj_name<< " at yaw "<< grasp.yaw<< " from "<< grasp.height<< " m, "
+                  << nb_feasible<< "/"<< above_poses.size()<< " candidates feasible");
+  epingle_grasps_[obj_name] = grasp;
+  above_joints = solutions[best].joints;
+  return true;
+}
+
+void PickNPlace::forgetEpingleGrasps(const moveit_msgs::PlanningScene &diff)
+{
+  // Grasps hold for the pose they were selected at, objects put back in the world have moved
+  for (int i=0; i<diff.world.collision_objects.size(); i++)
+    epingle_grasps_.erase(diff.world.collision_objects[i].id);
+  for (int i=0; i<diff.robot_state.attached_collision_objects.size(); i++){
+    const moveit_msgs::AttachedCollisionObject &attached = diff.robot_state.attached_collision_objects[i];
+    if (attached.object.operation == moveit_msgs::CollisionObject::REMOVE)
+      epingle_grasps_.erase(attached.object.id);
+  }
+}
+
+bool PickNPlace::moveAboveEpingle(const std::string obj_name)
+{
+  ROS_INFO_STREAM("Moving above "<<obj_name);
+  std::vector<double> above_joints;
+  if (selectEpingleGrasp(obj_name, above_joints))
+    return this->moveToJointPosition(above_joints);
+  
   geometry_msgs::Pose target_pose;
-  obj_pose.header = coll_obj->header;
-  obj_pose.pose = coll_obj->mesh_poses[0];
-  tf_->transformPose(base_frame_, obj_pose, obj_pose);
-  
-  tf::Transform object_transform;
-  object_transform.setOrigin(tf::Vector3(obj_pose.pose.position.x, obj_pose.pose.position.y, obj_pose.pose.position.z));
-  object_transform.setRotation(tf::Quaternion(obj_pose.pose.orientation.x, obj_pose.pose.orientation.y, obj_pose.pose.orientation.z, obj_pose.pose.orientation.w));
-  
-  tf::Transform up_transform;
-  up_transform.setOrigin(tf::Vector3(0.0, 0.0, 0.12));
-  tf::Quaternion rotation;
-  rotation.setRPY(0,0,0);
-  up_transform.setRotation(rotation);
-  
-  tf::Transform pi_rotation_transform;
-  pi_rotation_transform.setOrigin(tf::Vector3(0.0, 0.0, 0.0));
-  tf::Quaternion pi_rotation;
-  pi_rotation.setRPY(M_PI,0,0);
-  pi_rotation_transform.setRotation(pi_rotation);
-  
-  object_transform *= up_transform;
-  object_transform *= pi_rotation_transform;
-  
-  target_pose.position.x = object_transform.getOrigin().getX();
-  target_pose.position.y = object_transform.getOrigin().getY();
-  target_pose.position.z = object_transform.getOrigin().getZ();
-  target_pose.orientation.x = object_transform.getRotation().getX();
-  target_pose.orientation.y = object_transform.getRotation().getY();
-  target_pose.orientation.z = object_transform.getRotation().getZ();
-  target_pose.orientation.w = object_transform.getRotation().getW();
+  if (!getAboveEpinglePose(obj_name, target_pose))
+    return false;
   
   return this->moveToCartesianPose(target_pose);
 }
@@ -651,78 +1475,20 @@ bool PickNPlace::moveAboveEpingle(const std::string obj_name)
 bool PickNPlace::moveToEpingle(const std::string obj_name)
 {
   ROS_INFO_STREAM("Moving above "<<obj_name);
-  moveit_msgs::CollisionObjectPtr coll_obj = getCollisionObject(obj_name);
-  if (!coll_obj)
-    return false;
-
-  geometry_msgs::PoseStamped obj_pose;
   geometry_msgs::Pose target_pose;
-  obj_pose.header = coll_obj->header;
-  obj_pose.pose = coll_obj->mesh_poses[0];
-  tf_->transformPose(base_frame_, obj_pose, obj_pose);
-  
-  tf::Transform object_transform;
-  object_transform.setOrigin(tf::Vector3(obj_pose.pose.position.x, obj_pose.pose.position.y, obj_pose.pose.position.z));
-  object_transform.setRotation(tf::Quaternion(obj_pose.pose.orientation.x, obj_pose.pose.orientation.y, obj_pose.pose.orientation.z, obj_pose.pose.orientation.w));
-  
-  tf::Transform up_transform;
-  up_transform.setOrigin(tf::Vector3(0.0, 0.0, 0.06));
-  tf::Quaternion rotation;
-  rotation.setRPY(0,0,0);
-  up_transform.setRotation(rotation);
-  
-  tf::Transform pi_rotation_transform;
-  pi_rotation_transform.setOrigin(tf::Vector3(0.0, 0.0, 0.0));
-  tf::Quaternion pi_rotation;
-  pi_rotation.setRPY(M_PI,0,0);
-  pi_rotation_transform.setRotation(pi_rotation);
-  
-  object_transform *= up_transform;
-  object_transform *= pi_rotation_transform;
-  
-  target_pose.position.x = object_transform.getOrigin().getX();
-  target_pose.position.y = object_transform.getOrigin().getY();
-  target_pose.position.z = object_transform.getOrigin().getZ();
-  target_pose.orientation.x = object_transform.getRotation().getX();
-  target_pose.orientation.y = object_transform.getRotation().getY();
-  target_pose.orientation.z = object_transform.getRotation().getZ();
-  target_pose.orientation.w = object_transform.getRotation().getW();
+  if (!getToEpinglePose(obj_name, target_pose))
+    return false;
   
-  return this->moveToCartesianPose(target_pose);
+  // Straight along the object axis, or planned if the line is blocked
+  return moveLinearOrPlanned(target_pose);
 }
 
 bool PickNPlace::moveAbovePlaque(const std::string obj_name)
 {
   ROS_INFO_STREAM("Moving above "<<obj_name);
-  moveit_msgs::CollisionObjectPtr coll_obj = getCollisionObject(obj_name);
-  if (!coll_obj)
-    return false;
-
-  geometry_msgs::PoseStamped obj_pose;
   geometry_msgs::Pose target_pose;
-  obj_pose.header = coll_obj->header;
-  obj_pose.pose = coll_obj->mesh_poses[0];
-  tf_->transformPose(base_frame_, obj_pose, obj_pose);
-  
-  tf::Transform object_transform;
-  object_transform.setOrigin(tf::Vector3(obj_pose.pose.position.x, obj_pose.pose.position.y, obj_pose.pose.position.z));
-  object_transform.setRotation(tf::Quaternion(obj_pose.pose.orientation.x, obj_pose.pose.orientation.y, obj_pose.pose.orientation.z, obj_pose.pose.orientation.w));
-  
-  tf::Transform up_transform;
-  up_transform.setOrigin(tf::Vector3(0.0, 0.0, -0.3));
-  tf::Quaternion rotation;
-  rotation.setRPY(0,0,0);
-  up_transform.setRotation(rotation);
-  
-  object_transform *= up_transform;
-  
-  target_pose.position.x = object_transform.getOrigin().getX();
-  target_pose.position.y = object_transform.getOrigin().getY();
-  target_pose.position.z = object_transform.getOrigin().getZ();
-  target_pose.orientation.x = object_transform.getRotation().getX();
-  target_pose.orientation.y = object_transform.getRotation().getY();
-  target_pose.orientation.z = object_transform.getRotation().getZ();
-  target_pose.orientation.w = object_transform.getRotation().getW();
+  if (!getAbovePlaquePose(obj_name, target_pose))
+    return false;
   
   return this->moveToCartesianPose(target_pose);
 }
@@ -730,35 +1496,621 @@ bool PickNPlace::moveAbovePlaque(const std::string obj_name)
 bool PickNPlace::moveToPlaque(const std::string obj_name)
 {
   ROS_INFO_STREAM("Moving above "<<obj_name);
-  moveit_msgs::CollisionObjectPtr coll_obj = getCollisionObject(obj_name);
-  if (!coll_obj)
+  geometry_msgs::Pose target_pose;
+  if (!getToPlaquePose(obj_name, target_pose))
     return false;
+  
+  // Straight along the hole axis, or planned if the line is blocked
+  return moveLinearOrPlanned(target_pose);
+}
 
-  geometry_msgs::PoseStamped obj_pose;
-  geometry_msgs::Pose target_pose;
-  obj_pose.header = coll_obj->header;
-  obj_pose.pose = coll_obj->mesh_poses[0];
-  tf_->transformPose(base_frame_, obj_pose, obj_pose);
-  
-  tf::Transform object_transform;
-  object_transform.setOrigin(tf::Vector3(obj_pose.pose.position.x, obj_pose.pose.position.y, obj_pose.pose.position.z));
-  object_transform.setRotation(tf::Quaternion(obj_pose.pose.orientation.x, obj_pose.pose.orientation.y, obj_pose.pose.orientation.z, obj_pose.pose.orientation.w));
-  
-  tf::Transform up_transform;
-  up_transform.setOrigin(tf::Vector3(0.0, 0.0, -0.2));
-  tf::Quaternion rotation;
-  rotation.setRPY(0,0,0);
-  up_transform.setRotation(rotation);
-  
-  object_transform *= up_transform;
-  
-  target_pose.position.x = object_transform.getOrigin().getX();
-  target_pose.position.y = object_transform.getOrigin().getY();
-  target_pose.position.z = object_transform.getOrigin().getZ();
-  target_pose.orientation.x = object_transform.getRotation().getX();
-  target_pose.orientation.y = object_transform.getRotation().getY();
-  target_pose.orientation.z = object_transform.getRotation().getZ();
-  target_pose.orientation.w = object_transform.getRotation().getW();
+bool PickNPlace::planSegment(const MotionSegment &segment, MoveGroupPlan &plan)
+{
+  switch (segment.type){
+    case MotionSegment::JOINT_TARGET:
+      return planToJointPosition(segment.joints, plan);
+    case MotionSegment::POSE_TARGET:
+      return planToCartesianPose(segment.pose, plan);
+    case MotionSegment::LINEAR_PATH:
+      if (!segment.object_name.empty() && segment.attach_waypoint >= 0 && segment.attach_waypoint+1 < segment.waypoints.size())
+        return planGraspPath(segment, plan);
+      return planLinearPath(segment.waypoints, plan);
+    case MotionSegment::START:
+      return planToStart(plan);
+    default:
+      ROS_ERROR("Segment of type %d is not a motion", segment.type);
+      return false;
+  }
+}
+
+bool PickNPlace::planGraspPath(const MotionSegment &segment, MoveGroupPlan &plan)
+{
+  // Approach up to the grasp waypoint from the plan start state
+  std::vector<geometry_msgs::Pose> approach(segment.waypoints.begin(), segment.waypoints.begin() + segment.attach_waypoint+1);
+  std::vector<geometry_msgs::Pose> retreat(segment.waypoints.begin() + segment.attach_waypoint+1, segment.waypoints.end());
+  MoveGroupPlan approach_plan, retreat_plan;
+  if (!planLinearPath(approach, approach_plan))
+    return false;
   
-  return this->moveToCartesianPose(target_pose);
+  // Retreat with the object attached where the approach ends, then restore the plan start state
+  MotionSegment attach = segment;
+  attach.type = MotionSegment::ATTACH;
+  attach.attach_waypoint = -1;
+  moveit_msgs::RobotState grasp_state;
+  predictEndState(approach_plan, std::vector<MotionSegment>(1, attach), grasp_state);
+  
+  moveit_msgs::RobotState saved_start_state = plan_start_state_;
+  bool had_start_state = has_plan_start_state_;
+  setPlanStartState(grasp_state);
+  bool planned = planLinearPath(retreat, retreat_plan);
+  plan_start_state_ = saved_start_state;
+  has_plan_start_state_ = had_start_state;
+  if (!planned)
+    return false;
+  
+  // One trajectory through the grasp point, the retreat starts where the approach ends
+  plan = approach_plan;
+  trajectory_msgs::JointTrajectory &traj = plan.trajectory_.joint_trajectory;
+  const trajectory_msgs::JointTrajectory &retreat_traj = retreat_plan.trajectory_.joint_trajectory;
+  ros::Duration offset = traj.points.empty() ? ros::Duration(0.0) : traj.points.back().time_from_start;
+  for (int i=1; i<retreat_traj.points.size(); i++){
+    traj.points.push_back(retreat_traj.points[i]);
+    traj.points.back().time_from_start += offset;
+  }
+  return true;
+}
+
+bool PickNPlace::applySceneSegment(const MotionSegment &segment)
+{
+  switch (segment.type){
+    case MotionSegment::ATTACH:
+      return attachObject(segment.object_name);
+    case MotionSegment::DETACH:
+      return detachObject();
+    default:
+      ROS_ERROR("Segment of type %d is not a scene action", segment.type);
+      return false;
+  }
+}
+
+void PickNPlace::predictEndState(const MoveGroupPlan &plan, const std::vector<MotionSegment> &actions, moveit_msgs::RobotState &state)
+{
+  // Attach and detach in a copy of the scene, so that the attached bodies carry the geometry of the objects
+  planning_scene::PlanningScenePtr snapshot;
+  {
+    planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+    snapshot = planning_scene::PlanningScene::clone(scene);
+  }
+  robot_state::RobotState &end_state = snapshot->getCurrentStateNonConst();
+  const trajectory_msgs::JointTrajectory &traj = plan.trajectory_.joint_trajectory;
+  
+  for (int i=0; i<actions.size(); i++){
+    moveit_msgs::AttachedCollisionObject attached_object;
+    attached_object.link_name = ee_frame_;
+    attached_object.object.id = actions[i].object_name;
+    if (actions[i].type == MotionSegment::ATTACH){
+      // The object keeps the pose it has relative to the end-effector when it is grasped
+      int grasp_index = traj.points.size()-1;
+      if (actions[i].attach_waypoint >= 0)
+        grasp_index = getWaypointIndex(plan, actions[i].waypoints[actions[i].attach_waypoint]);
+      end_state.setVariablePositions(traj.joint_names, traj.points[grasp_index].positions);
+      end_state.update();
+      attached_object.object.operation = moveit_msgs::CollisionObject::ADD;
+    }
+    else{
+      attached_object.object.operation = moveit_msgs::CollisionObject::REMOVE;
+    }
+    if (!snapshot->processAttachedCollisionObjectMsg(attached_object))
+      ROS_WARN_STREAM("Could not predict the scene action on object "<< actions[i].object_name);
+  }
+  
+  // Joints of the group are where the trajectory ends
+  end_state.setVariablePositions(traj.joint_names, traj.points.back().positions);
+  end_state.update();
+  robot_state::robotStateToRobotStateMsg(end_state, state);
+}
+
+bool PickNPlace::reachedEndOfPlan(const MoveGroupPlan &plan)
+{
+  const trajectory_msgs::JointTrajectory &traj = plan.trajectory_.joint_trajectory;
+  robot_state::RobotStatePtr current_state = group_->getCurrentState();
+  
+  for (int i=0; i<traj.joint_names.size(); i++){
+    double error = fabs(current_state->getVariablePosition(traj.joint_names[i]) - traj.points.back().positions[i]);
+    if (error > pipeline_joint_tolerance_){
+      ROS_WARN("Joint %s ended %f rad away from the planned position", traj.joint_names[i].c_str(), error);
+      return false;
+    }
+  }
+  return true;
+}
+
+void PickNPlace::setPlanStartState(const moveit_msgs::RobotState &start_state)
+{
+  plan_start_state_ = start_state;
+  has_plan_start_state_ = true;
+}
+
+void PickNPlace::clearPlanStartState()
+{
+  has_plan_start_state_ = false;
+}
+
+std::string PickNPlace::makePlanCacheKey(const planning_scene::PlanningScene &scene, const std::string &goal_key, moveit_msgs::RobotState &start_state)
+{
+  robot_state::RobotState state(scene.getCurrentState());
+  if (has_plan_start_state_){
+    start_state = plan_start_state_;
+    state.setVariableValues(start_state.joint_state);
+  }
+  else
+    robot_state::robotStateToRobotStateMsg(state, start_state);
+  
+  std::vector<double> start_joints;
+  state.copyJointGroupPositions(joint_model_group_, start_joints);
+  
+  // Objects attached or detached in the start state are part of the goal
+  std::string full_goal_key = goal_key;
+  for (int i=0; i<start_state.attached_collision_objects.size(); i++)
+    full_goal_key += "|attached:" + start_state.attached_collision_objects[i].object.id + ":" 
+        + boost::lexical_cast<std::string>((int)start_state.attached_collision_objects[i].object.operation);
+  
+  return plan_cache_->makeKey(start_joints, full_goal_key, PlanCache::hashScene(scene));
+}
+
+bool PickNPlace::planWithPipeline(const std::vector<double> &joint_vals, MoveGroupPlan &plan)
+{
+  // The planners share a copy of the scene, the monitor keeps updating the original.
+  // Objects grasped in the start state leave the world of the copy
+  planning_scene::PlanningScenePtr snapshot;
+  {
+    planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+    snapshot = planning_scene::PlanningScene::clone(scene);
+  }
+  
+  moveit_msgs::RobotState start_state;
+  if (has_plan_start_state_){
+    start_state = plan_start_state_;
+    snapshot->setCurrentState(start_state);
+  }
+  else
+    robot_state::robotStateToRobotStateMsg(snapshot->getCurrentState(), start_state);
+  
+  robot_state::RobotState goal_state(snapshot->getCurrentState());
+  goal_state.setJointGroupPositions(joint_model_group_, joint_vals);
+  
+  planning_interface::MotionPlanRequest request;
+  request.group_name = group_name_;
+  request.planner_id = planner_id_;
+  request.start_state = start_state;
+  request.goal_constraints.push_back(kinematic_constraints::constructGoalConstraints(goal_state, joint_model_group_, 0.001));
+  request.allowed_planning_time = max_planning_time_;
+  request.num_planning_attempts = 1;
+  
+  ScopedTimer timer("plan");
+  if (planner_race_){
+    if (!planner_race_->plan(snapshot, request, plan.trajectory_)){
+      Instrumentation::instance().count("plan_failures");
+      return false;
+    }
+  }
+  else{
+    planning_interface::MotionPlanResponse response;
+    if (!planning_pipeline_->generatePlan(snapshot, request, response) || !response.trajectory_){
+      Instrumentation::instance().count("plan_failures");
+      return false;
+    }
+    response.trajectory_->getRobotTrajectoryMsg(plan.trajectory_);
+  }
+  plan.start_state_ = start_state;
+  plan.planning_time_ = 0.0;
+  return true;
+}
+
+bool PickNPlace::lookupCachedPlan(const std::string &goal_key, const moveit_msgs::Constraints &goal, MoveGroupPlan &plan)
+{
+  if (!plan_cache_)
+    return false;
+  
+  planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+  const planning_scene::PlanningSceneConstPtr &scene_ptr = scene;
+  moveit_msgs::RobotState start_state;
+  std::string key = makePlanCacheKey(*scene_ptr, goal_key, start_state);
+  if (!plan_cache_->lookup(key, *scene_ptr, start_state, goal, group_name_, plan.trajectory_))
+    return false;
+  
+  plan.start_state_ = start_state;
+  plan.planning_time_ = 0.0;
+  Instrumentation::instance().count("plan_cache_hits");
+  return true;
+}
+
+moveit_msgs::Constraints PickNPlace::jointGoalConstraints(const std::vector<double> &joint_vals)
+{
+  robot_state::RobotState goal_state(robot_model_);
+  goal_state.setToDefaultValues();
+  goal_state.setJointGroupPositions(joint_model_group_, joint_vals);
+  return kinematic_constraints::constructGoalConstraints(goal_state, joint_model_group_, group_->getGoalJointTolerance());
+}
+
+moveit_msgs::Constraints PickNPlace::poseGoalConstraints(const geometry_msgs::Pose &pose)
+{
+  geometry_msgs::PoseStamped goal_pose;
+  goal_pose.header.frame_id = base_frame_;
+  goal_pose.pose = pose;
+  return kinematic_constraints::constructGoalConstraints(ee_frame_, goal_pose, group_->getGoalPositionTolerance(), 
+                                                         group_->getGoalOrientationTolerance());
+}
+
+void PickNPlace::storeCachedPlan(const std::string &goal_key, const MoveGroupPlan &plan)
+{
+  if (!plan_cache_)
+    return;
+  
+  planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+  const planning_scene::PlanningSceneConstPtr &scene_ptr = scene;
+  moveit_msgs::RobotState start_state;
+  plan_cache_->insert(makePlanCacheKey(*scene_ptr, goal_key, start_state), plan.trajectory_);
+}
+
+bool PickNPlace::blendSegments(const std::vector<MotionSegment> &segments, int &index, MoveGroupPlan &plan, MotionSegment &segment)
+{
+  if (!trajectory_processor_){
+    ROS_WARN("Blending requires the trajectory processor, segment %d stops before the next motion", index);
+    return false;
+  }
+  
+  // Plan each motion from the end of the previous one, with the objects grasped on the way
+  std::vector<moveit_msgs::RobotTrajectory> trajectories(1, plan.trajectory_);
+  std::vector<double> blend_radii;
+  MoveGroupPlan last_plan = plan;
+  int last = index;
+  while (segments[last].blend_radius >= 0.0 && last+1 < segments.size() && segments[last+1].isMotion()){
+    std::vector<MotionSegment> actions;
+    if (segments[last].type == MotionSegment::LINEAR_PATH && !segments[last].object_name.empty()){
+      // The grasp waypoint of the linear path tells where the object is attached
+      actions.push_back(segments[last]);
+      actions.back().type = MotionSegment::ATTACH;
+    }
+    moveit_msgs::RobotState end_state;
+    predictEndState(last_plan, actions, end_state);
+    setPlanStartState(end_state);
+    MoveGroupPlan next_plan;
+    bool planned = planSegment(segments[last+1], next_plan);
+    clearPlanStartState();
+    
+    // The motion is planned again on its own after the blended ones
+    if (!planned){
+      ROS_WARN("Segment %d could not be planned for blending", last+1);
+      break;
+    }
+    last++;
+    if (next_plan.trajectory_.joint_trajectory.points.empty())
+      continue;
+    
+    // Free motions are shortcut on their own, the linear paths stay straight
+    if (segments[last].type != MotionSegment::LINEAR_PATH)
+      processTrajectory(next_plan, true);
+    trajectories.push_back(next_plan.trajectory_);
+    blend_radii.push_back(segments[last-1].blend_radius);
+    last_plan = next_plan;
+  }
+  if (last == index)
+    return false;
+  
+  // Processed on a copy, the caller executes the plan as it was if the blend fails
+  MoveGroupPlan first_plan = plan;
+  if (segment.type != MotionSegment::LINEAR_PATH)
+    processTrajectory(first_plan, true);
+  trajectories[0] = first_plan.trajectory_;
+  MoveGroupPlan blended_plan = first_plan;
+  {
+    ScopedTimer timer("trajectory_blending");
+    planning_scene::PlanningScenePtr snapshot;
+    {
+      planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+      snapshot = planning_scene::PlanningScene::clone(scene);
+    }
+    if (!trajectory_processor_->blend(first_plan.start_state_, trajectories, blend_radii, *snapshot, blended_plan.trajectory_))
+      return false;
+  }
+  
+  // The merged motion is executed as a linear path so that it is not shortcut,
+  // with the grasp of the blended segments if any
+  segment = MotionSegment(MotionSegment::LINEAR_PATH);
+  for (int i=index; i<=last; i++){
+    if (segments[i].type == MotionSegment::LINEAR_PATH && !segments[i].object_name.empty())
+      segment = segments[i];
+  }
+  segment.blend_radius = -1.0;
+  ROS_INFO("Segments %d to %d blended into one trajectory", index, last);
+  plan = blended_plan;
+  index = last;
+  return true;
+}
+
+bool PickNPlace::executeSegment(const MotionSegment &segment, const MoveGroupPlan &plan)
+{
+  if (segment.type != MotionSegment::LINEAR_PATH)
+    return executeJointTrajectory(plan);
+  if (segment.object_name.empty())
+    return executeJointTrajectory(plan, false);
+  
+  // Put the object back where it is now if the execution fails after grasping it
+  moveit_msgs::CollisionObject object;
+  if (!getCollisionObject(segment.object_name, object)){
+    ROS_ERROR_STREAM("Object "<< segment.object_name <<" to grasp is not in the scene");
+    return false;
+  }
+  
+  // Attach the object once the monitored joints went through the grasp point, without stopping there
+  MoveGroupPlan processed_plan = plan;
+  processTrajectory(processed_plan, false);
+  int grasp_index = getWaypointIndex(processed_plan, segment.waypoints[segment.attach_waypoint]);
+  
+  bool exec_success = false;
+  boost::thread exec_thread(boost::bind(&PickNPlace::sendTrajectoryInto, this, processed_plan, &exec_success));
+  int progress = 0;
+  bool exec_done = false;
+  while (!exec_done && progress < grasp_index){
+    exec_done = exec_thread.timed_join(boost::posix_time::milliseconds(GRASP_MONITOR_PERIOD_MS));
+    robot_state::RobotStatePtr current_state = planning_scene_monitor_->getStateMonitor()->getCurrentState();
+    progress = getTrajectoryProgress(processed_plan, *current_state, progress);
+  }
+  
+  bool attached = false;
+  if (progress >= grasp_index){
+    ROS_INFO("Grasping %s at point %d of the linear path", segment.object_name.c_str(), progress);
+    attached = attachObject(segment.object_name);
+  }
+  exec_thread.join();
+  
+  // A successful execution went through the grasp point even if the monitor missed it
+  if (exec_success && progress < grasp_index){
+    ROS_INFO("Grasping %s at the end of the linear path", segment.object_name.c_str());
+    attached = attachObject(segment.object_name);
+  }
+  if (!exec_success && attached){
+    ROS_WARN_STREAM("Execution failed after grasping "<< segment.object_name <<", putting it back in the scene");
+    SceneTransaction transaction;
+    transaction.detachObject(segment.object_name);
+    transaction.moveObject(object);
+    applySceneTransaction(transaction);
+  }
+  return exec_success && attached;
+}
+
+int PickNPlace::getTrajectoryProgress(const MoveGroupPlan &plan, const robot_state::RobotState &state, int from_index)
+{
+  // Follow the trajectory forward while its points get closer to the state, a path going
+  // back the way it came passes near earlier points again
+  const trajectory_msgs::JointTrajectory &traj = plan.trajectory_.joint_trajectory;
+  int index = from_index;
+  double distance = std::numeric_limits<double>::max();
+  for (int i=from_index; i<traj.points.size(); i++){
+    double point_distance = 0.0;
+    for (int j=0; j<traj.joint_names.size(); j++){
+      double error = state.getVariablePosition(traj.joint_names[j]) - traj.points[i].positions[j];
+      point_distance += error*error;
+    }
+    if (point_distance > distance)
+      break;
+    distance = point_distance;
+    index = i;
+  }
+  return index;
+}
+
+void PickNPlace::executeSegmentInto(const MotionSegment segment, const MoveGroupPlan mg_plan, bool *success)
+{
+  *success = executeSegment(segment, mg_plan);
+}
+
+void PickNPlace::sendTrajectoryInto(const MoveGroupPlan mg_plan, bool *success)
+{
+  *success = sendTrajectory(mg_plan);
+}
+
+bool PickNPlace::getPickJobSegments(const PickJob &job, std::vector<MotionSegment> &segments)
+{
+  // Objects do not move during the job, so all the targets are computed from one scene lookup
+  std::vector<std::string> ids;
+  ids.push_back(job.object_id);
+  ids.push_back(job.target_id);
+  std::vector<Eigen::Isometry3d> object_poses;
+  if (!getObjectPosesInBase(ids, object_poses))
+    return false;
+  
+  // Go above the epingle in joint space when a grasp could be selected
+  segments.assign(5, MotionSegment(MotionSegment::POSE_TARGET));
+  std::vector<double> above_joints;
+  if (selectEpingleGrasp(job.object_id, object_poses[0], above_joints)){
+    segments[0] = MotionSegment(MotionSegment::JOINT_TARGET);
+    segments[0].joints = above_joints;
+  }
+  PickTargets targets;
+  if (!makePickTargets(job, object_poses, targets))
+    return false;
+  segments[0].pose = targets.above_object;
+  segments[0].blend_radius = approach_blend_radius_;
+  
+  // Approach, grasp and retreat in one linear trajectory
+  segments[1] = MotionSegment(MotionSegment::LINEAR_PATH);
+  segments[1].waypoints.push_back(targets.to_object);
+  segments[1].waypoints.push_back(targets.above_object);
+  segments[1].object_name = job.object_id;
+  segments[1].attach_waypoint = 0;
+  
+  segments[2].pose = targets.above_target;
+  segments[2].blend_radius = approach_blend_radius_;
+  segments[3] = MotionSegment(MotionSegment::LINEAR_PATH);
+  segments[3].waypoints.push_back(targets.to_target);
+  segments[3].blend_radius = depose_blend_radius_;
+  segments[4].pose = targets.depose;
+  segments.push_back(MotionSegment(MotionSegment::DETACH));
+  return true;
+}
+
+bool PickNPlace::computeGroupIK(const geometry_msgs::Pose pose, std::vector<double> &positions)
+{
+  sensor_msgs::JointState joints;
+  if (!compute_ik(pose, joints))
+    return false;
+  jointStateToGroupPositions(joints, positions);
+  return true;
+}
+
+void PickNPlace::jointStateToGroupPositions(const sensor_msgs::JointState &joints, std::vector<double> &positions)
+{
+  // The IK service returns all the joints of the robot
+  robot_state::RobotState state(robot_model_);
+  state.setToDefaultValues();
+  state.setVariableValues(joints);
+  state.copyJointGroupPositions(joint_model_group_, positions);
+}
+
+bool PickNPlace::orderPickJobs(std::vector<PickJob> &jobs)
+{
+  ScopedTimer timer("order_jobs");
+  std::vector<double> start;
+  {
+    planning_scene_monitor::LockedPlanningSceneRO scene(planning_scene_monitor_);
+    scene->getCurrentState().copyJointGroupPositions(joint_model_group_, start);
+  }
+  
+  // A job starts above its object and ends at its depose pose
+  std::vector<std::vector<double> > picks, places;
+  std::vector<PickJob> reachable, unreachable;
+  for (int i=0; i<jobs.size(); i++){
+    geometry_msgs::Pose above_pose;
+    std::vector<double> pick, place;
+    if (!getAboveEpinglePose(jobs[i].object_id, above_pose) || !computeGroupIK(above_pose, pick) ||
+        !computeGroupIK(jobs[i].depose_pose, place)){
+      ROS_WARN_STREAM("No IK solution for job "<< jobs[i].object_id<< ", it is moved to the end of the queue");
+      unreachable.push_back(jobs[i]);
+      continue;
+    }
+    reachable.push_back(jobs[i]);
+    picks.push_back(pick);
+    places.push_back(place);
+  }
+  
+  std::vector<int> order;
+  for (int i=0; i<reachable.size(); i++)
+    order.push_back(i);
+  double initial_cost = JobOrdering::cost(start, picks, places, order);
+  order = JobOrdering::nearestNeighbour(start, picks, places);
+  double greedy_cost = JobOrdering::cost(start, picks, places, order);
+  double final_cost = JobOrdering::twoOpt(start, picks, places, order);
+  ROS_INFO("Ordered %d jobs, travel %.2f rad as given, %.2f rad nearest neighbour, %.2f rad after 2-opt", 
+           (int)order.size(), initial_cost, greedy_cost, final_cost);
+  
+  jobs.clear();
+  for (int i=0; i<order.size(); i++)
+    jobs.push_back(reachable[order[i]]);
+  jobs.insert(jobs.end(), unreachable.begin(), unreachable.end());
+  return unreachable.empty();
+}
+
+int PickNPlace::runPickJobs(const std::vector<PickJob> &jobs, bool pipelined)
+{
+  int nb_success = 0;
+  for (int i=0; i<jobs.size() && ros::ok(); i++){
+    ROS_INFO_STREAM("Job "<< i+1<< "/"<< jobs.size()<< ": "<< jobs[i].object_id<< " to "<< jobs[i].target_id);
+    // The robot is idle, the job starts from the current state and not from a stale prediction
+    clearPlanStartState();
+    std::vector<MotionSegment> segments;
+    if (getPickJobSegments(jobs[i], segments) && executeSequence(segments, pipelined)){
+      nb_success++;
+      continue;
+    }
+    ROS_ERROR_STREAM("Job on "<< jobs[i].object_id<< " failed");
+    
+    // Do not carry a failed object to the next job
+    std::vector<std::string> attached_ids;
+    getAttachedObjectIds(attached_ids);
+    if (!attached_ids.empty())
+      detachObject();
+  }
+  moveToStart();
+  ROS_INFO("%d/%d jobs succeeded", nb_success, (int)jobs.size());
+  return nb_success;
+}
+
+bool PickNPlace::executeSequence(const std::vector<MotionSegment> &segments, bool pipelined)
+{
+  MoveGroupPlan current_plan, lookahead_plan;
+  bool has_lookahead = false;
+  
+  for (int i=0; i<segments.size(); i++){
+    
+    if (!segments[i].isMotion()){
+      if (!applySceneSegment(segments[i]))
+        return false;
+      continue;
+    }
+    
+    // Use the plan computed during the previous motion, or plan from the current state
+    if (has_lookahead){
+      current_plan = lookahead_plan;
+      has_lookahead = false;
+    }
+    else{
+      clearPlanStartState();
+      if (!planSegment(segments[i], current_plan))
+        return false;
+    }
+    
+    if (current_plan.trajectory_.joint_trajectory.points.empty()){
+      ROS_INFO("Segment %d is already reached", i);
+      continue;
+    }
+    
+    // The following motions are merged in the current plan when the segment blends into them
+    MotionSegment segment = segments[i];
+    if (segment.blend_radius >= 0.0)
+      blendSegments(segments, i, current_plan, segment);
+    
+    // Look for the next motion and the scene actions in between
+    int next = i+1;
+    std::vector<MotionSegment> actions;
+    if (segment.type == MotionSegment::LINEAR_PATH && !segment.object_name.empty()){
+      // The grasp waypoint of the linear path tells where the object is attached
+      actions.push_back(segment);
+      actions.back().type = MotionSegment::ATTACH;
+    }
+    while (next < segments.size() && !segments[next].isMotion())
+      actions.push_back(segments[next++]);
+    
+    if (!pipelined || next >= segments.size()){
+      if (!executeSegment(segment, current_plan))
+        return false;
+      continue;
+    }
+    
+    // Execute the current motion in the background while planning the next one
+    bool exec_success = false;
+    boost::thread exec_thread(boost::bind(&PickNPlace::executeSegmentInto, this, segment, current_plan, &exec_success));
+    
+    moveit_msgs::RobotState predicted_state;
+    predictEndState(current_plan, actions, predicted_state);
+    setPlanStartState(predicted_state);
+    ros::WallTime plan_start = ros::WallTime::now();
+    has_lookahead = planSegment(segments[next], lookahead_plan);
+    clearPlanStartState();
+    ROS_INFO("Planned segment %d during execution of segment %d in %.3f s", next, i, (ros::WallTime::now() - plan_start).toSec());
+    
+    exec_thread.join();
+    if (!exec_success){
+      ROS_ERROR("Execution of segment %d failed", i);
+      return false;
+    }
+    
+    // Replan from the actual state if the arm is not where the lookahead plan starts
+    if (has_lookahead && !reachedEndOfPlan(current_plan)){
+      ROS_WARN("Execution deviated from the plan, segment %d will be replanned", next);
+      has_lookahead = false;
+    }
+  }
+  return true;
 }
@@ -0,0 +1,216 @@
+#include <lwr_pick_n_place/pick_n_place_action_server.hpp>
+
+namespace {
+  // Stages of a pick and place, in order
+  const int NB_STAGES = 8;
+  const char* STAGES[NB_STAGES] = {"move_above_object", "move_to_object", "attach_object", 
+    "move_above_target", "move_to_target", "move_to_depose", "detach_object", "move_to_start"};
+  
+  int getActionSpinnerThreads()
+  {
+    int nb_threads;
+    ros::NodeHandle("~").param<int>("action_spinner_threads", nb_threads, 1);
+    return nb_threads;
+  }
+}
+
+PickNPlaceActionServer::PickNPlaceActionServer(const std::string &action_name) :
+  nh_(callback_executor_.nodeHandle("action", getActionSpinnerThreads())),
+  action_server_(nh_, action_name, 
+      boost::bind(&PickNPlaceActionServer::goalCallback, this, _1),
+      boost::bind(&PickNPlaceActionServer::cancelCallback, this, _1), false),
+  has_active_goal_(false),
+  cancel_requested_(false),
+  shutdown_(false)
+{
+  // A cancel landing while a stage is planning stops its motion before it is sent
+  pick_n_place_.setCancelCheck(boost::bind(&PickNPlaceActionServer::cancelRequested, this));
+  worker_thread_ = boost::thread(boost::bind(&PickNPlaceActionServer::workerLoop, this));
+  action_server_.start();
+  ROS_INFO_STREAM("Pick and place action server "<< action_name <<" started");
+}
+
+PickNPlaceActionServer::~PickNPlaceActionServer()
+{
+  std::deque<PickPlaceGoalHandle> pending_goals;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    shutdown_ = true;
+    cancel_requested_ = true;
+    pending_goals.swap(goal_queue_);
+  }
+  queue_cond_.notify_all();
+  worker_thread_.join();
+  
+  // Goal handles take the action server lock, so they are canceled without holding ours
+  for (int i=0; i<pending_goals.size(); i++)
+    pending_goals[i].setCanceled(lwr_pick_n_place::PickPlaceResult(), "Server shutting down");
+}
+
+void PickNPlaceActionServer::goalCallback(PickPlaceGoalHandle goal_handle)
+{
+  // Goal handles take the action server lock, so they are updated without holding ours.
+  // The goal is tracked while it is being accepted, so that a cancel in between is not lost
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    accepting_goals_.push_back(goal_handle);
+  }
+  goal_handle.setAccepted();
+  
+  bool canceled = false;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    canceled = removeGoal(canceled_goals_, goal_handle);
+    removeGoal(accepting_goals_, goal_handle);
+    if (!canceled){
+      goal_queue_.push_back(goal_handle);
+      ROS_INFO("Pick and place goal queued (%zu waiting)", goal_queue_.size());
+      queue_cond_.notify_one();
+    }
+  }
+  if (canceled)
+    goal_handle.setCanceled(lwr_pick_n_place::PickPlaceResult(), "Canceled before being run");
+}
+
+bool PickNPlaceActionServer::removeGoal(std::deque<PickPlaceGoalHandle> &goals, const PickPlaceGoalHandle &goal_handle)
+{
+  for (std::deque<PickPlaceGoalHandle>::iterator it = goals.begin(); it != goals.end(); it++){
+    if (*it == goal_handle){
+      goals.erase(it);
+      return true;
+    }
+  }
+  return false;
+}
+
+void PickNPlaceActionServer::cancelCallback(PickPlaceGoalHandle goal_handle)
+{
+  bool queued = false, running = false;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    
+    // A goal being accepted is canceled by goalCallback once accepted
+    if (removeGoal(accepting_goals_, goal_handle)){
+      canceled_goals_.push_back(goal_handle);
+      return;
+    }
+    
+    // A goal still in the queue is simply removed
+    queued = removeGoal(goal_queue_, goal_handle);
+    
+    // The running goal is stopped, the worker reports the cancellation
+    if (!queued && has_active_goal_ && active_goal_ == goal_handle){
+      cancel_requested_ = true;
+      running = true;
+    }
+  }
+  
+  if (queued)
+    goal_handle.setCanceled(lwr_pick_n_place::PickPlaceResult(), "Canceled before being run");
+  else if (running){
+    ROS_INFO("Preempting the running pick and place goal");
+    pick_n_place_.stopJointTrajectory();
+  }
+}
+
+bool PickNPlaceActionServer::cancelRequested()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return cancel_requested_;
+}
+
+void PickNPlaceActionServer::workerLoop()
+{
+  while (ros::ok()){
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      has_active_goal_ = false;
+      while (goal_queue_.empty() && !shutdown_)
+        queue_cond_.wait(lock);
+      if (shutdown_)
+        return;
+      active_goal_ = goal_queue_.front();
+      goal_queue_.pop_front();
+      has_active_goal_ = true;
+      cancel_requested_ = false;
+    }
+    runGoal(active_goal_);
+  }
+}
+
+bool PickNPlaceActionServer::startStage(PickPlaceGoalHandle &goal_handle, const std::string &stage, int index)
+{
+  if (cancelRequested())
+    return false;
+  
+  lwr_pick_n_place::PickPlaceFeedback feedback;
+  feedback.stage = stage;
+  feedback.stage_index = index;
+  feedback.stage_count = NB_STAGES;
+  goal_handle.publishFeedback(feedback);
+  return true;
+}
+
+void PickNPlaceActionServer::releaseObject()
+{
+  // Do not carry the object of a stopped goal into the next one
+  std::vector<std::string> attached_ids;
+  pick_n_place_.getAttachedObjectIds(attached_ids);
+  if (!attached_ids.empty() && !pick_n_place_.detachObject())
+    ROS_ERROR("Failed to release the object of the stopped goal");
+}
+
+void PickNPlaceActionServer::runGoal(PickPlaceGoalHandle &goal_handle)
+{
+  lwr_pick_n_place::PickPlaceGoalConstPtr goal = goal_handle.getGoal();
+  lwr_pick_n_place::PickPlaceResult result;
+  result.success = false;
+  ROS_INFO_STREAM("Running pick and place of "<< goal->object_id <<" into "<< goal->target_id);
+  
+  bool success = true;
+  for (int i=0; i<NB_STAGES && success; i++){
+    if (!startStage(goal_handle, STAGES[i], i)){
+      result.failed_stage = STAGES[i];
+      releaseObject();
+      goal_handle.setCanceled(result, "Canceled");
+      return;
+    }
+    
+    switch (i){
+      case 0: success = pick_n_place_.moveAboveEpingle(goal->object_id); break;
+      case 1: success = pick_n_place_.moveToEpingle(goal->object_id); break;
+      case 2: success = pick_n_place_.attachObject(goal->object_id); break;
+      case 3: success = pick_n_place_.moveAbovePlaque(goal->target_id); break;
+      case 4: success = pick_n_place_.moveToPlaque(goal->target_id); break;
+      case 5: success = pick_n_place_.moveToCartesianPose(goal->depose_pose); break;
+      case 6: success = pick_n_place_.detachObject(); break;
+      case 7: success = pick_n_place_.moveToStart(); break;
+    }
+    
+    if (!success){
+      result.failed_stage = STAGES[i];
+      releaseObject();
+      if (cancelRequested()){
+        goal_handle.setCanceled(result, "Canceled");
+        return;
+      }
+      ROS_ERROR("Pick and place failed at stage %s", STAGES[i]);
+      goal_handle.setAborted(result, std::string("Failed at stage ") + STAGES[i]);
+      return;
+    }
+  }
+  
+  result.success = true;
+  goal_handle.setSucceeded(result);
+}
+
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "pick_n_place_action_server");
+  
+  PickNPlaceActionServer action_server("pick_n_place");
+  ros::waitForShutdown();
+  
+  MeshCache::instance().logStats();
+  return 0;
+}
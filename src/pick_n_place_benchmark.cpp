@@ -0,0 +1,235 @@
+#include <lwr_pick_n_place/pick_n_place.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+
+// Runs full pick and place cycles without any user input and records the wall time
+// of every stage. Meant to be run against move_group with fake controllers.
+// The jobs go through getPickJobSegments and executeSequence like runPickJobs, with
+// the same grasp selection, linear paths, pipelining and blending. The time spent in
+// every instrumentation probe (IK, planning, execution...) is recorded per stage.
+
+namespace {
+  
+  struct Sample
+  {
+    int cycle;
+    std::string stage, category;
+    double duration;
+  };
+  
+  class StageRecorder
+  {
+  public:
+    StageRecorder() : cycle_(0) {}
+    
+    void setCycle(int cycle) { cycle_ = cycle; }
+    
+    void start() { start_ = ros::WallTime::now(); }
+    
+    void stop(const std::string &stage, const std::string &category)
+    {
+      add(stage, category, (ros::WallTime::now() - start_).toSec());
+    }
+    
+    void add(const std::string &stage, const std::string &category, double duration)
+    {
+      Sample sample;
+      sample.cycle = cycle_;
+      sample.stage = stage;
+      sample.category = category;
+      sample.duration = duration;
+      samples_.push_back(sample);
+    }
+    
+    const std::vector<Sample>& samples() const { return samples_; }
+    
+  private:
+    int cycle_;
+    ros::WallTime start_;
+    std::vector<Sample> samples_;
+  };
+  
+  // Nearest-rank percentile of sorted values
+  double percentile(const std::vector<double> &sorted, double p)
+  {
+    if (sorted.empty())
+      return 0.0;
+    int rank = (int)ceil(p/100.0*sorted.size());
+    return sorted[std::max(0, std::min((int)sorted.size()-1, rank-1))];
+  }
+  
+  void writeStats(std::ostream &os, const std::string &name, std::vector<double> values, bool last)
+  {
+    std::sort(values.begin(), values.end());
+    double sum = 0.0;
+    for (int i=0; i<values.size(); i++)
+      sum += values[i];
+    os << "    \"" << name << "\": {\"count\": " << values.size()
+       << ", \"mean\": " << (values.empty() ? 0.0 : sum/values.size())
+       << ", \"min\": " << (values.empty() ? 0.0 : values.front())
+       << ", \"p50\": " << percentile(values, 50) << ", \"p90\": " << percentile(values, 90)
+       << ", \"p99\": " << percentile(values, 99)
+       << ", \"max\": " << (values.empty() ? 0.0 : values.back()) << "}" << (last ? "\n" : ",\n");
+  }
+  
+  void writeStatsGroup(std::ostream &os, const std::string &name, const std::map<std::string, std::vector<double> > &groups, bool last)
+  {
+    os << "  \"" << name << "\": {\n";
+    std::map<std::string, std::vector<double> >::const_iterator it = groups.begin();
+    for (int i=0; it != groups.end(); it++, i++)
+      writeStats(os, it->first, it->second, i == groups.size()-1);
+    os << "  }" << (last ? "\n" : ",\n");
+  }
+  
+  // Time (s) spent so far in every probe of the instrumentation
+  std::map<std::string, double> probeTotals()
+  {
+    std::map<std::string, double> totals;
+    std::map<std::string, Instrumentation::ProbeStats> stats = Instrumentation::instance().getProbeStats();
+    for (std::map<std::string, Instrumentation::ProbeStats>::const_iterator it = stats.begin(); it != stats.end(); it++)
+      totals[it->first] = it->second.mean*it->second.count;
+    return totals;
+  }
+  
+  // Wall time of the stage, and the time spent in every probe during it. The next motion is
+  // planned while the current one executes, so the probes can add up to more than the stage
+  class TimedStage
+  {
+  public:
+    TimedStage(StageRecorder &recorder, const std::string &stage) : 
+      recorder_(recorder), stage_(stage), probes_(probeTotals()) 
+    {
+      recorder_.start();
+    }
+    
+    ~TimedStage()
+    {
+      recorder_.stop(stage_, "wall");
+      std::map<std::string, double> probes = probeTotals();
+      for (std::map<std::string, double>::const_iterator it = probes.begin(); it != probes.end(); it++){
+        double duration = it->second - probes_[it->first];
+        if (duration > 0.0)
+          recorder_.add(stage_, it->first, duration);
+      }
+    }
+    
+  private:
+    StageRecorder &recorder_;
+    std::string stage_;
+    std::map<std::string, double> probes_;
+  };
+}
+
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "pick_n_place_benchmark");
+  
+  int nb_cycles;
+  bool pipelined;
+  std::string output_prefix;
+  ros::NodeHandle nh_param("~");
+  nh_param.param<int>("cycles", nb_cycles, 10);
+  nh_param.param<bool>("pipelined", pipelined, true);
+  nh_param.param<std::string>("output_prefix", output_prefix, "pick_n_place_benchmark");
+  
+  // Same setup as pick_n_place_node
+  geometry_msgs::Pose depose_pose, epingle_pose, plaque_pose;
+  depose_pose.position.x = 0.5;
+  depose_pose.position.z = 0.2;
+  tf::quaternionTFToMsg(tf::createQuaternionFromRPY(M_PI, 0.0, 0.0), depose_pose.orientation);
+  epingle_pose.position.x = 0.5;
+  epingle_pose.position.z = 0.12;
+  tf::quaternionTFToMsg(tf::createQuaternionFromRPY(-M_PI/4.0, 0.0, 0.0), epingle_pose.orientation);
+  plaque_pose.position.x = 0.8;
+  plaque_pose.position.z = 0.5;
+  tf::quaternionTFToMsg(tf::createQuaternionFromRPY(-M_PI/2.0+M_PI/4.0, M_PI/4.0, -M_PI/2.0), plaque_pose.orientation);
+  
+  PickNPlace pick_n_place;
+  StageRecorder recorder;
+  std::vector<double> cycle_times;
+  int nb_failures = 0;
+  
+  for (int cycle=0; cycle<nb_cycles && ros::ok(); cycle++){
+    recorder.setCycle(cycle);
+    ros::WallTime cycle_start = ros::WallTime::now();
+    ROS_INFO("Benchmark cycle %d/%d", cycle+1, nb_cycles);
+    
+    // Every cycle starts from the same scene and the home position
+    {
+      TimedStage stage(recorder, "reset");
+      pick_n_place.cleanObjects();
+      SceneTransaction setup;
+      moveit_msgs::CollisionObject epingle_object, plaque_object;
+      if (pick_n_place.makeEpingleObject(epingle_pose, epingle_object))
+        setup.addObject(epingle_object);
+      if (pick_n_place.makePlaqueObject(plaque_pose, plaque_object))
+        setup.addObject(plaque_object);
+      pick_n_place.applySceneTransaction(setup);
+    }
+    
+    bool ok;
+    {
+      TimedStage stage(recorder, "start");
+      ok = pick_n_place.moveToStart();
+    }
+    
+    PickJob job("epingle", "plaque");
+    job.depose_pose = depose_pose;
+    std::vector<MotionSegment> segments;
+    if (ok){
+      TimedStage stage(recorder, "segments");
+      ok = pick_n_place.getPickJobSegments(job, segments);
+    }
+    if (ok){
+      TimedStage stage(recorder, "sequence");
+      ok = pick_n_place.executeSequence(segments, pipelined);
+    }
+    
+    if (ok)
+      cycle_times.push_back((ros::WallTime::now() - cycle_start).toSec());
+    else{
+      nb_failures++;
+      ROS_ERROR("Benchmark cycle %d failed", cycle);
+    }
+  }
+  
+  // Raw samples
+  std::string csv_name = output_prefix + ".csv";
+  std::ofstream csv(csv_name.c_str());
+  csv << "cycle,stage,category,duration\n";
+  std::map<std::string, std::vector<double> > per_category, per_stage;
+  for (int i=0; i<recorder.samples().size(); i++){
+    const Sample &sample = recorder.samples()[i];
+    csv << sample.cycle << "," << sample.stage << "," << sample.category << "," << sample.duration << "\n";
+    if (sample.category != "wall")
+      per_category[sample.category].push_back(sample.duration);
+    per_stage[sample.stage + "/" + sample.category].push_back(sample.duration);
+  }
+  
+  // Summary with the configuration actually used by the instance
+  std::string json_name = output_prefix + ".json";
+  std::ofstream json(json_name.c_str());
+  json << "{\n";
+  json << "  \"config\": {\"cycles\": " << nb_cycles << ", \"pipelined\": " << (pipelined ? "true" : "false")
+       << ", \"planner_id\": \"" << pick_n_place.getPlannerId()
+       << "\", \"max_planning_time\": " << pick_n_place.getMaxPlanningTime() 
+       << ", \"cartesian_max_step\": " << pick_n_place.getCartesianMaxStep()
+       << ", \"approach_blend_radius\": " << pick_n_place.getApproachBlendRadius()
+       << ", \"depose_blend_radius\": " << pick_n_place.getDeposeBlendRadius()
+       << ", \"ik_attempts\": " << pick_n_place.getIkAttempts() 
+       << ", \"use_local_kinematics\": " << (pick_n_place.usesLocalKinematics() ? "true" : "false")
+       << ", \"plan_cache\": " << (pick_n_place.usesPlanCache() ? "true" : "false") << "},\n";
+  json << "  \"failures\": " << nb_failures << ",\n";
+  json << "  \"cycle\": {\n";
+  writeStats(json, "total", cycle_times, true);
+  json << "  },\n";
+  writeStatsGroup(json, "categories", per_category, false);
+  writeStatsGroup(json, "stages", per_stage, true);
+  json << "}\n";
+  
+  ROS_INFO("Benchmark done: %d cycles, %d failures, results in %s and %s", nb_cycles, nb_failures, csv_name.c_str(), json_name.c_str());
+  ros::shutdown();
+  return 0;
+}
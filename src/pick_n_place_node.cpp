@@ -1,8 +1,44 @@
 #include <lwr_pick_n_place/pick_n_place.hpp>
 
+// Pick the epingle, put it in the plaque, depose it and go back home
+bool runCycle(PickNPlace &pick_n_place, const geometry_msgs::Pose &depose_pose, bool pipelined)
+{
+  if (!pipelined){
+    pick_n_place.moveAboveEpingle("epingle");
+    pick_n_place.moveToEpingle("epingle");
+    pick_n_place.attachObject("epingle");
+    pick_n_place.moveAbovePlaque("plaque");
+    pick_n_place.moveToPlaque("plaque");
+    pick_n_place.moveToCartesianPose(depose_pose);
+    pick_n_place.detachObject();
+    return pick_n_place.moveToStart();
+  }
+  
+  PickJob job("epingle", "plaque");
+  job.depose_pose = depose_pose;
+  std::vector<MotionSegment> segments;
+  if (!pick_n_place.getPickJobSegments(job, segments))
+    return false;
+  segments.push_back(MotionSegment(MotionSegment::START));
+  
+  return pick_n_place.executeSequence(segments);
+}
+
 int main(int argc, char **argv)
 {
   ros::init(argc, argv, "pick_n_place_node");
+  
+  // Plan the next motion while the current one is executing
+  bool pipelined;
+  ros::NodeHandle nh_param("~");
+  nh_param.param<bool>("pipelined", pipelined, false);
+  
+  // Tray mode: a grid of epingles, each one put in the plaque and deposed next to the previous ones
+  int tray_rows, tray_cols;
+  double tray_pitch;
+  nh_param.param<int>("tray_rows", tray_rows, 0);
+  nh_param.param<int>("tray_cols", tray_cols, 0);
+  nh_param.param<double>("tray_pitch", tray_pitch, 0.05);
 
   // Define pose for depose fo the epingle
   geometry_msgs::Pose depose_pose;
@@ -37,24 +73,59 @@ int main(int argc, char **argv)
   plaque_pose.position.z = 0.5;
   
   
-  PickNPlace pick_n_place;
-  pick_n_place.cleanObjects();
-  usleep(1000000*1);
+  // Setup restored from a snapshot if there is one, built and saved otherwise
+  std::string scene_snapshot;
+  nh_param.param<std::string>("scene_snapshot", scene_snapshot, "");
   
-  // Set the setup 
-  pick_n_place.addEpingleObject(epingle_pose);
-  pick_n_place.addPlaqueObject(plaque_pose);
+  PickNPlace pick_n_place;
+  if (scene_snapshot.empty() || !pick_n_place.restoreSceneSnapshot(scene_snapshot)){
+    pick_n_place.cleanObjects();
+    
+    // Set the setup 
+    SceneTransaction setup;
+    moveit_msgs::CollisionObject epingle_object, plaque_object;
+    if (pick_n_place.makeEpingleObject(epingle_pose, epingle_object))
+      setup.addObject(epingle_object);
+    if (pick_n_place.makePlaqueObject(plaque_pose, plaque_object))
+      setup.addObject(plaque_object);
+    if (pick_n_place.applySceneTransaction(setup) && !scene_snapshot.empty())
+      pick_n_place.saveSceneSnapshot(scene_snapshot);
+  }
 
+  if (tray_rows > 0 && tray_cols > 0){
+    std::vector<geometry_msgs::Pose> tray_poses;
+    std::vector<std::string> tray_ids;
+    for (int r=0; r<tray_rows; r++){
+      for (int c=0; c<tray_cols; c++){
+        geometry_msgs::Pose pose = epingle_pose;
+        pose.position.x += r*tray_pitch;
+        pose.position.y += (c+1)*tray_pitch;
+        tray_poses.push_back(pose);
+      }
+    }
+    pick_n_place.addEpingleTray(tray_poses, tray_ids);
+    
+    // Depose the parts on the other side, in the same layout
+    std::vector<PickJob> jobs;
+    for (int i=0; i<tray_ids.size(); i++){
+      PickJob job(tray_ids[i], "plaque");
+      job.depose_pose = depose_pose;
+      job.depose_pose.position.x += (i/tray_cols)*tray_pitch;
+      job.depose_pose.position.y -= (i%tray_cols+1)*tray_pitch;
+      jobs.push_back(job);
+    }
+    pick_n_place.moveToStart();
+    pick_n_place.orderPickJobs(jobs);
+    pick_n_place.runPickJobs(jobs, pipelined);
+    
+    MeshCache::instance().logStats();
+    ros::shutdown();
+    return 0;
+  }
+  
   // First: demo with set up already in place
   pick_n_place.moveToStart();
-  pick_n_place.moveAboveEpingle("epingle");
-  pick_n_place.moveToEpingle("epingle");
-  pick_n_place.attachObject("epingle");
-  pick_n_place.moveAbovePlaque("plaque");
-  pick_n_place.moveToPlaque("plaque");
-  pick_n_place.moveToCartesianPose(depose_pose);
-  pick_n_place.detachObject();
-  pick_n_place.moveToStart();
+  runCycle(pick_n_place, depose_pose, pipelined);
   
   // Keep going if user wants to move the set up
   int run_prg = 1, first =1;
@@ -62,18 +133,12 @@ int main(int argc, char **argv)
   std::cin >> run_prg;
   while(run_prg && ros::ok()){
     
-    pick_n_place.moveAboveEpingle("epingle");
-    pick_n_place.moveToEpingle("epingle");
-    pick_n_place.attachObject("epingle");
-    pick_n_place.moveAbovePlaque("plaque");
-    pick_n_place.moveToPlaque("plaque");
-    pick_n_place.moveToCartesianPose(depose_pose);
-    pick_n_place.detachObject();
-    pick_n_place.moveToStart();
+    runCycle(pick_n_place, depose_pose, pipelined);
     
     std::cout << "run more? 0/1" <<std::endl;
     std::cin >> run_prg;
   }
+  MeshCache::instance().logStats();
   ros::shutdown();
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,337 @@
+#include <lwr_pick_n_place/plan_cache.hpp>
+#include <lwr_pick_n_place/cache_io.hpp>
+
+#include <ros/serialization.h>
+#include <moveit/kinematic_constraints/kinematic_constraint.h>
+#include <geometric_shapes/shapes.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <math.h>
+
+using cache_io::HASH_SEED;
+using cache_io::hashBytes;
+using cache_io::quantize;
+
+namespace {
+  const char PLAN_CACHE_MAGIC[8] = {'L','W','R','P','C','A','C','1'};
+  // Keys are a few joint values and a goal, anything longer is corrupt
+  const boost::uint32_t MAX_KEY_SIZE = 4096;
+
+  void hashString(boost::uint64_t &hash, const std::string &str)
+  {
+    hashBytes(hash, str.data(), str.size());
+  }
+
+  void hashValue(boost::uint64_t &hash, double value)
+  {
+    long q = quantize(value, 1e-4);
+    hashBytes(hash, &q, sizeof(q));
+  }
+
+  void hashPose(boost::uint64_t &hash, const Eigen::Affine3d &pose)
+  {
+    Eigen::Quaterniond q(pose.rotation());
+    for (int i=0; i<3; i++)
+      hashValue(hash, pose.translation()[i]);
+    hashValue(hash, q.x());
+    hashValue(hash, q.y());
+    hashValue(hash, q.z());
+    hashValue(hash, q.w());
+  }
+
+  // Type and dimensions of a shape, or the content of a mesh
+  void hashShape(boost::uint64_t &hash, const shapes::Shape &shape)
+  {
+    int type = shape.type;
+    hashBytes(hash, &type, sizeof(type));
+    switch (shape.type){
+      case shapes::BOX:
+        for (int i=0; i<3; i++)
+          hashValue(hash, static_cast<const shapes::Box&>(shape).size[i]);
+        break;
+      case shapes::CYLINDER:
+        hashValue(hash, static_cast<const shapes::Cylinder&>(shape).radius);
+        hashValue(hash, static_cast<const shapes::Cylinder&>(shape).length);
+        break;
+      case shapes::CONE:
+        hashValue(hash, static_cast<const shapes::Cone&>(shape).radius);
+        hashValue(hash, static_cast<const shapes::Cone&>(shape).length);
+        break;
+      case shapes::SPHERE:
+        hashValue(hash, static_cast<const shapes::Sphere&>(shape).radius);
+        break;
+      case shapes::MESH:{
+        const shapes::Mesh &mesh = static_cast<const shapes::Mesh&>(shape);
+        hashBytes(hash, &mesh.vertex_count, sizeof(mesh.vertex_count));
+        hashBytes(hash, &mesh.triangle_count, sizeof(mesh.triangle_count));
+        hashBytes(hash, mesh.vertices, 3*mesh.vertex_count*sizeof(mesh.vertices[0]));
+        hashBytes(hash, mesh.triangles, 3*mesh.triangle_count*sizeof(mesh.triangles[0]));
+        break;
+      }
+      default:
+        break;
+    }
+  }
+}
+
+PlanCache::PlanCache(double joint_resolution, int max_size, const std::string &file_name) :
+  joint_resolution_(joint_resolution),
+  max_size_(max_size),
+  file_name_(file_name)
+{
+  if (!file_name_.empty())
+    load();
+}
+
+PlanCache::~PlanCache()
+{
+  if (!file_name_.empty())
+    save();
+  logStats();
+}
+
+std::string PlanCache::makeKey(const std::vector<double> &start_joints, const std::string &goal_key, boost::uint64_t scene_hash) const
+{
+  std::ostringstream os;
+  os << "s";
+  for (int i=0; i<start_joints.size(); i++)
+    os << ":" << quantize(start_joints[i], joint_resolution_);
+  os << "|" << goal_key << "|h:" << std::hex << scene_hash;
+  return os.str();
+}
+
+std::string PlanCache::jointGoalKey(const std::vector<double> &joints) const
+{
+  std::ostringstream os;
+  os << "joints";
+  for (int i=0; i<joints.size(); i++)
+    os << ":" << quantize(joints[i], joint_resolution_);
+  return os.str();
+}
+
+std::string PlanCache::poseGoalKey(const geometry_msgs::Pose &pose)
+{
+  // Goal tolerances are 1 mm, use the same resolution
+  std::ostringstream os;
+  os << "pose:" << quantize(pose.position.x, 1e-3) << ":" << quantize(pose.position.y, 1e-3) << ":" << quantize(pose.position.z, 1e-3)
+     << ":" << quantize(pose.orientation.x, 1e-3) << ":" << quantize(pose.orientation.y, 1e-3)
+     << ":" << quantize(pose.orientation.z, 1e-3) << ":" << quantize(pose.orientation.w, 1e-3);
+  return os.str();
+}
+
+std::string PlanCache::namedGoalKey(const std::string &name)
+{
+  return "named:" + name;
+}
+
+boost::uint64_t PlanCache::hashScene(const planning_scene::PlanningScene &scene)
+{
+  boost::uint64_t hash = HASH_SEED;
+
+  collision_detection::WorldConstPtr world = scene.getWorld();
+  std::vector<std::string> ids = world->getObjectIds();
+  std::sort(ids.begin(), ids.end());
+  for (int i=0; i<ids.size(); i++){
+    collision_detection::World::ObjectConstPtr object = world->getObject(ids[i]);
+    hashString(hash, ids[i]);
+    for (int j=0; j<object->shapes_.size(); j++){
+      hashShape(hash, *object->shapes_[j]);
+      hashPose(hash, object->shape_poses_[j]);
+    }
+  }
+
+  std::vector<const robot_state::AttachedBody*> attached_bodies;
+  scene.getCurrentState().getAttachedBodies(attached_bodies);
+  for (int i=0; i<attached_bodies.size(); i++){
+    hashString(hash, attached_bodies[i]->getName());
+    hashString(hash, attached_bodies[i]->getAttachedLinkName());
+    for (int j=0; j<attached_bodies[i]->getShapes().size(); j++){
+      hashShape(hash, *attached_bodies[i]->getShapes()[j]);
+      hashPose(hash, attached_bodies[i]->getFixedTransforms()[j]);
+    }
+  }
+  return hash;
+}
+
+bool PlanCache::lookup(const std::string &key, const planning_scene::PlanningScene &scene, const moveit_msgs::RobotState &start_state,
+                       const moveit_msgs::Constraints &goal, const std::string &group_name, moveit_msgs::RobotTrajectory &trajectory)
+{
+  moveit_msgs::RobotTrajectory candidate;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    std::map<std::string, moveit_msgs::RobotTrajectory>::const_iterator it = entries_.find(key);
+    if (it == entries_.end()){
+      stats_.misses++;
+      return false;
+    }
+    candidate = it->second;
+  }
+
+  // The key is quantized, start exactly from the requested state
+  trajectory_msgs::JointTrajectory &traj = candidate.joint_trajectory;
+  if (traj.points.empty() || traj.points[0].positions.size() != traj.joint_names.size()
+      || traj.points.back().positions.size() != traj.joint_names.size()){
+    boost::mutex::scoped_lock lock(mutex_);
+    stats_.misses++;
+    return false;
+  }
+  for (int i=0; i<traj.joint_names.size(); i++){
+    for (int j=0; j<start_state.joint_state.name.size(); j++){
+      if (start_state.joint_state.name[j] == traj.joint_names[i]){
+        traj.points[0].positions[i] = start_state.joint_state.position[j];
+        break;
+      }
+    }
+  }
+  
+  // The goal is quantized too, the trajectory must end within the tolerance of the requested one
+  robot_state::RobotState final_state(scene.getCurrentState());
+  final_state.setVariablePositions(traj.joint_names, traj.points.back().positions);
+  final_state.update();
+  kinematic_constraints::KinematicConstraintSet goal_constraints(scene.getRobotModel());
+  goal_constraints.add(goal, scene.getTransforms());
+  if (!goal_constraints.decide(final_state).satisfied){
+    boost::mutex::scoped_lock lock(mutex_);
+    stats_.misses++;
+    return false;
+  }
+
+  // Objects could have moved within the hash resolution, check the path again
+  if (!scene.isPathValid(start_state, candidate, group_name)){
+    boost::mutex::scoped_lock lock(mutex_);
+    stats_.rejected++;
+    entries_.erase(key);
+    insertion_order_.erase(std::remove(insertion_order_.begin(), insertion_order_.end(), key), insertion_order_.end());
+    return false;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+  stats_.hits++;
+  trajectory = candidate;
+  return true;
+}
+
+void PlanCache::insert(const std::string &key, const moveit_msgs::RobotTrajectory &trajectory)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (entries_.find(key) == entries_.end())
+    insertion_order_.push_back(key);
+  entries_[key] = trajectory;
+
+  while (max_size_ > 0 && entries_.size() > max_size_){
+    entries_.erase(insertion_order_.front());
+    insertion_order_.pop_front();
+  }
+}
+
+bool PlanCache::save() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  std::ofstream file(file_name_.c_str(), std::ios::binary | std::ios::trunc);
+  if (!file){
+    ROS_ERROR_STREAM("Failed to open plan cache file "<< file_name_);
+    return false;
+  }
+
+  file.write(PLAN_CACHE_MAGIC, sizeof(PLAN_CACHE_MAGIC));
+  boost::uint32_t count = insertion_order_.size();
+  file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+  for (int i=0; i<insertion_order_.size(); i++){
+    const std::string &key = insertion_order_[i];
+    const moveit_msgs::RobotTrajectory &traj = entries_.find(key)->second;
+
+    boost::uint32_t key_size = key.size();
+    boost::uint32_t msg_size = ros::serialization::serializationLength(traj);
+    std::vector<boost::uint8_t> buffer(msg_size);
+    ros::serialization::OStream stream(&buffer[0], msg_size);
+    ros::serialization::serialize(stream, traj);
+
+    file.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+    file.write(key.data(), key_size);
+    file.write(reinterpret_cast<const char*>(&msg_size), sizeof(msg_size));
+    file.write(reinterpret_cast<const char*>(&buffer[0]), msg_size);
+  }
+  ROS_INFO("Saved %u plans to %s", count, file_name_.c_str());
+  return file.good();
+}
+
+bool PlanCache::load()
+{
+  std::ifstream file(file_name_.c_str(), std::ios::binary | std::ios::ate);
+  if (!file){
+    ROS_INFO_STREAM("No plan cache file "<< file_name_ <<" yet, starting empty");
+    return false;
+  }
+  std::streamoff file_size = file.tellg();
+  file.seekg(0);
+
+  char magic[sizeof(PLAN_CACHE_MAGIC)];
+  boost::uint32_t count = 0;
+  file.read(magic, sizeof(magic));
+  file.read(reinterpret_cast<char*>(&count), sizeof(count));
+  if (!file || !std::equal(magic, magic + sizeof(magic), PLAN_CACHE_MAGIC)){
+    ROS_ERROR_STREAM("File "<< file_name_ <<" is not a plan cache");
+    return false;
+  }
+
+  // A corrupt file is dropped as a whole, the sizes are checked against the file before allocating
+  std::map<std::string, moveit_msgs::RobotTrajectory> entries;
+  std::deque<std::string> insertion_order;
+  for (boost::uint32_t i=0; i<count; i++){
+    boost::uint32_t key_size, msg_size;
+    file.read(reinterpret_cast<char*>(&key_size), sizeof(key_size));
+    if (!file || key_size > MAX_KEY_SIZE || key_size > file_size - file.tellg()){
+      ROS_ERROR_STREAM("Plan cache "<< file_name_ <<" is truncated or corrupt");
+      return false;
+    }
+    std::string key(key_size, '\0');
+    if (key_size > 0)
+      file.read(&key[0], key_size);
+    file.read(reinterpret_cast<char*>(&msg_size), sizeof(msg_size));
+    if (!file || msg_size > file_size - file.tellg()){
+      ROS_ERROR_STREAM("Plan cache "<< file_name_ <<" is truncated or corrupt");
+      return false;
+    }
+    std::vector<boost::uint8_t> buffer(msg_size);
+    if (msg_size > 0)
+      file.read(reinterpret_cast<char*>(&buffer[0]), msg_size);
+    if (!file){
+      ROS_ERROR_STREAM("Plan cache "<< file_name_ <<" is truncated");
+      return false;
+    }
+
+    // A corrupt record can claim more data than its message holds, or huge arrays
+    moveit_msgs::RobotTrajectory traj;
+    try{
+      ros::serialization::IStream stream(buffer.empty() ? 0 : &buffer[0], msg_size);
+      ros::serialization::deserialize(stream, traj);
+    }
+    catch (const std::exception &e){
+      ROS_ERROR_STREAM("Plan cache "<< file_name_ <<" is corrupt: "<< e.what());
+      return false;
+    }
+    if (entries.find(key) == entries.end())
+      insertion_order.push_back(key);
+    entries[key] = traj;
+  }
+
+  boost::mutex::scoped_lock lock(mutex_);
+  entries_.swap(entries);
+  insertion_order_.swap(insertion_order);
+  ROS_INFO("Loaded %zu plans from %s", entries_.size(), file_name_.c_str());
+  return true;
+}
+
+PlanCache::Stats PlanCache::getStats() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return stats_;
+}
+
+void PlanCache::logStats() const
+{
+  Stats stats = getStats();
+  ROS_INFO("Plan cache: %lu hits, %lu misses, %lu rejected by the scene", stats.hits, stats.misses, stats.rejected);
+}
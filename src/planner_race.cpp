@@ -0,0 +1,125 @@
+#include <lwr_pick_n_place/planner_race.hpp>
+
+#include <math.h>
+
+PlannerRace::PlannerRace(const robot_model::RobotModelConstPtr &robot_model, const std::string &ns,
+                         const std::vector<std::string> &planner_ids, int attempts_per_planner, Mode mode, double budget) :
+  mode_(mode),
+  budget_(budget)
+{
+  ros::NodeHandle nh(ns);
+  for (int i=0; i<planner_ids.size(); i++){
+    for (int j=0; j<attempts_per_planner; j++){
+      Worker worker;
+      worker.planner_id = planner_ids[i];
+      worker.pipeline.reset(new planning_pipeline::PlanningPipeline(robot_model, nh));
+      worker.done = false;
+      worker.success = false;
+      workers_.push_back(worker);
+    }
+  }
+  ROS_INFO("Planner race ready with %zu workers", workers_.size());
+}
+
+PlannerRace::Mode PlannerRace::modeFromString(const std::string &mode)
+{
+  if (mode == "shortest")
+    return SHORTEST;
+  if (mode != "first")
+    ROS_WARN_STREAM("Unknown racing mode "<< mode <<", using first");
+  return FIRST_VALID;
+}
+
+double PlannerRace::pathLength(const moveit_msgs::RobotTrajectory &trajectory)
+{
+  const std::vector<trajectory_msgs::JointTrajectoryPoint> &points = trajectory.joint_trajectory.points;
+  double length = 0.0;
+  for (int i=1; i<points.size(); i++){
+    double sq_dist = 0.0;
+    for (int j=0; j<points[i].positions.size(); j++)
+      sq_dist += pow(points[i].positions[j] - points[i-1].positions[j], 2);
+    length += sqrt(sq_dist);
+  }
+  return length;
+}
+
+void PlannerRace::runWorker(int index, const planning_scene::PlanningSceneConstPtr &scene,
+                            const planning_interface::MotionPlanRequest &request)
+{
+  Worker *worker = &workers_[index];
+  planning_interface::MotionPlanRequest worker_request = request;
+  worker_request.planner_id = worker->planner_id;
+  planning_interface::MotionPlanResponse response;
+  bool success = worker->pipeline->generatePlan(scene, worker_request, response) && response.trajectory_;
+
+  boost::mutex::scoped_lock lock(mutex_);
+  worker->done = true;
+  worker->success = success;
+  if (success){
+    response.trajectory_->getRobotTrajectoryMsg(worker->trajectory);
+    if (first_success_ < 0)
+      first_success_ = index;
+  }
+  done_cond_.notify_all();
+}
+
+bool PlannerRace::plan(const planning_scene::PlanningSceneConstPtr &scene, const planning_interface::MotionPlanRequest &request,
+                       moveit_msgs::RobotTrajectory &trajectory)
+{
+  ros::WallTime start = ros::WallTime::now();
+  boost::thread_group threads;
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    first_success_ = -1;
+    for (int i=0; i<workers_.size(); i++){
+      workers_[i].done = false;
+      workers_[i].success = false;
+      threads.create_thread(boost::bind(&PlannerRace::runWorker, this, i, scene, boost::cref(request)));
+    }
+  }
+
+  // Wait until the race is decided
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    boost::system_time deadline = boost::get_system_time() + boost::posix_time::milliseconds(static_cast<long>(budget_*1000.0));
+    while (true){
+      int nb_done = 0;
+      for (int i=0; i<workers_.size(); i++)
+        nb_done += workers_[i].done;
+      if (nb_done == workers_.size() || (mode_ == FIRST_VALID && first_success_ >= 0))
+        break;
+      if (!done_cond_.timed_wait(lock, deadline))
+        break;
+    }
+  }
+
+  // Stop the planners still running and wait for them
+  for (int i=0; i<workers_.size(); i++){
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!workers_[i].done)
+      workers_[i].pipeline->terminate();
+  }
+  threads.join_all();
+
+  // In first valid mode, the plans of the workers that finished afterwards are ignored
+  int best = first_success_;
+  double best_length = best < 0 ? 0.0 : pathLength(workers_[best].trajectory);
+  for (int i=0; mode_ == SHORTEST && i<workers_.size(); i++){
+    if (!workers_[i].success)
+      continue;
+    double length = pathLength(workers_[i].trajectory);
+    if (length < best_length){
+      best = i;
+      best_length = length;
+    }
+  }
+
+  if (best < 0){
+    ROS_ERROR("No planner of the race found a solution");
+    return false;
+  }
+  ROS_INFO("Planner race won by %s (worker %d) with path length %.3f rad in %.3f s", workers_[best].planner_id.c_str(),
+      best, best_length, (ros::WallTime::now() - start).toSec());
+  trajectory = workers_[best].trajectory;
+  return true;
+}
@@ -0,0 +1,223 @@
+#include <lwr_pick_n_place/reachability_map.hpp>
+#include <lwr_pick_n_place/cache_io.hpp>
+
+#include <eigen_conversions/eigen_msg.h>
+
+#include <algorithm>
+#include <fstream>
+#include <math.h>
+
+using cache_io::writeValue;
+using cache_io::readValue;
+
+namespace {
+  const char REACHABILITY_MAP_MAGIC[8] = {'L','W','R','R','M','A','P','1'};
+}
+
+const boost::uint32_t ReachabilityMap::NO_ENTRY;
+
+ReachabilityMap::ReachabilityMap() :
+  extent_(0.0),
+  resolution_(1.0),
+  nb_voxels_(0),
+  nb_directions_(0),
+  nb_joints_(0)
+{
+}
+
+ReachabilityMap::ReachabilityMap(double extent, double resolution, int nb_directions, int nb_joints) :
+  extent_(extent),
+  resolution_(resolution),
+  nb_voxels_((int)ceil(2.0*extent/resolution)),
+  nb_directions_(nb_directions),
+  nb_joints_(nb_joints)
+{
+  init();
+  entries_.assign(capacity(), NO_ENTRY);
+}
+
+void ReachabilityMap::init()
+{
+  // Fibonacci sphere, the directions are spread evenly
+  directions_.clear();
+  double golden_angle = M_PI*(3.0 - sqrt(5.0));
+  for (int i=0; i<nb_directions_; i++){
+    double z = 1.0 - (2.0*i + 1.0)/nb_directions_;
+    double r = sqrt(std::max(0.0, 1.0 - z*z));
+    directions_.push_back(Eigen::Vector3d(r*cos(golden_angle*i), r*sin(golden_angle*i), z));
+  }
+}
+
+bool ReachabilityMap::getVoxel(const Eigen::Vector3d &position, int voxel[3]) const
+{
+  for (int i=0; i<3; i++){
+    voxel[i] = (int)floor((position[i] + extent_)/resolution_);
+    if (voxel[i] < 0 || voxel[i] >= nb_voxels_)
+      return false;
+  }
+  return true;
+}
+
+int ReachabilityMap::getDirection(const Eigen::Vector3d &approach) const
+{
+  int closest = 0;
+  for (int i=1; i<nb_directions_; i++)
+    if (directions_[i].dot(approach) > directions_[closest].dot(approach))
+      closest = i;
+  return closest;
+}
+
+size_t ReachabilityMap::getIndex(int x, int y, int z, int direction) const
+{
+  return (((size_t)x*nb_voxels_ + y)*nb_voxels_ + z)*nb_directions_ + direction;
+}
+
+void ReachabilityMap::insert(const Eigen::Affine3d &pose, const std::vector<double> &joints)
+{
+  int voxel[3];
+  if (joints.size() != nb_joints_ || !getVoxel(pose.translation(), voxel))
+    return;
+  size_t index = getIndex(voxel[0], voxel[1], voxel[2], getDirection(pose.linear().col(2)));
+  if (entries_[index] != NO_ENTRY)
+    return;
+  entries_[index] = samples_.size()/nb_joints_;
+  samples_.insert(samples_.end(), joints.begin(), joints.end());
+}
+
+boost::uint32_t ReachabilityMap::findSample(const geometry_msgs::Pose &pose) const
+{
+  if (entries_.empty())
+    return NO_ENTRY;
+  Eigen::Affine3d eigen_pose;
+  tf::poseMsgToEigen(pose, eigen_pose);
+  int voxel[3];
+  if (!getVoxel(eigen_pose.translation(), voxel))
+    return NO_ENTRY;
+  int direction = getDirection(eigen_pose.linear().col(2));
+  
+  // The voxel of the pose first, then its neighbours which absorb the discretization of the samples
+  boost::uint32_t sample = entries_[getIndex(voxel[0], voxel[1], voxel[2], direction)];
+  for (int dx=-1; dx<=1 && sample == NO_ENTRY; dx++)
+    for (int dy=-1; dy<=1 && sample == NO_ENTRY; dy++)
+      for (int dz=-1; dz<=1 && sample == NO_ENTRY; dz++){
+        int x = voxel[0] + dx, y = voxel[1] + dy, z = voxel[2] + dz;
+        if (x >= 0 && x < nb_voxels_ && y >= 0 && y < nb_voxels_ && z >= 0 && z < nb_voxels_)
+          sample = entries_[getIndex(x, y, z, direction)];
+      }
+  return sample;
+}
+
+bool ReachabilityMap::isReachable(const geometry_msgs::Pose &pose) const
+{
+  return findSample(pose) != NO_ENTRY;
+}
+
+bool ReachabilityMap::isOutOfReach(const geometry_msgs::Pose &pose) const
+{
+  if (entries_.empty())
+    return false;
+  int voxel[3];
+  if (!getVoxel(Eigen::Vector3d(pose.position.x, pose.position.y, pose.position.z), voxel))
+    return false;
+  for (int dx=-1; dx<=1; dx++)
+    for (int dy=-1; dy<=1; dy++)
+      for (int dz=-1; dz<=1; dz++){
+        int x = voxel[0] + dx, y = voxel[1] + dy, z = voxel[2] + dz;
+        if (x < 0 || x >= nb_voxels_ || y < 0 || y >= nb_voxels_ || z < 0 || z >= nb_voxels_)
+          continue;
+        for (int direction=0; direction<nb_directions_; direction++)
+          if (entries_[getIndex(x, y, z, direction)] != NO_ENTRY)
+            return false;
+      }
+  return true;
+}
+
+bool ReachabilityMap::lookupSeed(const geometry_msgs::Pose &pose, std::vector<double> &seed) const
+{
+  boost::uint32_t sample = findSample(pose);
+  if (sample == NO_ENTRY)
+    return false;
+  seed.assign(samples_.begin() + (size_t)sample*nb_joints_, samples_.begin() + (size_t)(sample + 1)*nb_joints_);
+  return true;
+}
+
+size_t ReachabilityMap::size() const
+{
+  return nb_joints_ > 0 ? samples_.size()/nb_joints_ : 0;
+}
+
+size_t ReachabilityMap::capacity() const
+{
+  return (size_t)nb_voxels_*nb_voxels_*nb_voxels_*nb_directions_;
+}
+
+bool ReachabilityMap::empty() const
+{
+  return size() == 0;
+}
+
+bool ReachabilityMap::save(const std::string &file_name) const
+{
+  std::ofstream file(file_name.c_str(), std::ios::binary | std::ios::trunc);
+  if (!file){
+    ROS_ERROR_STREAM("Failed to open reachability map file "<< file_name);
+    return false;
+  }
+  
+  file.write(REACHABILITY_MAP_MAGIC, sizeof(REACHABILITY_MAP_MAGIC));
+  writeValue<double>(file, extent_);
+  writeValue<double>(file, resolution_);
+  writeValue<boost::uint32_t>(file, nb_voxels_);
+  writeValue<boost::uint32_t>(file, nb_directions_);
+  writeValue<boost::uint32_t>(file, nb_joints_);
+  writeValue<boost::uint32_t>(file, samples_.size());
+  if (!entries_.empty())
+    file.write(reinterpret_cast<const char*>(&entries_[0]), entries_.size()*sizeof(entries_[0]));
+  if (!samples_.empty())
+    file.write(reinterpret_cast<const char*>(&samples_[0]), samples_.size()*sizeof(samples_[0]));
+  ROS_INFO("Saved a reachability map of %zu/%zu entries to %s", size(), capacity(), file_name.c_str());
+  return file.good();
+}
+
+bool ReachabilityMap::load(const std::string &file_name, int nb_joints)
+{
+  std::ifstream file(file_name.c_str(), std::ios::binary);
+  if (!file){
+    ROS_WARN_STREAM("No reachability map file "<< file_name);
+    return false;
+  }
+  
+  char magic[sizeof(REACHABILITY_MAP_MAGIC)];
+  file.read(magic, sizeof(magic));
+  extent_ = readValue<double>(file);
+  resolution_ = readValue<double>(file);
+  nb_voxels_ = readValue<boost::uint32_t>(file);
+  nb_directions_ = readValue<boost::uint32_t>(file);
+  nb_joints_ = readValue<boost::uint32_t>(file);
+  boost::uint32_t nb_values = readValue<boost::uint32_t>(file);
+  if (!file || !std::equal(magic, magic + sizeof(magic), REACHABILITY_MAP_MAGIC) || nb_voxels_ > 1000 || nb_directions_ > 1000){
+    ROS_ERROR_STREAM("File "<< file_name <<" is not a reachability map");
+    *this = ReachabilityMap();
+    return false;
+  }
+  if (nb_joints_ != nb_joints){
+    ROS_ERROR("Reachability map %s is for %d joints, not %d", file_name.c_str(), nb_joints_, nb_joints);
+    *this = ReachabilityMap();
+    return false;
+  }
+  
+  init();
+  entries_.resize(capacity());
+  samples_.resize(nb_values);
+  if (!entries_.empty())
+    file.read(reinterpret_cast<char*>(&entries_[0]), entries_.size()*sizeof(entries_[0]));
+  if (!samples_.empty())
+    file.read(reinterpret_cast<char*>(&samples_[0]), samples_.size()*sizeof(samples_[0]));
+  if (!file){
+    ROS_ERROR_STREAM("Reachability map "<< file_name <<" is truncated");
+    *this = ReachabilityMap();
+    return false;
+  }
+  ROS_INFO("Loaded a reachability map of %zu/%zu entries from %s", size(), capacity(), file_name.c_str());
+  return true;
+}
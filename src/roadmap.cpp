@@ -0,0 +1,402 @@
+#include <lwr_pick_n_place/roadmap.hpp>
+#include <lwr_pick_n_place/plan_cache.hpp>
+#include <lwr_pick_n_place/cache_io.hpp>
+
+#include <moveit/robot_state/robot_state.h>
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <math.h>
+
+using cache_io::writeValue;
+using cache_io::readValue;
+
+namespace {
+  const char ROADMAP_MAGIC[8] = {'L','W','R','R','O','A','D','1'};
+  const boost::uint32_t NO_EDGE = 0xffffffff;
+}
+
+Roadmap::Roadmap(const robot_model::RobotModelConstPtr &robot_model, const std::string &group_name, int nb_neighbours, double resolution) :
+  robot_model_(robot_model),
+  group_name_(group_name),
+  joint_model_group_(robot_model->getJointModelGroup(group_name)),
+  nb_joints_(joint_model_group_ ? joint_model_group_->getVariableCount() : 0),
+  nb_neighbours_(nb_neighbours),
+  resolution_(resolution),
+  static_hash_(0),
+  dynamic_hash_(0),
+  has_dynamic_objects_(false),
+  has_attached_bodies_(false)
+{
+}
+
+void Roadmap::build(const planning_scene::PlanningSceneConstPtr &scene, const std::vector<std::string> &static_ids, int nb_milestones)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  ros::WallTime start = ros::WallTime::now();
+  static_ids_ = static_ids;
+  milestones_.clear();
+  edges_.clear();
+  adjacency_.clear();
+  static_scene_.reset();
+  updateScenes(scene);
+
+  // Milestones are only checked against the static part, the edges are checked lazily
+  robot_state::RobotState state(static_scene_->getCurrentState());
+  std::vector<double> positions;
+  int nb_samples = 0;
+  while (adjacency_.size() < nb_milestones && nb_samples < 100*nb_milestones){
+    nb_samples++;
+    state.setToRandomPositions(joint_model_group_);
+    state.update();
+    if (static_scene_->isStateColliding(state, group_name_))
+      continue;
+    state.copyJointGroupPositions(joint_model_group_, positions);
+    milestones_.insert(milestones_.end(), positions.begin(), positions.end());
+    adjacency_.push_back(std::vector<boost::uint32_t>());
+  }
+
+  std::vector<boost::uint32_t> neighbours;
+  for (boost::uint32_t i=0; i<adjacency_.size(); i++){
+    nearest(milestone(i), nb_neighbours_+1, adjacency_.size(), neighbours);
+    for (int j=0; j<neighbours.size(); j++){
+      if (neighbours[j] != i && !isConnected(i, neighbours[j]))
+        addEdge(i, neighbours[j]);
+    }
+  }
+  ROS_INFO("Built a roadmap of %zu milestones and %zu edges from %d samples in %.2f s",
+           adjacency_.size(), edges_.size(), nb_samples, (ros::WallTime::now() - start).toSec());
+}
+
+bool Roadmap::query(const planning_scene::PlanningSceneConstPtr &scene, const std::vector<double> &start, const std::vector<double> &goal,
+                    trajectory_msgs::JointTrajectory &path, double timeout)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  if (adjacency_.empty() || start.size() != nb_joints_ || goal.size() != nb_joints_)
+    return false;
+  ros::WallTime begin = ros::WallTime::now();
+  ros::WallTime deadline = begin + ros::WallDuration(timeout);
+  updateScenes(scene);
+
+  // The query configurations are connected for this query only, the direct motion is tried first
+  size_t nb_milestones = adjacency_.size();
+  size_t nb_edges = edges_.size();
+  boost::uint32_t start_node = addNode(start, nb_milestones);
+  boost::uint32_t goal_node = addNode(goal, nb_milestones);
+  addEdge(start_node, goal_node);
+
+  // Check the edges of the shortest path until one path is entirely valid
+  std::vector<boost::uint32_t> edge_path;
+  bool found = false;
+  int nb_searches = 0;
+  while (!found && ros::WallTime::now() < deadline && searchPath(start_node, goal_node, edge_path)){
+    nb_searches++;
+    found = true;
+    for (int i=0; i<edge_path.size() && found; i++)
+      found = checkEdge(edges_[edge_path[i]]);
+  }
+
+  if (found){
+    path.joint_names = joint_model_group_->getVariableNames();
+    path.points.resize(edge_path.size()+1);
+    boost::uint32_t node = start_node;
+    path.points[0].positions.assign(milestone(node), milestone(node) + nb_joints_);
+    for (int i=0; i<edge_path.size(); i++){
+      const Edge &edge = edges_[edge_path[i]];
+      node = edge.from == node ? edge.to : edge.from;
+      path.points[i+1].positions.assign(milestone(node), milestone(node) + nb_joints_);
+    }
+  }
+
+  // Each edge was appended to the adjacency of its nodes, remove them in the reverse order
+  for (size_t i=edges_.size(); i>nb_edges; i--){
+    adjacency_[edges_[i-1].from].pop_back();
+    adjacency_[edges_[i-1].to].pop_back();
+  }
+  edges_.erase(edges_.begin() + nb_edges, edges_.end());
+  adjacency_.resize(nb_milestones);
+  milestones_.resize(nb_milestones*nb_joints_);
+
+  if (found)
+    ROS_INFO("Roadmap path of %zu waypoints found in %.3f s after %d searches", path.points.size(), (ros::WallTime::now() - begin).toSec(), nb_searches);
+  else
+    ROS_WARN("No roadmap path found in %.3f s after %d searches", (ros::WallTime::now() - begin).toSec(), nb_searches);
+  return found;
+}
+
+bool Roadmap::save(const std::string &file_name) const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  std::ofstream file(file_name.c_str(), std::ios::binary | std::ios::trunc);
+  if (!file){
+    ROS_ERROR_STREAM("Failed to open roadmap file "<< file_name);
+    return false;
+  }
+
+  file.write(ROADMAP_MAGIC, sizeof(ROADMAP_MAGIC));
+  writeValue<boost::uint32_t>(file, nb_joints_);
+  writeValue<boost::uint64_t>(file, static_hash_);
+  writeValue<boost::uint32_t>(file, static_ids_.size());
+  for (int i=0; i<static_ids_.size(); i++){
+    writeValue<boost::uint32_t>(file, static_ids_[i].size());
+    file.write(static_ids_[i].data(), static_ids_[i].size());
+  }
+  writeValue<boost::uint32_t>(file, adjacency_.size());
+  if (!milestones_.empty())
+    file.write(reinterpret_cast<const char*>(&milestones_[0]), milestones_.size()*sizeof(milestones_[0]));
+  writeValue<boost::uint32_t>(file, edges_.size());
+  for (int i=0; i<edges_.size(); i++){
+    writeValue<boost::uint32_t>(file, edges_[i].from);
+    writeValue<boost::uint32_t>(file, edges_[i].to);
+    writeValue<boost::uint8_t>(file, edges_[i].static_state);
+  }
+  ROS_INFO("Saved a roadmap of %zu milestones and %zu edges to %s", adjacency_.size(), edges_.size(), file_name.c_str());
+  return file.good();
+}
+
+bool Roadmap::load(const std::string &file_name)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  std::ifstream file(file_name.c_str(), std::ios::binary);
+  if (!file){
+    ROS_WARN_STREAM("No roadmap file "<< file_name);
+    return false;
+  }
+
+  char magic[sizeof(ROADMAP_MAGIC)];
+  file.read(magic, sizeof(magic));
+  boost::uint32_t nb_joints = readValue<boost::uint32_t>(file);
+  if (!file || !std::equal(magic, magic + sizeof(magic), ROADMAP_MAGIC) || nb_joints != nb_joints_){
+    ROS_ERROR_STREAM("File "<< file_name <<" is not a roadmap of group "<< group_name_);
+    return false;
+  }
+
+  static_hash_ = readValue<boost::uint64_t>(file);
+  static_ids_.resize(readValue<boost::uint32_t>(file));
+  for (int i=0; i<static_ids_.size() && file; i++){
+    static_ids_[i].resize(readValue<boost::uint32_t>(file));
+    if (!static_ids_[i].empty())
+      file.read(&static_ids_[i][0], static_ids_[i].size());
+  }
+  adjacency_.assign(readValue<boost::uint32_t>(file), std::vector<boost::uint32_t>());
+  milestones_.resize(adjacency_.size()*nb_joints_);
+  if (!milestones_.empty())
+    file.read(reinterpret_cast<char*>(&milestones_[0]), milestones_.size()*sizeof(milestones_[0]));
+  boost::uint32_t nb_edges = readValue<boost::uint32_t>(file);
+  edges_.clear();
+  for (int i=0; i<nb_edges && file; i++){
+    boost::uint32_t from = readValue<boost::uint32_t>(file);
+    boost::uint32_t to = readValue<boost::uint32_t>(file);
+    boost::uint8_t state = readValue<boost::uint8_t>(file);
+    if (from >= adjacency_.size() || to >= adjacency_.size())
+      break;
+    addEdge(from, to);
+    edges_.back().static_state = state;
+  }
+  if (!file || edges_.size() != nb_edges){
+    ROS_ERROR_STREAM("Roadmap "<< file_name <<" is truncated");
+    milestones_.clear();
+    edges_.clear();
+    adjacency_.clear();
+    return false;
+  }
+
+  // The scenes are split again at the first query, against the static hash of the file
+  static_scene_.reset();
+  dynamic_scene_.reset();
+  ROS_INFO("Loaded a roadmap of %zu milestones and %zu edges from %s", adjacency_.size(), edges_.size(), file_name.c_str());
+  return true;
+}
+
+size_t Roadmap::size() const
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return adjacency_.size();
+}
+
+bool Roadmap::empty() const
+{
+  return size() == 0;
+}
+
+void Roadmap::updateScenes(const planning_scene::PlanningSceneConstPtr &scene)
+{
+  std::vector<const robot_state::AttachedBody*> attached_bodies;
+  scene->getCurrentState().getAttachedBodies(attached_bodies);
+
+  // The attached bodies move with the robot, they are checked against all the objects
+  planning_scene::PlanningScenePtr static_scene = planning_scene::PlanningScene::clone(scene);
+  planning_scene::PlanningScenePtr dynamic_scene = planning_scene::PlanningScene::clone(scene);
+  static_scene->getCurrentStateNonConst().clearAttachedBodies();
+  std::vector<std::string> ids = scene->getWorld()->getObjectIds();
+  for (int i=0; i<ids.size(); i++){
+    if (std::find(static_ids_.begin(), static_ids_.end(), ids[i]) == static_ids_.end())
+      static_scene->getWorldNonConst()->removeObject(ids[i]);
+    else if (attached_bodies.empty())
+      dynamic_scene->getWorldNonConst()->removeObject(ids[i]);
+  }
+
+  // The hash covers the geometry, a file saved with a hash of the poses only never matches it
+  boost::uint64_t static_hash = PlanCache::hashScene(*static_scene);
+  if (static_hash != static_hash_){
+    if (static_scene_ || !edges_.empty())
+      ROS_WARN("The static objects of the roadmap changed, its edges will be checked again");
+    for (int i=0; i<edges_.size(); i++)
+      edges_[i].static_state = UNKNOWN;
+    static_hash_ = static_hash;
+  }
+
+  // Any object may have moved onto an edge, only the verdicts against the objects are dropped
+  boost::uint64_t dynamic_hash = PlanCache::hashScene(*dynamic_scene);
+  if (dynamic_hash != dynamic_hash_){
+    for (int i=0; i<edges_.size(); i++)
+      edges_[i].dynamic_state = UNKNOWN;
+    dynamic_hash_ = dynamic_hash;
+  }
+
+  static_scene_ = static_scene;
+  dynamic_scene_ = dynamic_scene;
+  has_attached_bodies_ = !attached_bodies.empty();
+  has_dynamic_objects_ = has_attached_bodies_ || !dynamic_scene->getWorld()->getObjectIds().empty();
+}
+
+bool Roadmap::checkEdge(Edge &edge)
+{
+  if (edge.static_state == UNKNOWN)
+    edge.static_state = isSegmentValid(milestone(edge.from), milestone(edge.to), false) ? VALID : INVALID;
+  if (edge.static_state == INVALID || !has_dynamic_objects_)
+    return edge.static_state == VALID;
+  if (edge.dynamic_state == UNKNOWN)
+    edge.dynamic_state = isSegmentValid(milestone(edge.from), milestone(edge.to), true) ? VALID : INVALID;
+  return edge.dynamic_state == VALID;
+}
+
+bool Roadmap::isSegmentValid(const double *from, const double *to, bool dynamic)
+{
+  // The dynamic part only checks the robot against the objects, the self collisions are static.
+  // Attached bodies also collide with the robot, so they need the full check
+  const planning_scene::PlanningScenePtr &scene = dynamic ? dynamic_scene_ : static_scene_;
+  robot_state::RobotState state(scene->getCurrentState());
+  collision_detection::CollisionRequest request;
+  request.group_name = group_name_;
+
+  int nb_steps = std::max(1, (int)ceil(distance(from, to) / resolution_));
+  std::vector<double> positions(nb_joints_);
+  for (int k=0; k<=nb_steps; k++){
+    double s = (double)k / nb_steps;
+    for (int j=0; j<nb_joints_; j++)
+      positions[j] = from[j] + s*(to[j] - from[j]);
+    state.setJointGroupPositions(joint_model_group_, positions);
+    state.update();
+    if (dynamic && !has_attached_bodies_){
+      collision_detection::CollisionResult result;
+      scene->getCollisionWorld()->checkRobotCollision(request, result, *scene->getCollisionRobot(), state, scene->getAllowedCollisionMatrix());
+      if (result.collision)
+        return false;
+    }
+    else if (scene->isStateColliding(state, group_name_))
+      return false;
+  }
+  return true;
+}
+
+bool Roadmap::searchPath(boost::uint32_t start, boost::uint32_t goal, std::vector<boost::uint32_t> &edge_path) const
+{
+  typedef std::pair<double, boost::uint32_t> QueueEntry;
+  std::priority_queue<QueueEntry, std::vector<QueueEntry>, std::greater<QueueEntry> > open;
+  std::vector<double> costs(adjacency_.size(), std::numeric_limits<double>::infinity());
+  std::vector<boost::uint32_t> parent_edges(adjacency_.size(), NO_EDGE);
+  std::vector<char> closed(adjacency_.size(), 0);
+
+  costs[start] = 0.0;
+  open.push(QueueEntry(distance(milestone(start), milestone(goal)), start));
+  while (!open.empty()){
+    boost::uint32_t node = open.top().second;
+    open.pop();
+    if (closed[node])
+      continue;
+    if (node == goal)
+      break;
+    closed[node] = 1;
+    for (int i=0; i<adjacency_[node].size(); i++){
+      const Edge &edge = edges_[adjacency_[node][i]];
+      if (edge.static_state == INVALID || (has_dynamic_objects_ && edge.dynamic_state == INVALID))
+        continue;
+      boost::uint32_t next = edge.from == node ? edge.to : edge.from;
+      double cost = costs[node] + edge.length;
+      if (closed[next] || cost >= costs[next])
+        continue;
+      costs[next] = cost;
+      parent_edges[next] = adjacency_[node][i];
+      open.push(QueueEntry(cost + distance(milestone(next), milestone(goal)), next));
+    }
+  }
+  if (parent_edges[goal] == NO_EDGE)
+    return false;
+
+  edge_path.clear();
+  for (boost::uint32_t node = goal; node != start;){
+    const Edge &edge = edges_[parent_edges[node]];
+    edge_path.push_back(parent_edges[node]);
+    node = edge.from == node ? edge.to : edge.from;
+  }
+  std::reverse(edge_path.begin(), edge_path.end());
+  return true;
+}
+
+boost::uint32_t Roadmap::addNode(const std::vector<double> &positions, size_t nb_milestones)
+{
+  std::vector<boost::uint32_t> neighbours;
+  nearest(&positions[0], nb_neighbours_, nb_milestones, neighbours);
+  boost::uint32_t node = adjacency_.size();
+  milestones_.insert(milestones_.end(), positions.begin(), positions.end());
+  adjacency_.push_back(std::vector<boost::uint32_t>());
+  for (int i=0; i<neighbours.size(); i++)
+    addEdge(node, neighbours[i]);
+  return node;
+}
+
+void Roadmap::addEdge(boost::uint32_t from, boost::uint32_t to)
+{
+  edges_.push_back(Edge(from, to, distance(milestone(from), milestone(to))));
+  adjacency_[from].push_back(edges_.size()-1);
+  adjacency_[to].push_back(edges_.size()-1);
+}
+
+void Roadmap::nearest(const double *positions, int k, size_t nb_milestones, std::vector<boost::uint32_t> &indices) const
+{
+  std::vector<std::pair<double, boost::uint32_t> > distances(nb_milestones);
+  for (boost::uint32_t i=0; i<nb_milestones; i++)
+    distances[i] = std::make_pair(distance(positions, milestone(i)), i);
+  int nb_nearest = std::min<size_t>(k, nb_milestones);
+  std::partial_sort(distances.begin(), distances.begin() + nb_nearest, distances.end());
+  indices.resize(nb_nearest);
+  for (int i=0; i<nb_nearest; i++)
+    indices[i] = distances[i].second;
+}
+
+bool Roadmap::isConnected(boost::uint32_t from, boost::uint32_t to) const
+{
+  for (int i=0; i<adjacency_[from].size(); i++){
+    const Edge &edge = edges_[adjacency_[from][i]];
+    if (edge.from == to || edge.to == to)
+      return true;
+  }
+  return false;
+}
+
+const double *Roadmap::milestone(boost::uint32_t index) const
+{
+  return &milestones_[index*nb_joints_];
+}
+
+double Roadmap::distance(const double *a, const double *b) const
+{
+  double squared = 0.0;
+  for (int j=0; j<nb_joints_; j++)
+    squared += (b[j] - a[j])*(b[j] - a[j]);
+  return sqrt(squared);
+}
@@ -0,0 +1,292 @@
+#include <lwr_pick_n_place/scene_snapshot.hpp>
+#include <lwr_pick_n_place/cache_io.hpp>
+
+#include <ros/serialization.h>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+
+// Layout, every record starts on 8 bytes:
+//   header: magic[8], uint32 mesh count, uint32 world object count, uint32 attached object count, uint32 0
+//   mesh:   uint64 hash, uint32 vertex count, uint32 triangle count, double xyz[3*vertices], uint32 ids[3*triangles]
+//   object: uint32 message size, uint32 mesh count, uint32 mesh indices[mesh count], serialized
+//           AttachedCollisionObject without its meshes (empty link name for the world objects)
+using cache_io::HASH_SEED;
+using cache_io::hashBytes;
+
+namespace {
+  const char SCENE_SNAPSHOT_MAGIC[8] = {'L','W','R','S','C','N','S','1'};
+  
+  struct Header
+  {
+    char magic[8];
+    boost::uint32_t nb_meshes, nb_world_objects, nb_attached_objects, reserved;
+  };
+  
+  struct MeshHeader
+  {
+    boost::uint64_t hash;
+    boost::uint32_t nb_vertices, nb_triangles;
+  };
+  
+  size_t padding(size_t size)
+  {
+    return (8 - size % 8) % 8;
+  }
+  
+  void writePadding(std::ofstream &file, size_t size)
+  {
+    const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    file.write(zeros, padding(size));
+  }
+  
+  // Meshes with the same hash are only shared when their content is the same
+  bool sameMesh(const shape_msgs::Mesh &a, const shape_msgs::Mesh &b)
+  {
+    if (a.vertices.size() != b.vertices.size() || a.triangles.size() != b.triangles.size())
+      return false;
+    for (int i=0; i<a.vertices.size(); i++)
+      if (a.vertices[i].x != b.vertices[i].x || a.vertices[i].y != b.vertices[i].y || a.vertices[i].z != b.vertices[i].z)
+        return false;
+    for (int i=0; i<a.triangles.size(); i++)
+      if (a.triangles[i].vertex_indices != b.triangles[i].vertex_indices)
+        return false;
+    return true;
+  }
+  
+  // Reads the records of a mapped file, checking that they fit in it
+  class Reader
+  {
+  public:
+    Reader(const char *data, size_t size) : data_(data), size_(size), offset_(0) {}
+    
+    const char* take(size_t size)
+    {
+      if (size > size_ - offset_)
+        return 0;
+      const char *record = data_ + offset_;
+      offset_ += size + padding(size);
+      offset_ = std::min(offset_, size_);
+      return record;
+    }
+    
+  private:
+    const char *data_;
+    size_t size_, offset_;
+  };
+  
+  // Serialize an object without its meshes, they are referenced by index in the mesh table
+  void writeObject(std::ofstream &file, const moveit_msgs::AttachedCollisionObject &object, const std::vector<boost::uint32_t> &refs)
+  {
+    moveit_msgs::AttachedCollisionObject stripped = object;
+    stripped.object.meshes.clear();
+    boost::uint32_t msg_size = ros::serialization::serializationLength(stripped);
+    std::vector<boost::uint8_t> buffer(msg_size);
+    ros::serialization::OStream stream(&buffer[0], msg_size);
+    ros::serialization::serialize(stream, stripped);
+    
+    boost::uint32_t record[2] = {msg_size, (boost::uint32_t)refs.size()};
+    file.write(reinterpret_cast<const char*>(record), sizeof(record));
+    if (!refs.empty())
+      file.write(reinterpret_cast<const char*>(&refs[0]), refs.size()*sizeof(boost::uint32_t));
+    writePadding(file, refs.size()*sizeof(boost::uint32_t));
+    file.write(reinterpret_cast<const char*>(&buffer[0]), msg_size);
+    writePadding(file, msg_size);
+  }
+  
+  bool readObject(Reader &reader, const std::vector<shape_msgs::Mesh> &meshes, moveit_msgs::AttachedCollisionObject &object)
+  {
+    const boost::uint32_t *record = reinterpret_cast<const boost::uint32_t*>(reader.take(2*sizeof(boost::uint32_t)));
+    if (!record)
+      return false;
+    boost::uint32_t msg_size = record[0], nb_refs = record[1];
+    const boost::uint32_t *refs = reinterpret_cast<const boost::uint32_t*>(reader.take(nb_refs*sizeof(boost::uint32_t)));
+    const char *msg = reader.take(msg_size);
+    if ((nb_refs > 0 && !refs) || !msg)
+      return false;
+    
+    // A corrupt record can claim more data than its message holds, or huge arrays
+    std::vector<boost::uint8_t> buffer(msg, msg + msg_size);
+    try{
+      ros::serialization::IStream stream(buffer.empty() ? 0 : &buffer[0], msg_size);
+      ros::serialization::deserialize(stream, object);
+    }
+    catch (const std::exception &e){
+      ROS_ERROR_STREAM("Failed to read a scene snapshot object: "<< e.what());
+      return false;
+    }
+    for (boost::uint32_t i=0; i<nb_refs; i++){
+      if (refs[i] >= meshes.size())
+        return false;
+      object.object.meshes.push_back(meshes[refs[i]]);
+    }
+    return true;
+  }
+}
+
+void SceneSnapshot::capture(const planning_scene::PlanningScene &scene)
+{
+  scene.getCollisionObjectMsgs(world_objects_);
+  scene.getAttachedCollisionObjectMsgs(attached_objects_);
+}
+
+const std::vector<moveit_msgs::CollisionObject>& SceneSnapshot::getWorldObjects() const
+{
+  return world_objects_;
+}
+
+const std::vector<moveit_msgs::AttachedCollisionObject>& SceneSnapshot::getAttachedObjects() const
+{
+  return attached_objects_;
+}
+
+boost::uint64_t SceneSnapshot::hashMesh(const shape_msgs::Mesh &mesh)
+{
+  boost::uint64_t hash = HASH_SEED;
+  for (int i=0; i<mesh.vertices.size(); i++){
+    double xyz[3] = {mesh.vertices[i].x, mesh.vertices[i].y, mesh.vertices[i].z};
+    hashBytes(hash, xyz, sizeof(xyz));
+  }
+  for (int i=0; i<mesh.triangles.size(); i++)
+    hashBytes(hash, &mesh.triangles[i].vertex_indices[0], 3*sizeof(mesh.triangles[i].vertex_indices[0]));
+  return hash;
+}
+
+bool SceneSnapshot::save(const std::string &file_name) const
+{
+  // World objects are written as attached objects without link
+  std::vector<moveit_msgs::AttachedCollisionObject> objects(world_objects_.size());
+  for (int i=0; i<world_objects_.size(); i++)
+    objects[i].object = world_objects_[i];
+  objects.insert(objects.end(), attached_objects_.begin(), attached_objects_.end());
+  
+  // Meshes shared by several objects (e.g. a tray of parts) are stored once
+  typedef std::multimap<boost::uint64_t, boost::uint32_t>::const_iterator MeshIterator;
+  std::multimap<boost::uint64_t, boost::uint32_t> mesh_indices;
+  std::vector<const shape_msgs::Mesh*> meshes;
+  std::vector<std::vector<boost::uint32_t> > refs(objects.size());
+  for (int i=0; i<objects.size(); i++){
+    for (int j=0; j<objects[i].object.meshes.size(); j++){
+      const shape_msgs::Mesh &mesh = objects[i].object.meshes[j];
+      boost::uint64_t hash = hashMesh(mesh);
+      std::pair<MeshIterator, MeshIterator> range = mesh_indices.equal_range(hash);
+      MeshIterator it = range.first;
+      while (it != range.second && !sameMesh(*meshes[it->second], mesh))
+        it++;
+      if (it == range.second){
+        it = mesh_indices.insert(std::make_pair(hash, (boost::uint32_t)meshes.size()));
+        meshes.push_back(&mesh);
+      }
+      refs[i].push_back(it->second);
+    }
+  }
+  
+  std::ofstream file(file_name.c_str(), std::ios::binary | std::ios::trunc);
+  if (!file){
+    ROS_ERROR_STREAM("Failed to open scene snapshot file "<< file_name);
+    return false;
+  }
+  Header header;
+  std::copy(SCENE_SNAPSHOT_MAGIC, SCENE_SNAPSHOT_MAGIC + sizeof(SCENE_SNAPSHOT_MAGIC), header.magic);
+  header.nb_meshes = meshes.size();
+  header.nb_world_objects = world_objects_.size();
+  header.nb_attached_objects = attached_objects_.size();
+  header.reserved = 0;
+  file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  
+  for (int i=0; i<meshes.size(); i++){
+    MeshHeader mesh_header;
+    mesh_header.hash = hashMesh(*meshes[i]);
+    mesh_header.nb_vertices = meshes[i]->vertices.size();
+    mesh_header.nb_triangles = meshes[i]->triangles.size();
+    file.write(reinterpret_cast<const char*>(&mesh_header), sizeof(mesh_header));
+    for (int j=0; j<meshes[i]->vertices.size(); j++){
+      double xyz[3] = {meshes[i]->vertices[j].x, meshes[i]->vertices[j].y, meshes[i]->vertices[j].z};
+      file.write(reinterpret_cast<const char*>(xyz), sizeof(xyz));
+    }
+    for (int j=0; j<meshes[i]->triangles.size(); j++){
+      boost::uint32_t ids[3] = {meshes[i]->triangles[j].vertex_indices[0], meshes[i]->triangles[j].vertex_indices[1], 
+                                meshes[i]->triangles[j].vertex_indices[2]};
+      file.write(reinterpret_cast<const char*>(ids), sizeof(ids));
+    }
+    writePadding(file, mesh_header.nb_triangles*3*sizeof(boost::uint32_t));
+  }
+  
+  for (int i=0; i<objects.size(); i++)
+    writeObject(file, objects[i], refs[i]);
+  ROS_INFO("Saved %zu objects with %zu distinct meshes to %s", objects.size(), meshes.size(), file_name.c_str());
+  return file.good();
+}
+
+bool SceneSnapshot::load(const std::string &file_name)
+{
+  namespace bip = boost::interprocess;
+  bip::mapped_region region;
+  try{
+    bip::file_mapping mapping(file_name.c_str(), bip::read_only);
+    region = bip::mapped_region(mapping, bip::read_only);
+  }
+  catch (const bip::interprocess_exception &e){
+    ROS_INFO_STREAM("No scene snapshot "<< file_name<< ": "<< e.what());
+    return false;
+  }
+  
+  Reader reader(static_cast<const char*>(region.get_address()), region.get_size());
+  const Header *header = reinterpret_cast<const Header*>(reader.take(sizeof(Header)));
+  if (!header || !std::equal(SCENE_SNAPSHOT_MAGIC, SCENE_SNAPSHOT_MAGIC + sizeof(SCENE_SNAPSHOT_MAGIC), header->magic)){
+    ROS_ERROR_STREAM("File "<< file_name <<" is not a scene snapshot");
+    return false;
+  }
+  
+  if (header->nb_meshes > region.get_size()/sizeof(MeshHeader)){
+    ROS_ERROR_STREAM("Scene snapshot "<< file_name <<" is corrupt, it cannot hold "<< header->nb_meshes <<" meshes");
+    return false;
+  }
+  
+  // The vertices and triangles are read in place from the mapping
+  std::vector<shape_msgs::Mesh> meshes(header->nb_meshes);
+  for (boost::uint32_t i=0; i<header->nb_meshes; i++){
+    const MeshHeader *mesh_header = reinterpret_cast<const MeshHeader*>(reader.take(sizeof(MeshHeader)));
+    if (!mesh_header)
+      break;
+    const double *xyz = reinterpret_cast<const double*>(reader.take(mesh_header->nb_vertices*3*sizeof(double)));
+    const boost::uint32_t *ids = reinterpret_cast<const boost::uint32_t*>(reader.take(mesh_header->nb_triangles*3*sizeof(boost::uint32_t)));
+    if (!xyz || !ids){
+      ROS_ERROR_STREAM("Scene snapshot "<< file_name <<" is truncated");
+      return false;
+    }
+    meshes[i].vertices.resize(mesh_header->nb_vertices);
+    for (boost::uint32_t j=0; j<mesh_header->nb_vertices; j++){
+      meshes[i].vertices[j].x = xyz[3*j];
+      meshes[i].vertices[j].y = xyz[3*j+1];
+      meshes[i].vertices[j].z = xyz[3*j+2];
+    }
+    meshes[i].triangles.resize(mesh_header->nb_triangles);
+    for (boost::uint32_t j=0; j<mesh_header->nb_triangles; j++)
+      std::copy(ids + 3*j, ids + 3*j + 3, meshes[i].triangles[j].vertex_indices.begin());
+    if (hashMesh(meshes[i]) != mesh_header->hash){
+      ROS_ERROR_STREAM("Scene snapshot "<< file_name <<" is corrupt, mesh "<< i <<" does not match its hash");
+      return false;
+    }
+  }
+  
+  world_objects_.clear();
+  attached_objects_.clear();
+  for (boost::uint32_t i=0; i<header->nb_world_objects + header->nb_attached_objects; i++){
+    moveit_msgs::AttachedCollisionObject object;
+    if (!readObject(reader, meshes, object)){
+      ROS_ERROR_STREAM("Scene snapshot "<< file_name <<" is truncated or corrupt");
+      return false;
+    }
+    if (i < header->nb_world_objects)
+      world_objects_.push_back(object.object);
+    else
+      attached_objects_.push_back(object);
+  }
+  ROS_INFO("Loaded %zu world and %zu attached objects from %s", world_objects_.size(), attached_objects_.size(), file_name.c_str());
+  return true;
+}
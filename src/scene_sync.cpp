@@ -0,0 +1,139 @@
+#include <lwr_pick_n_place/scene_sync.hpp>
+
+#include <boost/bind.hpp>
+
+namespace {
+  bool hasObjects(const std::vector<std::string> &ids, bool present, const planning_scene::PlanningScene &scene)
+  {
+    for (int i=0; i<ids.size(); i++)
+      if (scene.getWorld()->hasObject(ids[i]) != present)
+        return false;
+    return true;
+  }
+
+  bool isAttached(const std::string &id, bool attached, const planning_scene::PlanningScene &scene)
+  {
+    if (id.empty()){
+      std::vector<const robot_state::AttachedBody*> attached_bodies;
+      scene.getCurrentState().getAttachedBodies(attached_bodies);
+      return attached_bodies.empty() != attached;
+    }
+    return scene.getCurrentState().hasAttachedBody(id) == attached;
+  }
+
+  bool isEmpty(const planning_scene::PlanningScene &scene)
+  {
+    return scene.getWorld()->size() == 0 && isAttached("", false, scene);
+  }
+
+  boost::system_time deadlineFromNow(double timeout)
+  {
+    return boost::get_system_time() + boost::posix_time::microseconds(static_cast<long>(timeout*1e6));
+  }
+}
+
+ros::SubscriberStatusCallback SubscriberWaiter::connectCallback()
+{
+  return boost::bind(&SubscriberWaiter::onConnect, this, _1);
+}
+
+void SubscriberWaiter::onConnect(const ros::SingleSubscriberPublisher &publisher)
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  connect_cond_.notify_all();
+}
+
+bool SubscriberWaiter::waitForSubscribers(const ros::Publisher &publisher, int nb_subscribers, double timeout)
+{
+  boost::system_time deadline = deadlineFromNow(timeout);
+  boost::mutex::scoped_lock lock(mutex_);
+  while (publisher.getNumSubscribers() < nb_subscribers){
+    if (!connect_cond_.timed_wait(lock, deadline))
+      return publisher.getNumSubscribers() >= nb_subscribers;
+  }
+  return true;
+}
+
+SceneSynchronizer::SceneSynchronizer(planning_scene_monitor::PlanningSceneMonitor *monitor) :
+  monitor_(monitor),
+  sequence_(0)
+{
+  monitor_->addUpdateCallback(boost::bind(&SceneSynchronizer::onSceneUpdate, this, _1));
+}
+
+void SceneSynchronizer::onSceneUpdate(planning_scene_monitor::PlanningSceneMonitor::SceneUpdateType type)
+{
+  // Robot state updates alone do not tell anything about published diffs
+  if (type == planning_scene_monitor::PlanningSceneMonitor::UPDATE_STATE)
+    return;
+  boost::mutex::scoped_lock lock(mutex_);
+  sequence_++;
+  update_cond_.notify_all();
+}
+
+unsigned long SceneSynchronizer::getSequence()
+{
+  boost::mutex::scoped_lock lock(mutex_);
+  return sequence_;
+}
+
+bool SceneSynchronizer::checkPredicate(const ScenePredicate &predicate)
+{
+  planning_scene_monitor::LockedPlanningSceneRO scene(monitor_);
+  const planning_scene::PlanningSceneConstPtr &scene_ptr = scene;
+  return predicate(*scene_ptr);
+}
+
+bool SceneSynchronizer::waitFor(const ScenePredicate &predicate, unsigned long sequence, double timeout)
+{
+  ros::WallTime start = ros::WallTime::now();
+  boost::system_time deadline = deadlineFromNow(timeout);
+  boost::mutex::scoped_lock lock(mutex_);
+  while (true){
+    // The scene is checked without holding our lock, updates keep being counted meanwhile
+    unsigned long current = sequence_;
+    if (current > sequence){
+      lock.unlock();
+      bool ready = checkPredicate(predicate);
+      lock.lock();
+      if (ready){
+        ROS_DEBUG("Scene synchronized in %.3f s", (ros::WallTime::now() - start).toSec());
+        return true;
+      }
+    }
+    while (sequence_ == current){
+      if (!update_cond_.timed_wait(lock, deadline)){
+        lock.unlock();
+        bool ready = checkPredicate(predicate);
+        if (!ready)
+          ROS_WARN("Timed out after %.3f s waiting for the planning scene", timeout);
+        return ready;
+      }
+    }
+  }
+}
+
+SceneSynchronizer::ScenePredicate SceneSynchronizer::objectsInWorld(const std::vector<std::string> &ids)
+{
+  return boost::bind(&hasObjects, ids, true, _1);
+}
+
+SceneSynchronizer::ScenePredicate SceneSynchronizer::objectsNotInWorld(const std::vector<std::string> &ids)
+{
+  return boost::bind(&hasObjects, ids, false, _1);
+}
+
+SceneSynchronizer::ScenePredicate SceneSynchronizer::objectAttached(const std::string &id)
+{
+  return boost::bind(&isAttached, id, true, _1);
+}
+
+SceneSynchronizer::ScenePredicate SceneSynchronizer::objectNotAttached(const std::string &id)
+{
+  return boost::bind(&isAttached, id, false, _1);
+}
+
+SceneSynchronizer::ScenePredicate SceneSynchronizer::sceneEmpty()
+{
+  return boost::bind(&isEmpty, _1);
+}
@@ -0,0 +1,186 @@
+#include <lwr_pick_n_place/scene_transaction.hpp>
+
+#include <eigen_conversions/eigen_msg.h>
+
+#include <boost/bind.hpp>
+
+#include <algorithm>
+
+namespace {
+  const double POSE_TOLERANCE = 1e-5;
+  
+  // The shapes of the world object are at the poses of the message, in the order the scene adds them
+  bool isPlaced(const moveit_msgs::CollisionObject &object, const planning_scene::PlanningScene &scene)
+  {
+    collision_detection::World::ObjectConstPtr world_object = scene.getWorld()->getObject(object.id);
+    if (!world_object)
+      return false;
+    std::vector<geometry_msgs::Pose> poses(object.primitive_poses);
+    poses.insert(poses.end(), object.mesh_poses.begin(), object.mesh_poses.end());
+    poses.insert(poses.end(), object.plane_poses.begin(), object.plane_poses.end());
+    if (world_object->shape_poses_.size() != poses.size())
+      return false;
+    
+    Eigen::Affine3d frame = Eigen::Affine3d::Identity();
+    if (!object.header.frame_id.empty() && scene.knowsFrameTransform(object.header.frame_id))
+      frame = scene.getFrameTransform(object.header.frame_id);
+    for (int i=0; i<poses.size(); i++){
+      Eigen::Affine3d expected;
+      tf::poseMsgToEigen(poses[i], expected);
+      expected = frame*expected;
+      if ((world_object->shape_poses_[i].matrix() - expected.matrix()).cwiseAbs().maxCoeff() > POSE_TOLERANCE)
+        return false;
+    }
+    return true;
+  }
+  
+  bool isApplied(const SceneSynchronizer::ScenePredicate &present, const SceneSynchronizer::ScenePredicate &removed, 
+                 const std::vector<std::string> &detached_ids, const std::vector<std::string> &attached_ids, 
+                 const std::vector<moveit_msgs::CollisionObject> &placed_objects, const planning_scene::PlanningScene &scene)
+  {
+    for (int i=0; i<detached_ids.size(); i++)
+      if (scene.getCurrentState().hasAttachedBody(detached_ids[i]))
+        return false;
+    for (int i=0; i<attached_ids.size(); i++)
+      if (!scene.getCurrentState().hasAttachedBody(attached_ids[i]))
+        return false;
+    if (!present(scene) || !removed(scene))
+      return false;
+    for (int i=0; i<placed_objects.size(); i++)
+      if (!isPlaced(placed_objects[i], scene))
+        return false;
+    return true;
+  }
+
+  // Keep the last operation on an id only, a later operation overrides the earlier ones
+  void forgetId(std::vector<std::string> &ids, const std::string &id)
+  {
+    ids.erase(std::remove(ids.begin(), ids.end(), id), ids.end());
+  }
+  
+  void forgetId(std::vector<moveit_msgs::CollisionObject> &objects, const std::string &id)
+  {
+    for (int i=objects.size()-1; i>=0; i--)
+      if (objects[i].id == id)
+        objects.erase(objects.begin() + i);
+  }
+  
+  // Only the poses of the shapes are checked, their geometry is not compared
+  void placeObject(std::vector<moveit_msgs::CollisionObject> &objects, const moveit_msgs::CollisionObject &object)
+  {
+    forgetId(objects, object.id);
+    moveit_msgs::CollisionObject placed;
+    placed.id = object.id;
+    placed.header = object.header;
+    placed.primitive_poses = object.primitive_poses;
+    placed.mesh_poses = object.mesh_poses;
+    placed.plane_poses = object.plane_poses;
+    objects.push_back(placed);
+  }
+}
+
+SceneTransaction::SceneTransaction()
+{
+  diff_.is_diff = true;
+  diff_.robot_state.is_diff = true;
+}
+
+void SceneTransaction::addObject(const moveit_msgs::CollisionObject &object)
+{
+  diff_.world.collision_objects.push_back(object);
+  diff_.world.collision_objects.back().operation = moveit_msgs::CollisionObject::ADD;
+  forgetId(removed_ids_, object.id);
+  forgetId(present_ids_, object.id);
+  present_ids_.push_back(object.id);
+  placeObject(placed_objects_, object);
+}
+
+void SceneTransaction::moveObject(const moveit_msgs::CollisionObject &object)
+{
+  moveit_msgs::CollisionObject move;
+  move.id = object.id;
+  move.header = object.header;
+  move.operation = moveit_msgs::CollisionObject::MOVE;
+  move.primitive_poses = object.primitive_poses;
+  move.mesh_poses = object.mesh_poses;
+  move.plane_poses = object.plane_poses;
+  diff_.world.collision_objects.push_back(move);
+  forgetId(removed_ids_, object.id);
+  forgetId(present_ids_, object.id);
+  present_ids_.push_back(object.id);
+  placeObject(placed_objects_, object);
+}
+
+void SceneTransaction::removeObject(const std::string &id)
+{
+  moveit_msgs::CollisionObject remove;
+  remove.id = id;
+  remove.operation = moveit_msgs::CollisionObject::REMOVE;
+  diff_.world.collision_objects.push_back(remove);
+  forgetId(present_ids_, id);
+  forgetId(removed_ids_, id);
+  forgetId(placed_objects_, id);
+  removed_ids_.push_back(id);
+}
+
+void SceneTransaction::detachObject(const std::string &id)
+{
+  // The attached body is processed before the world, so later operations on the id apply to the detached object
+  moveit_msgs::AttachedCollisionObject detach;
+  detach.object.id = id;
+  detach.object.operation = moveit_msgs::CollisionObject::REMOVE;
+  diff_.robot_state.attached_collision_objects.push_back(detach);
+  diff_.robot_state.is_diff = true;
+  forgetId(removed_ids_, id);
+  forgetId(present_ids_, id);
+  forgetId(attached_ids_, id);
+  forgetId(detached_ids_, id);
+  forgetId(placed_objects_, id);
+  present_ids_.push_back(id);
+  detached_ids_.push_back(id);
+}
+
+void SceneTransaction::attachObject(const moveit_msgs::AttachedCollisionObject &object)
+{
+  // Processed before the world as well, an object of the world with the same id is taken from it
+  diff_.robot_state.attached_collision_objects.push_back(object);
+  diff_.robot_state.attached_collision_objects.back().object.operation = moveit_msgs::CollisionObject::ADD;
+  diff_.robot_state.is_diff = true;
+  forgetId(present_ids_, object.object.id);
+  forgetId(detached_ids_, object.object.id);
+  forgetId(attached_ids_, object.object.id);
+  forgetId(placed_objects_, object.object.id);
+  attached_ids_.push_back(object.object.id);
+}
+
+size_t SceneTransaction::size() const
+{
+  return diff_.world.collision_objects.size() + diff_.robot_state.attached_collision_objects.size();
+}
+
+bool SceneTransaction::empty() const
+{
+  return size() == 0;
+}
+
+void SceneTransaction::clear()
+{
+  diff_.world.collision_objects.clear();
+  diff_.robot_state.attached_collision_objects.clear();
+  present_ids_.clear();
+  removed_ids_.clear();
+  detached_ids_.clear();
+  attached_ids_.clear();
+  placed_objects_.clear();
+}
+
+const moveit_msgs::PlanningScene& SceneTransaction::getDiff() const
+{
+  return diff_;
+}
+
+SceneSynchronizer::ScenePredicate SceneTransaction::getPredicate() const
+{
+  return boost::bind(&isApplied, SceneSynchronizer::objectsInWorld(present_ids_), SceneSynchronizer::objectsNotInWorld(removed_ids_), 
+                     detached_ids_, attached_ids_, placed_objects_, _1);
+}
@@ -0,0 +1,26 @@
+#include <lwr_pick_n_place/collision_geometry.hpp>
+
+#include <cstdlib>
+
+// Write the simplified collision mesh of a resource next to it, so that nodes do not compute it at startup
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "simplify_collision_mesh");
+  if (argc < 3){
+    std::cout << "Usage: simplify_collision_mesh <resource> <decimated|convex_hull> [tolerance]" << std::endl;
+    return 1;
+  }
+  
+  double tolerance = argc > 3 ? atof(argv[3]) : 0.001;
+  CollisionGeometry::Mode mode = CollisionGeometry::modeFromString(argv[2]);
+  if (mode != CollisionGeometry::DECIMATED && mode != CollisionGeometry::CONVEX_HULL){
+    ROS_ERROR("Only decimated meshes and convex hulls are cached");
+    return 1;
+  }
+  
+  CollisionGeometry geometry(mode, tolerance);
+  if (!geometry.getSimplifiedMesh(argv[1]))
+    return 1;
+  ROS_INFO_STREAM("Simplified mesh available as "<< geometry.getCacheResource(argv[1]));
+  return 0;
+}
@@ -0,0 +1,109 @@
+#include <lwr_pick_n_place/target_pose_engine.hpp>
+
+#include <math.h>
+
+TargetPoseEngine::TargetPoseEngine()
+{
+  // The gripper points down onto the epingle, and goes under the plaque holes
+  setOffsets("epingle", makeOffset(0.0, 0.0, 0.12, M_PI, 0.0, 0.0), makeOffset(0.0, 0.0, 0.06, M_PI, 0.0, 0.0));
+  setOffsets("plaque", makeOffset(0.0, 0.0, -0.3, 0.0, 0.0, 0.0), makeOffset(0.0, 0.0, -0.2, 0.0, 0.0, 0.0));
+}
+
+void TargetPoseEngine::loadParams(const ros::NodeHandle &nh)
+{
+  std::vector<std::string> types;
+  for (std::map<std::string, Offsets>::const_iterator it = offsets_.begin(); it != offsets_.end(); ++it)
+    types.push_back(it->first);
+  nh.param<std::vector<std::string> >("target_types", types, types);
+  
+  for (int i=0; i<types.size(); i++){
+    Offsets defaults;
+    defaults.above = defaults.at = Eigen::Isometry3d::Identity();
+    std::map<std::string, Offsets>::const_iterator it = offsets_.find(types[i]);
+    if (it != offsets_.end())
+      defaults = it->second;
+    setOffsets(types[i], loadOffset(nh, "target_offsets/" + types[i] + "/above", defaults.above),
+               loadOffset(nh, "target_offsets/" + types[i] + "/at", defaults.at));
+  }
+}
+
+Eigen::Isometry3d TargetPoseEngine::loadOffset(const ros::NodeHandle &nh, const std::string &name, const Eigen::Isometry3d &default_offset)
+{
+  std::vector<double> values;
+  if (!nh.getParam(name, values))
+    return default_offset;
+  if (values.size() != 6){
+    ROS_ERROR_STREAM("Parameter "<< name<< " must be [x, y, z, roll, pitch, yaw], using the default offset");
+    return default_offset;
+  }
+  return makeOffset(values[0], values[1], values[2], values[3], values[4], values[5]);
+}
+
+void TargetPoseEngine::setOffsets(const std::string &type, const Eigen::Isometry3d &above, const Eigen::Isometry3d &at)
+{
+  Offsets &offsets = offsets_[type];
+  offsets.above = above;
+  offsets.at = at;
+}
+
+bool TargetPoseEngine::getType(const std::string &object_id, std::string &type) const
+{
+  bool found = false;
+  for (std::map<std::string, Offsets>::const_iterator it = offsets_.begin(); it != offsets_.end(); ++it){
+    const std::string &candidate = it->first;
+    bool is_instance = object_id == candidate || 
+                       (object_id.size() > candidate.size() && object_id.compare(0, candidate.size(), candidate) == 0 && 
+                        object_id[candidate.size()] == '_');
+    if (is_instance && (!found || candidate.size() > type.size())){
+      type = candidate;
+      found = true;
+    }
+  }
+  return found;
+}
+
+bool TargetPoseEngine::getOffset(const std::string &object_id, Stage stage, Eigen::Isometry3d &offset) const
+{
+  std::string type;
+  if (!getType(object_id, type)){
+    ROS_ERROR_STREAM("No target offsets for object "<< object_id);
+    return false;
+  }
+  const Offsets &offsets = offsets_.find(type)->second;
+  offset = stage == ABOVE ? offsets.above : offsets.at;
+  return true;
+}
+
+Eigen::Isometry3d TargetPoseEngine::apply(const Eigen::Isometry3d &object_pose, const Eigen::Isometry3d &offset, double yaw)
+{
+  return object_pose * Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()) * offset;
+}
+
+Eigen::Isometry3d TargetPoseEngine::atHeight(const Eigen::Isometry3d &offset, double height)
+{
+  Eigen::Isometry3d result(offset);
+  result.translation().z() = height;
+  return result;
+}
+
+Eigen::Isometry3d TargetPoseEngine::makeOffset(double x, double y, double z, double roll, double pitch, double yaw)
+{
+  Eigen::Isometry3d offset = Eigen::Isometry3d::Identity();
+  offset.translation() = Eigen::Vector3d(x, y, z);
+  offset.linear() = (Eigen::AngleAxisd(yaw, Eigen::Vector3d::UnitZ()) *
+                     Eigen::AngleAxisd(pitch, Eigen::Vector3d::UnitY()) *
+                     Eigen::AngleAxisd(roll, Eigen::Vector3d::UnitX())).toRotationMatrix();
+  return offset;
+}
+
+void TargetPoseEngine::toMsg(const Eigen::Isometry3d &pose, geometry_msgs::Pose &msg)
+{
+  Eigen::Quaterniond rotation(pose.linear());
+  msg.position.x = pose.translation().x();
+  msg.position.y = pose.translation().y();
+  msg.position.z = pose.translation().z();
+  msg.orientation.x = rotation.x();
+  msg.orientation.y = rotation.y();
+  msg.orientation.z = rotation.z();
+  msg.orientation.w = rotation.w();
+}
@@ -0,0 +1,332 @@
+#include <lwr_pick_n_place/trajectory_processor.hpp>
+
+#include <moveit/robot_state/conversions.h>
+
+#include <boost/random/uniform_int_distribution.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace {
+  // Largest distance between the waypoint and the segment from the previous to the next one, per joint.
+  // The segment is parameterized by the joint moving the most, so a point off the line or going back is kept
+  double distanceToSegment(const std::vector<double> &previous, const std::vector<double> &point, const std::vector<double> &next)
+  {
+    int main_joint = 0;
+    double main_delta = 0.0;
+    for (int j=0; j<previous.size(); j++){
+      if (std::fabs(next[j] - previous[j]) > main_delta){
+        main_delta = std::fabs(next[j] - previous[j]);
+        main_joint = j;
+      }
+    }
+    double s = main_delta > 0.0 ? (point[main_joint] - previous[main_joint]) / (next[main_joint] - previous[main_joint]) : 0.0;
+    if (s < 0.0 || s > 1.0)
+      return std::numeric_limits<double>::max();
+    
+    double max_distance = 0.0;
+    for (int j=0; j<previous.size(); j++)
+      max_distance = std::max(max_distance, std::fabs(previous[j] + s*(next[j] - previous[j]) - point[j]));
+    return max_distance;
+  }
+
+  double jointDistance(const std::vector<double> &from, const std::vector<double> &to)
+  {
+    double squared = 0.0;
+    for (int j=0; j<from.size(); j++)
+      squared += (to[j] - from[j])*(to[j] - from[j]);
+    return std::sqrt(squared);
+  }
+
+  // Length of the path between two waypoints, in joint space
+  double pathLength(const std::vector<trajectory_msgs::JointTrajectoryPoint> &points, int first, int last)
+  {
+    double length = 0.0;
+    for (int i=first; i<last; i++)
+      length += jointDistance(points[i].positions, points[i+1].positions);
+    return length;
+  }
+  
+  // Point at a joint space distance from a waypoint, walking the path with step -1 or 1.
+  // index is set to the last waypoint walked through before reaching the point
+  std::vector<double> walkPath(const std::vector<trajectory_msgs::JointTrajectoryPoint> &points, int start, int step, double distance, int &index)
+  {
+    index = start;
+    while (index+step >= 0 && index+step < points.size()){
+      const std::vector<double> &from = points[index].positions;
+      const std::vector<double> &to = points[index+step].positions;
+      double length = jointDistance(from, to);
+      if (length > distance){
+        std::vector<double> point(from.size());
+        for (int j=0; j<from.size(); j++)
+          point[j] = from[j] + distance/length*(to[j] - from[j]);
+        return point;
+      }
+      distance -= length;
+      index += step;
+    }
+    return points[index].positions;
+  }
+}
+
+TrajectoryProcessor::TrajectoryProcessor(const robot_model::RobotModelConstPtr &robot_model, const std::string &group_name,
+                                         double velocity_scaling, double acceleration_scaling, double waypoint_tolerance) :
+  robot_model_(robot_model),
+  group_name_(group_name),
+  waypoint_tolerance_(waypoint_tolerance),
+  smoothing_budget_(0.0),
+  resolution_(0.02)
+{
+  setVelocityScaling(velocity_scaling);
+  setAccelerationScaling(acceleration_scaling);
+}
+
+void TrajectoryProcessor::setVelocityScaling(double velocity_scaling)
+{
+  velocity_scaling_ = std::min(1.0, std::max(0.01, velocity_scaling));
+}
+
+void TrajectoryProcessor::setAccelerationScaling(double acceleration_scaling)
+{
+  acceleration_scaling_ = std::min(1.0, std::max(0.01, acceleration_scaling));
+}
+
+void TrajectoryProcessor::setSmoothing(double budget, double resolution)
+{
+  smoothing_budget_ = std::max(0.0, budget);
+  resolution_ = std::max(1e-3, resolution);
+}
+
+bool TrajectoryProcessor::isSegmentValid(const planning_scene::PlanningScene &scene, robot_state::RobotState &state, const std::vector<std::string> &joint_names,
+                                         const std::vector<double> &from, const std::vector<double> &to) const
+{
+  // Check the end first, the beginning is usually an already checked waypoint
+  int nb_steps = std::max(1, (int)std::ceil(jointDistance(from, to) / resolution_));
+  std::vector<double> positions(from.size());
+  for (int k=nb_steps; k>0; k--){
+    double s = (double)k / nb_steps;
+    for (int j=0; j<from.size(); j++)
+      positions[j] = from[j] + s*(to[j] - from[j]);
+    state.setVariablePositions(joint_names, positions);
+    state.update();
+    if (!scene.isStateValid(state, group_name_))
+      return false;
+  }
+  return true;
+}
+
+int TrajectoryProcessor::shortcut(const planning_scene::PlanningScene &scene, trajectory_msgs::JointTrajectory &trajectory, const ros::WallTime &deadline)
+{
+  std::vector<trajectory_msgs::JointTrajectoryPoint> &points = trajectory.points;
+  robot_state::RobotState state(scene.getCurrentState());
+  int nb_shortcuts = 0, nb_useless = 0;
+  
+  // Stop early when random attempts keep failing, the path is then about as short as it gets
+  while (points.size() > 2 && ros::WallTime::now() < deadline && nb_useless < 10*(int)points.size()){
+    boost::random::uniform_int_distribution<int> first_dist(0, points.size()-3);
+    int first = first_dist(random_generator_);
+    boost::random::uniform_int_distribution<int> last_dist(first+2, points.size()-1);
+    int last = last_dist(random_generator_);
+    
+    double straight = jointDistance(points[first].positions, points[last].positions);
+    if (straight >= pathLength(points, first, last) - 1e-6 || 
+        !isSegmentValid(scene, state, trajectory.joint_names, points[first].positions, points[last].positions)){
+      nb_useless++;
+      continue;
+    }
+    points.erase(points.begin()+first+1, points.begin()+last);
+    nb_shortcuts++;
+    nb_useless = 0;
+  }
+  return nb_shortcuts;
+}
+
+int TrajectoryProcessor::smooth(const planning_scene::PlanningScene &scene, trajectory_msgs::JointTrajectory &trajectory, const ros::WallTime &deadline)
+{
+  std::vector<trajectory_msgs::JointTrajectoryPoint> &points = trajectory.points;
+  robot_state::RobotState state(scene.getCurrentState());
+  int nb_moved = 0;
+  bool moved = true;
+  
+  // Passes over the path until nothing moves by more than the check resolution
+  while (moved && ros::WallTime::now() < deadline){
+    moved = false;
+    for (int i=1; i+1<points.size() && ros::WallTime::now() < deadline; i++){
+      const std::vector<double> &previous = points[i-1].positions;
+      const std::vector<double> &next = points[i+1].positions;
+      std::vector<double> candidate(points[i].positions.size());
+      for (int j=0; j<candidate.size(); j++)
+        candidate[j] = 0.5*points[i].positions[j] + 0.25*(previous[j] + next[j]);
+      if (jointDistance(candidate, points[i].positions) < resolution_)
+        continue;
+      if (!isSegmentValid(scene, state, trajectory.joint_names, previous, candidate) ||
+          !isSegmentValid(scene, state, trajectory.joint_names, candidate, next))
+        continue;
+      points[i].positions = candidate;
+      nb_moved++;
+      moved = true;
+    }
+  }
+  return nb_moved;
+}
+
+bool TrajectoryProcessor::blend(const moveit_msgs::RobotState &start_state, const std::vector<moveit_msgs::RobotTrajectory> &trajectories,
+                                const std::vector<double> &blend_radii, const planning_scene::PlanningScene &scene, moveit_msgs::RobotTrajectory &blended)
+{
+  if (trajectories.empty())
+    return false;
+  
+  // Each trajectory starts where the previous one ends, its first waypoint is dropped
+  ros::WallTime start = ros::WallTime::now();
+  trajectory_msgs::JointTrajectory &joint_trajectory = blended.joint_trajectory;
+  blended = moveit_msgs::RobotTrajectory();
+  joint_trajectory.joint_names = trajectories[0].joint_trajectory.joint_names;
+  std::vector<int> corners;
+  for (int i=0; i<trajectories.size(); i++){
+    const trajectory_msgs::JointTrajectory &piece = trajectories[i].joint_trajectory;
+    if (piece.joint_names != joint_trajectory.joint_names){
+      ROS_ERROR("Trajectory %d does not move the same joints, it cannot be blended", i);
+      return false;
+    }
+    int first = joint_trajectory.points.empty() ? 0 : 1;
+    for (int k=first; k<piece.points.size(); k++){
+      joint_trajectory.points.push_back(trajectory_msgs::JointTrajectoryPoint());
+      joint_trajectory.points.back().positions = piece.points[k].positions;
+    }
+    if (i+1 < trajectories.size())
+      corners.push_back(joint_trajectory.points.size()-1);
+  }
+  
+  // A corner takes at most half of the path on each side, so that the arcs do not overlap
+  std::vector<double> radii(corners.size());
+  for (int i=0; i<corners.size(); i++){
+    int previous = i > 0 ? corners[i-1] : 0;
+    int next = i+1 < corners.size() ? corners[i+1] : joint_trajectory.points.size()-1;
+    radii[i] = std::min(blend_radii[i], 0.5*std::min(pathLength(joint_trajectory.points, previous, corners[i]),
+                                                     pathLength(joint_trajectory.points, corners[i], next)));
+  }
+  
+  // The last corners are rounded first, the indices of the previous ones stay valid
+  robot_state::RobotState state(scene.getCurrentState());
+  int nb_rounded = 0;
+  for (int i=corners.size()-1; i>=0; i--){
+    if (radii[i] > resolution_ && roundCorner(scene, state, joint_trajectory, corners[i], radii[i]))
+      nb_rounded++;
+  }
+  
+  // Timed as one trajectory, the velocity only drops at the corners as much as their angle requires
+  robot_state::RobotState reference_state(robot_model_);
+  reference_state.setToDefaultValues();
+  robot_state::robotStateMsgToRobotState(start_state, reference_state);
+  robot_trajectory::RobotTrajectory robot_trajectory(robot_model_, group_name_);
+  robot_trajectory.setRobotTrajectoryMsg(reference_state, blended);
+  if (!time_parameterization_.computeTimeStamps(robot_trajectory, velocity_scaling_, acceleration_scaling_)){
+    ROS_ERROR("Time parameterization of the blended trajectory failed");
+    return false;
+  }
+  robot_trajectory.getRobotTrajectoryMsg(blended);
+  
+  ROS_INFO("Blended %zu trajectories in %.3f s: %d/%zu corners rounded, duration %.2f s",
+           trajectories.size(), (ros::WallTime::now() - start).toSec(), nb_rounded, corners.size(),
+           joint_trajectory.points.back().time_from_start.toSec());
+  return true;
+}
+
+bool TrajectoryProcessor::roundCorner(const planning_scene::PlanningScene &scene, robot_state::RobotState &state, trajectory_msgs::JointTrajectory &trajectory,
+                                      int corner, double radius)
+{
+  std::vector<trajectory_msgs::JointTrajectoryPoint> &points = trajectory.points;
+  int first, last;
+  std::vector<double> entry = walkPath(points, corner, -1, radius, first);
+  std::vector<double> exit = walkPath(points, corner, 1, radius, last);
+  
+  // Quadratic Bezier from the entry to the exit point with the corner as control point,
+  // it is tangent to the path at both ends
+  const std::vector<double> &control = points[corner].positions;
+  int nb_steps = std::max(2, (int)std::ceil(2.0*radius / resolution_));
+  std::vector<trajectory_msgs::JointTrajectoryPoint> arc(nb_steps+1);
+  for (int k=0; k<=nb_steps; k++){
+    double s = (double)k / nb_steps;
+    arc[k].positions.resize(control.size());
+    for (int j=0; j<control.size(); j++)
+      arc[k].positions[j] = (1.0-s)*(1.0-s)*entry[j] + 2.0*(1.0-s)*s*control[j] + s*s*exit[j];
+    if (k > 0 && !isSegmentValid(scene, state, trajectory.joint_names, arc[k-1].positions, arc[k].positions)){
+      ROS_WARN("Corner %d of the blended trajectory is kept, its rounding is in collision", corner);
+      return false;
+    }
+  }
+  
+  // The waypoints walked through are replaced by the arc, which starts at the entry and ends at the exit point
+  points.erase(points.begin()+first, points.begin()+last+1);
+  points.insert(points.begin()+first, arc.begin(), arc.end());
+  return true;
+}
+
+int TrajectoryProcessor::removeRedundantWaypoints(trajectory_msgs::JointTrajectory &trajectory) const
+{
+  std::vector<trajectory_msgs::JointTrajectoryPoint> &points = trajectory.points;
+  if (points.size() < 3)
+    return 0;
+  
+  // The first and last waypoints are always kept. A waypoint is dropped when it and all the
+  // waypoints dropped since the last kept one lie on the segment from the last kept one to the next
+  std::vector<trajectory_msgs::JointTrajectoryPoint> kept;
+  kept.push_back(points.front());
+  int last_kept = 0;
+  for (int i=1; i+1<points.size(); i++){
+    bool redundant = true;
+    for (int k=last_kept+1; k<=i && redundant; k++)
+      redundant = distanceToSegment(points[last_kept].positions, points[k].positions, points[i+1].positions) <= waypoint_tolerance_;
+    if (!redundant){
+      kept.push_back(points[i]);
+      last_kept = i;
+    }
+  }
+  kept.push_back(points.back());
+  
+  int nb_removed = points.size() - kept.size();
+  points.swap(kept);
+  return nb_removed;
+}
+
+bool TrajectoryProcessor::process(const moveit_msgs::RobotState &start_state, moveit_msgs::RobotTrajectory &trajectory,
+                                  const planning_scene::PlanningSceneConstPtr &scene)
+{
+  trajectory_msgs::JointTrajectory &joint_trajectory = trajectory.joint_trajectory;
+  if (joint_trajectory.points.empty())
+    return true;
+  
+  ros::WallTime start = ros::WallTime::now();
+  int nb_points = joint_trajectory.points.size();
+  double initial_length = pathLength(joint_trajectory.points, 0, nb_points-1);
+  double initial_duration = joint_trajectory.points.back().time_from_start.toSec();
+  int nb_removed = removeRedundantWaypoints(joint_trajectory);
+  
+  // Shortcut first, then spend what remains of the budget on smoothing
+  int nb_shortcuts = 0, nb_smoothed = 0;
+  if (scene && smoothing_budget_ > 0.0){
+    ros::WallTime deadline = start + ros::WallDuration(smoothing_budget_);
+    nb_shortcuts = shortcut(*scene, joint_trajectory, start + ros::WallDuration(smoothing_budget_/2.0));
+    nb_smoothed = smooth(*scene, joint_trajectory, deadline);
+  }
+  
+  // The time parameterization works on a robot trajectory, from the start state
+  robot_state::RobotState reference_state(robot_model_);
+  reference_state.setToDefaultValues();
+  robot_state::robotStateMsgToRobotState(start_state, reference_state);
+  robot_trajectory::RobotTrajectory robot_trajectory(robot_model_, group_name_);
+  robot_trajectory.setRobotTrajectoryMsg(reference_state, trajectory);
+  if (!time_parameterization_.computeTimeStamps(robot_trajectory, velocity_scaling_, acceleration_scaling_)){
+    ROS_ERROR("Time parameterization of the trajectory failed");
+    return false;
+  }
+  robot_trajectory.getRobotTrajectoryMsg(trajectory);
+  
+  ROS_INFO("Trajectory processed in %.3f s: %d/%d waypoints removed, %d shortcuts, %d waypoints smoothed, "
+           "length %.3f rad -> %.3f rad, duration %.2f s -> %.2f s",
+           (ros::WallTime::now() - start).toSec(), nb_removed, nb_points, nb_shortcuts, nb_smoothed,
+           initial_length, pathLength(joint_trajectory.points, 0, joint_trajectory.points.size()-1),
+           initial_duration, joint_trajectory.points.back().time_from_start.toSec());
+  return true;
+}